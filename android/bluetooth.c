@@ -40,6 +40,7 @@
 #include "lib/mgmt.h"
 #include "src/shared/util.h"
 #include "src/shared/mgmt.h"
+#include "lib/uuid.h"
 #include "src/uuid-helper.h"
 #include "src/eir.h"
 #include "lib/sdp.h"
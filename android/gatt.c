@@ -1754,23 +1754,21 @@ static void send_client_descr_notify(int32_t status, int32_t conn_id,
 static void cache_all_descr(const uint8_t *pdu, guint16 len,
 							struct queue *cache)
 {
-	struct att_data_list *list;
+	struct att_data_iter iter;
+	const uint8_t *value;
 	guint8 format;
 	int i;
 
-	list = dec_find_info_resp(pdu, len, &format);
-	if (!list)
+	if (!dec_find_info_resp_iter(pdu, len, &format, &iter))
 		return;
 
-	for (i = 0; i < list->num; i++) {
+	for (i = 0; (value = att_data_iter_next(&iter)); i++) {
 		char uuidstr[MAX_LEN_UUID_STR];
 		struct descriptor *descr;
 		bt_uuid_t uuid128;
 		uint16_t handle;
-		uint8_t *value;
 		bt_uuid_t uuid;
 
-		value = list->data[i];
 		handle = get_le16(value);
 
 		if (format == ATT_FIND_INFO_RESP_FMT_16BIT) {
@@ -1797,8 +1795,6 @@ static void cache_all_descr(const uint8_t *pdu, guint16 len,
 		if (!queue_push_tail(cache, descr))
 			free(descr);
 	}
-
-	att_data_list_free(list);
 }
 
 struct discover_desc_data {
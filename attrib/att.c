@@ -97,35 +97,65 @@ const char *att_ecode2str(uint8_t status)
 
 void att_data_list_free(struct att_data_list *list)
 {
-	if (list == NULL)
-		return;
-
-	if (list->data) {
-		int i;
-		for (i = 0; i < list->num; i++)
-			g_free(list->data[i]);
-	}
-
-	g_free(list->data);
 	g_free(list);
 }
 
+/*
+ * The list, the entry pointers and the entries themselves share a single
+ * allocation: the pointer array follows the list and the entries follow
+ * the pointer array back to back.
+ */
 struct att_data_list *att_data_list_alloc(uint16_t num, uint16_t len)
 {
 	struct att_data_list *list;
+	uint8_t *entries;
 	int i;
 
 	if (len > UINT8_MAX)
 		return NULL;
 
-	list = g_new0(struct att_data_list, 1);
+	list = g_malloc0(sizeof(*list) + num * (sizeof(uint8_t *) + len));
 	list->len = len;
 	list->num = num;
 
-	list->data = g_malloc0(sizeof(uint8_t *) * num);
+	list->data = (uint8_t **) (list + 1);
+	entries = (uint8_t *) (list->data + num);
 
 	for (i = 0; i < num; i++)
-		list->data[i] = g_malloc0(sizeof(uint8_t) * len);
+		list->data[i] = entries + i * len;
+
+	return list;
+}
+
+const uint8_t *att_data_iter_next(struct att_data_iter *iter)
+{
+	const uint8_t *entry;
+
+	if (iter->num == 0)
+		return NULL;
+
+	entry = iter->ptr;
+
+	iter->ptr += iter->len;
+	iter->num--;
+
+	return entry;
+}
+
+static struct att_data_list *att_data_list_from_iter(
+						struct att_data_iter *iter)
+{
+	struct att_data_list *list;
+	const uint8_t *entry;
+	int i;
+
+	list = att_data_list_alloc(iter->num, iter->len);
+	if (list == NULL)
+		return NULL;
+
+	/* The entries are contiguous in the PDU as in the list */
+	for (i = 0; (entry = att_data_iter_next(iter)); i++)
+		memcpy(list->data[i], entry, list->len);
 
 	return list;
 }
@@ -227,15 +257,13 @@ uint16_t enc_read_by_grp_resp(struct att_data_list *list, uint8_t *pdu,
 	return w;
 }
 
-struct att_data_list *dec_read_by_grp_resp(const uint8_t *pdu, size_t len)
+uint16_t dec_read_by_grp_resp_iter(const uint8_t *pdu, size_t len,
+						struct att_data_iter *iter)
 {
-	struct att_data_list *list;
-	const uint8_t *ptr;
-	uint16_t elen, num;
-	int i;
+	uint16_t elen;
 
 	if (pdu[0] != ATT_OP_READ_BY_GROUP_RESP)
-		return NULL;
+		return 0;
 
 	/* PDU must contain at least:
 	 * - Attribute Opcode (1 octet)
@@ -245,30 +273,32 @@ struct att_data_list *dec_read_by_grp_resp(const uint8_t *pdu, size_t len)
 	 *   - End Group Handle (2 octets)
 	 *   - Attribute Value (at least 1 octet) */
 	if (len < 7)
-		return NULL;
+		return 0;
 
 	elen = pdu[1];
 	/* Minimum Attribute Data List size */
 	if (elen < 5)
-		return NULL;
+		return 0;
 
 	/* Reject incomplete Attribute Data List */
 	if ((len - 2) % elen)
-		return NULL;
+		return 0;
 
-	num = (len - 2) / elen;
-	list = att_data_list_alloc(num, elen);
-	if (list == NULL)
-		return NULL;
+	iter->ptr = &pdu[2];
+	iter->num = (len - 2) / elen;
+	iter->len = elen;
 
-	ptr = &pdu[2];
+	return iter->num;
+}
 
-	for (i = 0; i < num; i++) {
-		memcpy(list->data[i], ptr, list->len);
-		ptr += list->len;
-	}
+struct att_data_list *dec_read_by_grp_resp(const uint8_t *pdu, size_t len)
+{
+	struct att_data_iter iter;
 
-	return list;
+	if (!dec_read_by_grp_resp_iter(pdu, len, &iter))
+		return NULL;
+
+	return att_data_list_from_iter(&iter);
 }
 
 uint16_t enc_find_by_type_req(uint16_t start, uint16_t end, bt_uuid_t *uuid,
@@ -472,15 +502,13 @@ uint16_t enc_read_by_type_resp(struct att_data_list *list, uint8_t *pdu,
 	return w;
 }
 
-struct att_data_list *dec_read_by_type_resp(const uint8_t *pdu, size_t len)
+uint16_t dec_read_by_type_resp_iter(const uint8_t *pdu, size_t len,
+						struct att_data_iter *iter)
 {
-	struct att_data_list *list;
-	const uint8_t *ptr;
-	uint16_t elen, num;
-	int i;
+	uint16_t elen;
 
 	if (pdu[0] != ATT_OP_READ_BY_TYPE_RESP)
-		return NULL;
+		return 0;
 
 	/* PDU must contain at least:
 	 * - Attribute Opcode (1 octet)
@@ -489,30 +517,32 @@ struct att_data_list *dec_read_by_type_resp(const uint8_t *pdu, size_t len)
 	 *   - Attribute Handle (2 octets)
 	 *   - Attribute Value (at least 1 octet) */
 	if (len < 5)
-		return NULL;
+		return 0;
 
 	elen = pdu[1];
 	/* Minimum Attribute Data List size */
 	if (elen < 3)
-		return NULL;
+		return 0;
 
 	/* Reject incomplete Attribute Data List */
 	if ((len - 2) % elen)
-		return NULL;
+		return 0;
 
-	num = (len - 2) / elen;
-	list = att_data_list_alloc(num, elen);
-	if (list == NULL)
-		return NULL;
+	iter->ptr = &pdu[2];
+	iter->num = (len - 2) / elen;
+	iter->len = elen;
 
-	ptr = &pdu[2];
+	return iter->num;
+}
 
-	for (i = 0; i < num; i++) {
-		memcpy(list->data[i], ptr, list->len);
-		ptr += list->len;
-	}
+struct att_data_list *dec_read_by_type_resp(const uint8_t *pdu, size_t len)
+{
+	struct att_data_iter iter;
 
-	return list;
+	if (!dec_read_by_type_resp_iter(pdu, len, &iter))
+		return NULL;
+
+	return att_data_list_from_iter(&iter);
 }
 
 uint16_t enc_write_cmd(uint16_t handle, const uint8_t *value, size_t vlen,
@@ -843,13 +873,10 @@ uint16_t enc_find_info_resp(uint8_t format, struct att_data_list *list,
 	return w;
 }
 
-struct att_data_list *dec_find_info_resp(const uint8_t *pdu, size_t len,
-							uint8_t *format)
+uint16_t dec_find_info_resp_iter(const uint8_t *pdu, size_t len,
+				uint8_t *format, struct att_data_iter *iter)
 {
-	struct att_data_list *list;
-	uint8_t *ptr;
-	uint16_t elen, num;
-	int i;
+	uint16_t elen;
 
 	if (pdu == NULL)
 		return 0;
@@ -857,7 +884,7 @@ struct att_data_list *dec_find_info_resp(const uint8_t *pdu, size_t len,
 	if (format == NULL)
 		return 0;
 
-	if (pdu[0] != ATT_OP_FIND_INFO_RESP)
+	if (len < 2 || pdu[0] != ATT_OP_FIND_INFO_RESP)
 		return 0;
 
 	*format = pdu[1];
@@ -867,20 +894,22 @@ struct att_data_list *dec_find_info_resp(const uint8_t *pdu, size_t len,
 	else if (*format == 0x02)
 		elen += 16;
 
-	num = (len - 2) / elen;
+	iter->ptr = &pdu[2];
+	iter->num = (len - 2) / elen;
+	iter->len = elen;
 
-	ptr = (void *) &pdu[2];
+	return iter->num;
+}
 
-	list = att_data_list_alloc(num, elen);
-	if (list == NULL)
-		return NULL;
+struct att_data_list *dec_find_info_resp(const uint8_t *pdu, size_t len,
+							uint8_t *format)
+{
+	struct att_data_iter iter;
 
-	for (i = 0; i < num; i++) {
-		memcpy(list->data[i], ptr, list->len);
-		ptr += list->len;
-	}
+	if (!dec_find_info_resp_iter(pdu, len, format, &iter))
+		return NULL;
 
-	return list;
+	return att_data_list_from_iter(&iter);
 }
 
 uint16_t enc_notification(uint16_t handle, uint8_t *value, size_t vlen,
@@ -96,6 +96,16 @@ struct att_data_list {
 	uint8_t **data;
 };
 
+/*
+ * Entries of an Attribute Data List decoded in place: each entry returned
+ * by att_data_iter_next() points into the PDU passed to the decoder.
+ */
+struct att_data_iter {
+	const uint8_t *ptr;
+	uint16_t num;
+	uint16_t len;
+};
+
 struct att_range {
 	uint16_t start;
 	uint16_t end;
@@ -103,6 +113,7 @@ struct att_range {
 
 struct att_data_list *att_data_list_alloc(uint16_t num, uint16_t len);
 void att_data_list_free(struct att_data_list *list);
+const uint8_t *att_data_iter_next(struct att_data_iter *iter);
 
 const char *att_ecode2str(uint8_t status);
 uint16_t enc_read_by_grp_req(uint16_t start, uint16_t end, bt_uuid_t *uuid,
@@ -119,6 +130,8 @@ uint16_t dec_find_by_type_req(const uint8_t *pdu, size_t len, uint16_t *start,
 uint16_t enc_find_by_type_resp(GSList *ranges, uint8_t *pdu, size_t len);
 GSList *dec_find_by_type_resp(const uint8_t *pdu, size_t len);
 struct att_data_list *dec_read_by_grp_resp(const uint8_t *pdu, size_t len);
+uint16_t dec_read_by_grp_resp_iter(const uint8_t *pdu, size_t len,
+						struct att_data_iter *iter);
 uint16_t enc_read_by_type_req(uint16_t start, uint16_t end, bt_uuid_t *uuid,
 						uint8_t *pdu, size_t len);
 uint16_t dec_read_by_type_req(const uint8_t *pdu, size_t len, uint16_t *start,
@@ -130,6 +143,8 @@ uint16_t enc_write_cmd(uint16_t handle, const uint8_t *value, size_t vlen,
 uint16_t dec_write_cmd(const uint8_t *pdu, size_t len, uint16_t *handle,
 						uint8_t *value, size_t *vlen);
 struct att_data_list *dec_read_by_type_resp(const uint8_t *pdu, size_t len);
+uint16_t dec_read_by_type_resp_iter(const uint8_t *pdu, size_t len,
+						struct att_data_iter *iter);
 uint16_t enc_write_req(uint16_t handle, const uint8_t *value, size_t vlen,
 						uint8_t *pdu, size_t len);
 uint16_t dec_write_req(const uint8_t *pdu, size_t len, uint16_t *handle,
@@ -157,6 +172,8 @@ uint16_t enc_find_info_resp(uint8_t format, struct att_data_list *list,
 						uint8_t *pdu, size_t len);
 struct att_data_list *dec_find_info_resp(const uint8_t *pdu, size_t len,
 							uint8_t *format);
+uint16_t dec_find_info_resp_iter(const uint8_t *pdu, size_t len,
+				uint8_t *format, struct att_data_iter *iter);
 uint16_t enc_notification(uint16_t handle, uint8_t *value, size_t vlen,
 						uint8_t *pdu, size_t len);
 uint16_t enc_indication(uint16_t handle, uint8_t *value, size_t vlen,
@@ -73,6 +73,15 @@ struct discover_char {
 	void *user_data;
 };
 
+struct discover_desc {
+	int ref;
+	GAttrib *attrib;
+	uint16_t end;
+	GSList *descriptors;
+	gatt_cb_t cb;
+	void *user_data;
+};
+
 static void discover_primary_unref(void *data)
 {
 	struct discover_primary *dp = data;
@@ -139,6 +148,27 @@ static struct discover_char *discover_char_ref(struct discover_char *dc)
 	return dc;
 }
 
+static void discover_desc_unref(void *data)
+{
+	struct discover_desc *dd = data;
+
+	dd->ref--;
+
+	if (dd->ref > 0)
+		return;
+
+	g_slist_free_full(dd->descriptors, g_free);
+	g_attrib_unref(dd->attrib);
+	g_free(dd);
+}
+
+static struct discover_desc *discover_desc_ref(struct discover_desc *dd)
+{
+	dd->ref++;
+
+	return dd;
+}
+
 static void put_uuid_le(const bt_uuid_t *uuid, void *dst)
 {
 	if (uuid->type == BT_UUID16)
@@ -238,8 +268,9 @@ static void primary_all_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 							gpointer user_data)
 {
 	struct discover_primary *dp = user_data;
-	struct att_data_list *list;
-	unsigned int i, err;
+	struct att_data_iter iter;
+	const uint8_t *data;
+	unsigned int err;
 	uint16_t start, end;
 	uint8_t type;
 
@@ -248,24 +279,21 @@ static void primary_all_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 		goto done;
 	}
 
-	list = dec_read_by_grp_resp(ipdu, iplen);
-	if (list == NULL) {
+	if (!dec_read_by_grp_resp_iter(ipdu, iplen, &iter)) {
 		err = ATT_ECODE_IO;
 		goto done;
 	}
 
-	if (list->len == 6)
+	if (iter.len == 6)
 		type = BT_UUID16;
-	else if (list->len == 20)
+	else if (iter.len == 20)
 		type = BT_UUID128;
 	else {
-		att_data_list_free(list);
 		err = ATT_ECODE_INVALID_PDU;
 		goto done;
 	}
 
-	for (i = 0, end = 0; i < list->num; i++) {
-		const uint8_t *data = list->data[i];
+	for (end = 0; (data = att_data_iter_next(&iter));) {
 		struct gatt_primary *primary;
 		bt_uuid_t uuid128;
 
@@ -276,7 +304,6 @@ static void primary_all_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 
 		primary = g_try_new0(struct gatt_primary, 1);
 		if (!primary) {
-			att_data_list_free(list);
 			err = ATT_ECODE_INSUFF_RESOURCES;
 			goto done;
 		}
@@ -286,7 +313,6 @@ static void primary_all_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 		dp->primaries = g_slist_append(dp->primaries, primary);
 	}
 
-	att_data_list_free(list);
 	err = 0;
 
 	if (end != 0xffff) {
@@ -437,8 +463,8 @@ static void find_included_cb(uint8_t status, const uint8_t *pdu, uint16_t len,
 	struct included_discovery *isd = user_data;
 	uint16_t last_handle = isd->end_handle;
 	unsigned int err = status;
-	struct att_data_list *list;
-	int i;
+	struct att_data_iter iter;
+	const uint8_t *data;
 
 	if (err == ATT_ECODE_ATTR_NOT_FOUND)
 		err = 0;
@@ -446,26 +472,24 @@ static void find_included_cb(uint8_t status, const uint8_t *pdu, uint16_t len,
 	if (status)
 		goto done;
 
-	list = dec_read_by_type_resp(pdu, len);
-	if (list == NULL) {
+	if (!dec_read_by_type_resp_iter(pdu, len, &iter)) {
 		err = ATT_ECODE_IO;
 		goto done;
 	}
 
-	if (list->len != 6 && list->len != 8) {
+	if (iter.len != 6 && iter.len != 8) {
 		err = ATT_ECODE_IO;
-		att_data_list_free(list);
 		goto done;
 	}
 
-	for (i = 0; i < list->num; i++) {
+	while ((data = att_data_iter_next(&iter))) {
 		struct gatt_included *incl;
 
-		incl = included_from_buf(list->data[i], list->len);
+		incl = included_from_buf(data, iter.len);
 		last_handle = incl->handle;
 
 		/* 128 bit UUID, needs resolving */
-		if (list->len == 6) {
+		if (iter.len == 6) {
 			resolve_included_uuid(isd, incl);
 			continue;
 		}
@@ -473,8 +497,6 @@ static void find_included_cb(uint8_t status, const uint8_t *pdu, uint16_t len,
 		isd->includes = g_slist_append(isd->includes, incl);
 	}
 
-	att_data_list_free(list);
-
 	if (last_handle < isd->end_handle)
 		find_included(isd, last_handle + 1);
 
@@ -501,8 +523,9 @@ static void char_discovered_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 							gpointer user_data)
 {
 	struct discover_char *dc = user_data;
-	struct att_data_list *list;
-	unsigned int i, err = ATT_ECODE_ATTR_NOT_FOUND;
+	struct att_data_iter iter;
+	const uint8_t *value;
+	unsigned int err = ATT_ECODE_ATTR_NOT_FOUND;
 	uint16_t last = 0;
 	uint8_t type;
 
@@ -511,19 +534,17 @@ static void char_discovered_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 		goto done;
 	}
 
-	list = dec_read_by_type_resp(ipdu, iplen);
-	if (list == NULL) {
+	if (!dec_read_by_type_resp_iter(ipdu, iplen, &iter)) {
 		err = ATT_ECODE_IO;
 		goto done;
 	}
 
-	if (list->len == 7)
+	if (iter.len == 7)
 		type = BT_UUID16;
 	else
 		type = BT_UUID128;
 
-	for (i = 0; i < list->num; i++) {
-		uint8_t *value = list->data[i];
+	while ((value = att_data_iter_next(&iter))) {
 		struct gatt_char *chars;
 		bt_uuid_t uuid128;
 
@@ -536,7 +557,6 @@ static void char_discovered_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 
 		chars = g_try_new0(struct gatt_char, 1);
 		if (!chars) {
-			att_data_list_free(list);
 			err = ATT_ECODE_INSUFF_RESOURCES;
 			goto done;
 		}
@@ -549,8 +569,6 @@ static void char_discovered_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 									chars);
 	}
 
-	att_data_list_free(list);
-
 	if (last != 0 && (last + 1 < dc->end)) {
 		bt_uuid_t uuid;
 		guint16 oplen;
@@ -564,17 +582,31 @@ static void char_discovered_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 		oplen = enc_read_by_type_req(last + 1, dc->end, &uuid, buf,
 									buflen);
 
-		if (oplen == 0)
-			return;
+		if (oplen == 0) {
+			err = ATT_ECODE_IO;
+			goto done;
+		}
 
-		g_attrib_send(dc->attrib, 0, buf, oplen, char_discovered_cb,
-				discover_char_ref(dc), discover_char_unref);
+		if (g_attrib_send(dc->attrib, 0, buf, oplen,
+					char_discovered_cb,
+					discover_char_ref(dc),
+					discover_char_unref) == 0) {
+			discover_char_unref(dc);
+			err = ATT_ECODE_IO;
+			goto done;
+		}
 
 		return;
 	}
 
 done:
-	err = (dc->characteristics ? 0 : err);
+	/*
+	 * Success means the whole range was discovered, a request failing
+	 * part way is reported as an error together with the partial list.
+	 */
+	if (err == ATT_ECODE_ATTR_NOT_FOUND && dc->characteristics)
+		err = 0;
+
 	dc->cb(err, dc->characteristics, dc->user_data);
 }
 
@@ -898,6 +930,113 @@ guint gatt_discover_char_desc(GAttrib *attrib, uint16_t start, uint16_t end,
 	return g_attrib_send(attrib, 0, buf, plen, func, user_data, NULL);
 }
 
+static void desc_discovered_cb(guint8 status, const guint8 *ipdu,
+					guint16 iplen, gpointer user_data)
+{
+	struct discover_desc *dd = user_data;
+	struct att_data_iter iter;
+	const uint8_t *value;
+	unsigned int err = ATT_ECODE_ATTR_NOT_FOUND;
+	uint16_t last = 0;
+	uint8_t format;
+
+	if (status) {
+		err = status;
+		goto done;
+	}
+
+	if (!dec_find_info_resp_iter(ipdu, iplen, &format, &iter) ||
+				(format != ATT_FIND_INFO_RESP_FMT_16BIT &&
+				format != ATT_FIND_INFO_RESP_FMT_128BIT)) {
+		err = ATT_ECODE_IO;
+		goto done;
+	}
+
+	while ((value = att_data_iter_next(&iter))) {
+		struct gatt_desc *desc;
+		bt_uuid_t uuid128;
+
+		desc = g_try_new0(struct gatt_desc, 1);
+		if (!desc) {
+			err = ATT_ECODE_INSUFF_RESOURCES;
+			goto done;
+		}
+
+		last = get_le16(value);
+
+		if (format == ATT_FIND_INFO_RESP_FMT_16BIT)
+			get_uuid128(BT_UUID16, &value[2], &uuid128);
+		else
+			get_uuid128(BT_UUID128, &value[2], &uuid128);
+
+		desc->handle = last;
+		bt_uuid_to_string(&uuid128, desc->uuid, sizeof(desc->uuid));
+		dd->descriptors = g_slist_append(dd->descriptors, desc);
+	}
+
+	if (last != 0 && last < dd->end) {
+		guint16 oplen;
+		size_t buflen;
+		uint8_t *buf;
+
+		buf = g_attrib_get_buffer(dd->attrib, &buflen);
+
+		oplen = enc_find_info_req(last + 1, dd->end, buf, buflen);
+		if (oplen == 0) {
+			err = ATT_ECODE_IO;
+			goto done;
+		}
+
+		if (g_attrib_send(dd->attrib, 0, buf, oplen,
+					desc_discovered_cb,
+					discover_desc_ref(dd),
+					discover_desc_unref) == 0) {
+			discover_desc_unref(dd);
+			err = ATT_ECODE_IO;
+			goto done;
+		}
+
+		return;
+	}
+
+done:
+	/* As with characteristics, success means the whole range was read */
+	if (err == ATT_ECODE_ATTR_NOT_FOUND && dd->descriptors)
+		err = 0;
+
+	dd->cb(err, dd->descriptors, dd->user_data);
+}
+
+guint gatt_discover_desc(GAttrib *attrib, uint16_t start, uint16_t end,
+					gatt_cb_t func, gpointer user_data)
+{
+	size_t buflen;
+	uint8_t *buf = g_attrib_get_buffer(attrib, &buflen);
+	struct discover_desc *dd;
+	guint16 plen;
+	guint id;
+
+	plen = enc_find_info_req(start, end, buf, buflen);
+	if (plen == 0)
+		return 0;
+
+	dd = g_try_new0(struct discover_desc, 1);
+	if (dd == NULL)
+		return 0;
+
+	dd->attrib = g_attrib_ref(attrib);
+	dd->cb = func;
+	dd->user_data = user_data;
+	dd->end = end;
+
+	id = g_attrib_send(attrib, 0, buf, plen, desc_discovered_cb,
+				discover_desc_ref(dd), discover_desc_unref);
+	if (id == 0)
+		discover_desc_unref(dd);
+
+	return id;
+}
+
 guint gatt_write_cmd(GAttrib *attrib, uint16_t handle, const uint8_t *value,
 			int vlen, GDestroyNotify notify, gpointer user_data)
 {
@@ -29,6 +29,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
 #include <glib.h>
 
 #include <stdio.h>
@@ -44,6 +46,9 @@
 
 #define GATT_TIMEOUT 30
 
+/* Upper bound of PDUs without response written per G_IO_OUT wakeup */
+#define GATTRIB_MAX_BATCH 32
+
 struct _GAttrib {
 	GIOChannel *io;
 	int refs;
@@ -54,11 +59,15 @@ struct _GAttrib {
 	guint timeout_watch;
 	GQueue *requests;
 	GQueue *responses;
+	GQueue *commands;
 	GSList *events;
 	guint next_cmd_id;
 	GDestroyNotify destroy;
 	gpointer destroy_user_data;
 	bool stale;
+	guint queued;
+	guint sent;
+	guint dropped;
 };
 
 struct command {
@@ -183,11 +192,24 @@ static void attrib_destroy(GAttrib *attrib)
 	GSList *l;
 	struct command *c;
 
-	while ((c = g_queue_pop_head(attrib->requests)))
+	while ((c = g_queue_pop_head(attrib->requests))) {
+		if (!c->sent)
+			attrib->dropped++;
+		command_destroy(c);
+	}
+
+	while ((c = g_queue_pop_head(attrib->responses))) {
+		attrib->dropped++;
 		command_destroy(c);
+	}
 
-	while ((c = g_queue_pop_head(attrib->responses)))
+	while ((c = g_queue_pop_head(attrib->commands))) {
+		attrib->dropped++;
 		command_destroy(c);
+	}
+
+	DBG("%p: queued %u sent %u dropped %u", attrib, attrib->queued,
+					attrib->sent, attrib->dropped);
 
 	g_queue_free(attrib->requests);
 	attrib->requests = NULL;
@@ -195,6 +217,9 @@ static void attrib_destroy(GAttrib *attrib)
 	g_queue_free(attrib->responses);
 	attrib->responses = NULL;
 
+	g_queue_free(attrib->commands);
+	attrib->commands = NULL;
+
 	for (l = attrib->events; l; l = l->next)
 		event_destroy(l->data);
 
@@ -288,63 +313,124 @@ done:
 	return FALSE;
 }
 
-static gboolean can_write_data(GIOChannel *io, GIOCondition cond,
-								gpointer data)
+/*
+ * Write queued PDUs which don't expect a response until the queue is empty,
+ * the socket would block or the batch limit is reached. Returns the number
+ * of PDUs left in the batch budget or a negative error.
+ */
+static int flush_queue(struct _GAttrib *attrib, GQueue *queue, int fd,
+								int budget)
 {
-	struct _GAttrib *attrib = data;
 	struct command *cmd;
-	GError *gerr = NULL;
-	gsize len;
-	GIOStatus iostat;
-	GQueue *queue;
 
-	if (attrib->stale)
-		return FALSE;
+	while (budget > 0 && (cmd = g_queue_peek_head(queue))) {
+		ssize_t written;
 
-	if (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL))
-		return FALSE;
+		written = send(fd, cmd->pdu, cmd->len, MSG_DONTWAIT);
+		if (written < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
 
-	queue = attrib->responses;
-	cmd = g_queue_peek_head(queue);
-	if (cmd == NULL) {
-		queue = attrib->requests;
-		cmd = g_queue_peek_head(queue);
+			if (errno == EINTR)
+				continue;
+
+			return -errno;
+		}
+
+		g_queue_pop_head(queue);
+		attrib->sent++;
+		command_destroy(cmd);
+
+		budget--;
 	}
-	if (cmd == NULL)
-		return FALSE;
+
+	return budget;
+}
+
+/*
+ * Write the request at the head of the queue unless it is already waiting
+ * for its response. Returns a negative error if the write failed.
+ */
+static int flush_request(struct _GAttrib *attrib, int fd)
+{
+	struct command *cmd;
+	ssize_t written;
+
+	cmd = g_queue_peek_head(attrib->requests);
 
 	/*
 	 * Verify that we didn't already send this command. This can only
 	 * happen with elementes from attrib->requests.
 	 */
-	if (cmd->sent)
-		return FALSE;
+	if (cmd == NULL || cmd->sent)
+		return 0;
 
-	iostat = g_io_channel_write_chars(io, (char *) cmd->pdu, cmd->len,
-								&len, &gerr);
-	if (iostat != G_IO_STATUS_NORMAL) {
-		if (gerr) {
-			error("%s", gerr->message);
-			g_error_free(gerr);
-		}
+	do {
+		written = send(fd, cmd->pdu, cmd->len, MSG_DONTWAIT);
+	} while (written < 0 && errno == EINTR);
 
-		return FALSE;
-	}
+	if (written < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
 
-	if (cmd->expected == 0) {
-		g_queue_pop_head(queue);
-		command_destroy(cmd);
-
-		return TRUE;
+		return -errno;
 	}
 
+	attrib->sent++;
+
 	cmd->sent = true;
 
 	if (attrib->timeout_watch == 0)
 		attrib->timeout_watch = g_timeout_add_seconds(GATT_TIMEOUT,
 						disconnect_timeout, attrib);
 
-	return FALSE;
+	return 0;
+}
+
+static gboolean can_write_data(GIOChannel *io, GIOCondition cond,
+								gpointer data)
+{
+	struct _GAttrib *attrib = data;
+	struct command *cmd;
+	int fd, err;
+
+	if (attrib->stale)
+		return FALSE;
+
+	if (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL))
+		return FALSE;
+
+	fd = g_io_channel_unix_get_fd(io);
+
+	/*
+	 * A pending request goes first on every wakeup, so that a steady
+	 * stream of PDUs without response can't hold it back forever.
+	 */
+	err = flush_request(attrib, fd);
+
+	/*
+	 * Responses and PDUs without response (Write Commands, Notifications)
+	 * don't wait for anything, so drain as many as the socket accepts.
+	 */
+	if (err == 0)
+		err = flush_queue(attrib, attrib->responses, fd,
+							GATTRIB_MAX_BATCH);
+	if (err > 0)
+		err = flush_queue(attrib, attrib->commands, fd, err);
+
+	if (err < 0) {
+		error("write failed: %s (%d)", strerror(-err), -err);
+		return FALSE;
+	}
+
+	if (!g_queue_is_empty(attrib->responses) ||
+					!g_queue_is_empty(attrib->commands))
+		return TRUE;
+
+	/* Keep waiting if the socket didn't take the request yet */
+	cmd = g_queue_peek_head(attrib->requests);
+
+	return cmd && !cmd->sent;
 }
 
 static void destroy_sender(gpointer data)
@@ -460,7 +546,8 @@ static gboolean received_data(GIOChannel *io, GIOCondition cond, gpointer data)
 
 done:
 	if (!g_queue_is_empty(attrib->requests) ||
-					!g_queue_is_empty(attrib->responses))
+					!g_queue_is_empty(attrib->responses) ||
+					!g_queue_is_empty(attrib->commands))
 		wake_up_sender(attrib);
 
 	if (cmd) {
@@ -504,6 +591,7 @@ GAttrib *g_attrib_new(GIOChannel *io)
 	attrib->io = g_io_channel_ref(io);
 	attrib->requests = g_queue_new();
 	attrib->responses = g_queue_new();
+	attrib->commands = g_queue_new();
 
 	attrib->read_watch = g_io_add_watch(attrib->io,
 			G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
@@ -540,21 +628,26 @@ guint g_attrib_send(GAttrib *attrib, guint id, const guint8 *pdu, guint16 len,
 
 	if (is_response(opcode))
 		queue = attrib->responses;
+	else if (c->expected == 0)
+		queue = attrib->commands;
 	else
 		queue = attrib->requests;
 
 	if (id) {
 		c->id = id;
-		if (!is_response(opcode))
+		if (queue == attrib->requests)
 			g_queue_push_head(queue, c);
 		else
-			/* Don't re-order responses even if an ID is given */
+			/* Don't re-order PDUs without response even if an ID
+			 * is given */
 			g_queue_push_tail(queue, c);
 	} else {
 		c->id = ++attrib->next_cmd_id;
 		g_queue_push_tail(queue, c);
 	}
 
+	attrib->queued++;
+
 	/*
 	 * If a command was added to the queue and it was empty before, wake up
 	 * the sender. If the sender was already woken up by the second queue,
@@ -595,6 +688,14 @@ gboolean g_attrib_cancel(GAttrib *attrib, guint id)
 					command_cmp_by_id);
 	}
 
+	if (l == NULL) {
+		queue = attrib->commands;
+		if (!queue)
+			return FALSE;
+		l = g_queue_find_custom(queue, GUINT_TO_POINTER(id),
+					command_cmp_by_id);
+	}
+
 	if (l == NULL)
 		return FALSE;
 
@@ -604,13 +705,14 @@ gboolean g_attrib_cancel(GAttrib *attrib, guint id)
 		cmd->func = NULL;
 	else {
 		g_queue_remove(queue, cmd);
+		attrib->dropped++;
 		command_destroy(cmd);
 	}
 
 	return TRUE;
 }
 
-static gboolean cancel_all_per_queue(GQueue *queue)
+static gboolean cancel_all_per_queue(GAttrib *attrib, GQueue *queue)
 {
 	struct command *c, *head = NULL;
 	gboolean first = TRUE;
@@ -627,6 +729,7 @@ static gboolean cancel_all_per_queue(GQueue *queue)
 		}
 
 		first = FALSE;
+		attrib->dropped++;
 		command_destroy(c);
 	}
 
@@ -645,8 +748,9 @@ gboolean g_attrib_cancel_all(GAttrib *attrib)
 	if (attrib == NULL)
 		return FALSE;
 
-	ret = cancel_all_per_queue(attrib->requests);
-	ret = cancel_all_per_queue(attrib->responses) && ret;
+	ret = cancel_all_per_queue(attrib, attrib->requests);
+	ret = cancel_all_per_queue(attrib, attrib->responses) && ret;
+	ret = cancel_all_per_queue(attrib, attrib->commands) && ret;
 
 	return ret;
 }
@@ -657,6 +761,19 @@ gboolean g_attrib_set_debug(GAttrib *attrib,
 	return TRUE;
 }
 
+void g_attrib_get_stats(GAttrib *attrib, guint *queued, guint *sent,
+								guint *dropped)
+{
+	if (queued)
+		*queued = attrib->queued;
+
+	if (sent)
+		*sent = attrib->sent;
+
+	if (dropped)
+		*dropped = attrib->dropped;
+}
+
 uint8_t *g_attrib_get_buffer(GAttrib *attrib, size_t *len)
 {
 	if (len == NULL)
@@ -67,6 +67,10 @@ guint g_attrib_register(GAttrib *attrib, guint8 opcode, guint16 handle,
 
 gboolean g_attrib_is_encrypted(GAttrib *attrib);
 
+/* PDUs queued, written and discarded unsent since the channel was created */
+void g_attrib_get_stats(GAttrib *attrib, guint *queued, guint *sent,
+							guint *dropped);
+
 uint8_t *g_attrib_get_buffer(GAttrib *attrib, size_t *len);
 gboolean g_attrib_set_mtu(GAttrib *attrib, int mtu);
 
@@ -299,6 +299,15 @@ void g_dbus_pending_property_error(GDBusPendingReply id, const char *name,
 void g_dbus_emit_property_changed(DBusConnection *connection,
 				const char *path, const char *interface,
 				const char *name);
+/*
+ * Emit PropertiesChanged for the given property (or, if name is NULL, for
+ * every property of the interface) at most once per interval milliseconds
+ * per object. Changes in between are folded into one delayed signal. An
+ * interval of 0 removes the limit. Only affects objects whose property
+ * changes were not yet emitted when this is called.
+ */
+void g_dbus_set_property_rate_limit(const char *interface, const char *name,
+							unsigned int interval);
 gboolean g_dbus_get_properties(DBusConnection *connection, const char *path,
 				const char *interface, DBusMessageIter *iter);
 
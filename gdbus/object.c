@@ -55,7 +55,7 @@ struct generic_data {
 	GSList *objects;
 	GSList *added;
 	GSList *removed;
-	guint process_id;
+	gboolean queued;
 	gboolean pending_prop;
 	char *introspect;
 	struct generic_data *parent;
@@ -67,10 +67,26 @@ struct interface_data {
 	const GDBusSignalTable *signals;
 	const GDBusPropertyTable *properties;
 	GSList *pending_prop;
+	GSList *limited_prop;
 	void *user_data;
 	GDBusDestroyFunction destroy;
 };
 
+struct property_limit {
+	char *interface;
+	char *name;
+	unsigned int interval;
+};
+
+struct limited_property {
+	struct generic_data *data;
+	struct interface_data *iface;
+	const GDBusPropertyTable *property;
+	unsigned int interval;
+	gint64 last;
+	guint timeout_id;
+};
+
 struct security_data {
 	GDBusPendingReply pending;
 	DBusMessage *message;
@@ -87,6 +103,8 @@ struct property_data {
 static int global_flags = 0;
 static struct generic_data *root;
 static GSList *pending = NULL;
+static guint pending_id = 0;
+static GSList *property_limits = NULL;
 
 static gboolean process_changes(gpointer user_data);
 static void process_properties_from_interface(struct generic_data *data,
@@ -494,6 +512,9 @@ static void reset_parent(gpointer data, gpointer user_data)
 	struct generic_data *parent = user_data;
 
 	child->parent = parent;
+
+	if (parent != NULL)
+		parent->objects = g_slist_prepend(parent->objects, child);
 }
 
 static void append_property(struct interface_data *iface,
@@ -632,16 +653,44 @@ static gboolean g_dbus_args_have_signature(const GDBusArgInfo *args,
 	return TRUE;
 }
 
+static gboolean process_pending(gpointer user_data)
+{
+	pending_id = 0;
+
+	/* process_changes removes the object from the head of the list */
+	while (pending != NULL)
+		process_changes(pending->data);
+
+	return FALSE;
+}
+
 static void add_pending(struct generic_data *data)
 {
-	if (data->process_id > 0)
+	if (data->queued)
 		return;
 
-	data->process_id = g_idle_add(process_changes, data);
+	data->queued = TRUE;
+
+	/*
+	 * Changes of all objects are processed from a single idle source so
+	 * that bursts touching many objects cost one main loop dispatch.
+	 */
+	if (pending_id == 0)
+		pending_id = g_idle_add(process_pending, NULL);
 
 	pending = g_slist_append(pending, data);
 }
 
+static void free_limited_property(gpointer user_data)
+{
+	struct limited_property *lp = user_data;
+
+	if (lp->timeout_id > 0)
+		g_source_remove(lp->timeout_id);
+
+	g_free(lp);
+}
+
 static gboolean remove_interface(struct generic_data *data, const char *name)
 {
 	struct interface_data *iface;
@@ -652,6 +701,9 @@ static gboolean remove_interface(struct generic_data *data, const char *name)
 
 	process_properties_from_interface(data, iface);
 
+	g_slist_free_full(iface->limited_prop, free_limited_property);
+	iface->limited_prop = NULL;
+
 	data->interfaces = g_slist_remove(data->interfaces, iface);
 
 	if (iface->destroy) {
@@ -723,9 +775,14 @@ static struct generic_data *invalidate_parent_data(DBusConnection *conn,
 							(void *) &child))
 		goto done;
 
-	if (child == NULL || g_slist_find(data->objects, child) != NULL)
+	/* child->parent is only ever set to an object listing the child */
+	if (child == NULL || child->parent == data)
 		goto done;
 
+	if (child->parent != NULL)
+		child->parent->objects = g_slist_remove(child->parent->objects,
+									child);
+
 	data->objects = g_slist_prepend(data->objects, child);
 	child->parent = data;
 
@@ -982,12 +1039,16 @@ static void emit_interfaces_removed(struct generic_data *data)
 
 static void remove_pending(struct generic_data *data)
 {
-	if (data->process_id > 0) {
-		g_source_remove(data->process_id);
-		data->process_id = 0;
-	}
+	if (!data->queued)
+		return;
+
+	data->queued = FALSE;
 
 	pending = g_slist_remove(pending, data);
+	if (pending == NULL && pending_id > 0) {
+		g_source_remove(pending_id);
+		pending_id = 0;
+	}
 }
 
 static gboolean process_changes(gpointer user_data)
@@ -1006,8 +1067,6 @@ static gboolean process_changes(gpointer user_data)
 	if (data->removed != NULL)
 		emit_interfaces_removed(data);
 
-	data->process_id = 0;
-
 	return FALSE;
 }
 
@@ -1019,11 +1078,8 @@ static void generic_unregister(DBusConnection *connection, void *user_data)
 	if (parent != NULL)
 		parent->objects = g_slist_remove(parent->objects, data);
 
-	if (data->process_id > 0) {
-		g_source_remove(data->process_id);
-		data->process_id = 0;
+	if (data->queued)
 		process_changes(data);
-	}
 
 	g_slist_foreach(data->objects, reset_parent, data->parent);
 	g_slist_free(data->objects);
@@ -1726,6 +1782,118 @@ static void process_property_changes(struct generic_data *data)
 	}
 }
 
+static void queue_property_changed(struct generic_data *data,
+					struct interface_data *iface,
+					const GDBusPropertyTable *property)
+{
+	if (g_slist_find(iface->pending_prop, (void *) property) != NULL)
+		return;
+
+	data->pending_prop = TRUE;
+	iface->pending_prop = g_slist_prepend(iface->pending_prop,
+						(void *) property);
+
+	add_pending(data);
+}
+
+static gboolean limited_property_timeout(gpointer user_data)
+{
+	struct limited_property *lp = user_data;
+
+	lp->timeout_id = 0;
+	lp->last = g_get_monotonic_time();
+
+	/* The value is read when the signal is built, so it is the latest */
+	queue_property_changed(lp->data, lp->iface, lp->property);
+
+	return FALSE;
+}
+
+static unsigned int find_property_limit(const char *interface,
+							const char *name)
+{
+	unsigned int interval = 0;
+	GSList *l;
+
+	for (l = property_limits; l != NULL; l = l->next) {
+		struct property_limit *limit = l->data;
+
+		if (!g_str_equal(limit->interface, interface))
+			continue;
+
+		/* A limit for the property wins over the interface wide one */
+		if (limit->name == NULL)
+			interval = limit->interval;
+		else if (g_str_equal(limit->name, name))
+			return limit->interval;
+	}
+
+	return interval;
+}
+
+static struct limited_property *find_limited_property(
+					struct interface_data *iface,
+					const GDBusPropertyTable *property)
+{
+	GSList *l;
+
+	for (l = iface->limited_prop; l != NULL; l = l->next) {
+		struct limited_property *lp = l->data;
+
+		if (lp->property == property)
+			return lp;
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns TRUE if the change must not be queued right away. A change
+ * arriving within the configured interval of the previous one is delayed
+ * until the interval has passed, and any further changes in the meantime
+ * are folded into that single delayed signal.
+ */
+static gboolean property_rate_limited(struct generic_data *data,
+					struct interface_data *iface,
+					const GDBusPropertyTable *property)
+{
+	struct limited_property *lp;
+	gint64 now, elapsed;
+
+	lp = find_limited_property(iface, property);
+	if (lp == NULL) {
+		lp = g_new0(struct limited_property, 1);
+		lp->data = data;
+		lp->iface = iface;
+		lp->property = property;
+		lp->interval = find_property_limit(iface->name, property->name);
+		lp->last = g_get_monotonic_time();
+
+		iface->limited_prop = g_slist_prepend(iface->limited_prop, lp);
+
+		return FALSE;
+	}
+
+	if (lp->interval == 0)
+		return FALSE;
+
+	if (lp->timeout_id > 0)
+		return TRUE;
+
+	now = g_get_monotonic_time();
+	elapsed = (now - lp->last) / 1000;
+
+	if (elapsed >= lp->interval) {
+		lp->last = now;
+		return FALSE;
+	}
+
+	lp->timeout_id = g_timeout_add(lp->interval - elapsed,
+						limited_property_timeout, lp);
+
+	return TRUE;
+}
+
 void g_dbus_emit_property_changed(DBusConnection *connection,
 				const char *path, const char *interface,
 				const char *name)
@@ -1759,14 +1927,49 @@ void g_dbus_emit_property_changed(DBusConnection *connection,
 		return;
 	}
 
-	if (g_slist_find(iface->pending_prop, (void *) property) != NULL)
+	if (property_limits != NULL &&
+				property_rate_limited(data, iface, property))
 		return;
 
-	data->pending_prop = TRUE;
-	iface->pending_prop = g_slist_prepend(iface->pending_prop,
-						(void *) property);
+	queue_property_changed(data, iface, property);
+}
 
-	add_pending(data);
+void g_dbus_set_property_rate_limit(const char *interface, const char *name,
+							unsigned int interval)
+{
+	struct property_limit *limit;
+	GSList *l;
+
+	for (l = property_limits; l != NULL; l = l->next) {
+		limit = l->data;
+
+		if (g_str_equal(limit->interface, interface) &&
+					g_strcmp0(limit->name, name) == 0)
+			break;
+	}
+
+	if (l != NULL) {
+		if (interval > 0) {
+			limit->interval = interval;
+			return;
+		}
+
+		property_limits = g_slist_delete_link(property_limits, l);
+		g_free(limit->interface);
+		g_free(limit->name);
+		g_free(limit);
+		return;
+	}
+
+	if (interval == 0)
+		return;
+
+	limit = g_new0(struct property_limit, 1);
+	limit->interface = g_strdup(interface);
+	limit->name = g_strdup(name);
+	limit->interval = interval;
+
+	property_limits = g_slist_prepend(property_limits, limit);
 }
 
 gboolean g_dbus_get_properties(DBusConnection *connection, const char *path,
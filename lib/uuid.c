@@ -29,6 +29,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <stdbool.h>
 
 #include "uuid.h"
 
@@ -121,10 +122,68 @@ int bt_uuid128_create(bt_uuid_t *btuuid, uint128_t value)
 	return 0;
 }
 
+static int bt_uuid32_cmp(uint32_t u1, uint32_t u2)
+{
+	if (u1 < u2)
+		return -1;
+
+	return u1 > u2 ? 1 : 0;
+}
+
+/*
+ * Compare a 128-bit UUID with a 16 or 32-bit value without expanding it:
+ * only the first four bytes and the Bluetooth base need to be checked.
+ */
+static int bt_uuid128_short_cmp(const bt_uuid_t *u128, uint32_t value)
+{
+	uint32_t be32 = htonl(value);
+	int ret;
+
+	ret = memcmp(&u128->value.u128.data[BASE_UUID32_OFFSET], &be32,
+								sizeof(be32));
+	if (ret)
+		return ret;
+
+	return memcmp(&u128->value.u128.data[sizeof(be32)],
+				&bluetooth_base_uuid.data[sizeof(be32)],
+				sizeof(uint128_t) - sizeof(be32));
+}
+
+static uint32_t bt_uuid_short_value(const bt_uuid_t *uuid)
+{
+	return uuid->type == BT_UUID16 ? uuid->value.u16 : uuid->value.u32;
+}
+
+static bool bt_uuid_is_short(const bt_uuid_t *uuid)
+{
+	return uuid->type == BT_UUID16 || uuid->type == BT_UUID32;
+}
+
+/*
+ * The result orders UUIDs like their 128-bit big-endian form would be, but
+ * only UUIDs of different width and one of them 128-bit need to look at
+ * more than the values themselves.
+ */
 int bt_uuid_cmp(const bt_uuid_t *uuid1, const bt_uuid_t *uuid2)
 {
 	bt_uuid_t u1, u2;
 
+	if (uuid1->type == BT_UUID16 && uuid2->type == BT_UUID16)
+		return uuid1->value.u16 - uuid2->value.u16;
+
+	if (bt_uuid_is_short(uuid1) && bt_uuid_is_short(uuid2))
+		return bt_uuid32_cmp(bt_uuid_short_value(uuid1),
+					bt_uuid_short_value(uuid2));
+
+	if (uuid1->type == BT_UUID128 && uuid2->type == BT_UUID128)
+		return bt_uuid128_cmp(uuid1, uuid2);
+
+	if (uuid1->type == BT_UUID128 && bt_uuid_is_short(uuid2))
+		return bt_uuid128_short_cmp(uuid1, bt_uuid_short_value(uuid2));
+
+	if (bt_uuid_is_short(uuid1) && uuid2->type == BT_UUID128)
+		return -bt_uuid128_short_cmp(uuid2, bt_uuid_short_value(uuid1));
+
 	bt_uuid_to_uuid128(uuid1, &u1);
 	bt_uuid_to_uuid128(uuid2, &u2);
 
@@ -68,7 +68,8 @@ struct oob_params {
 	bdaddr_t address;
 	uint32_t class;
 	char *name;
-	GSList *services;
+	bt_uuid_t *uuids;
+	unsigned int uuid_count;
 	uint8_t *hash;
 	uint8_t *randomizer;
 	uint8_t *pin;
@@ -78,7 +79,7 @@ struct oob_params {
 
 static void free_oob_params(struct oob_params *params)
 {
-	g_slist_free_full(params->services, free);
+	g_free(params->uuids);
 	g_free(params->name);
 	g_free(params->hash);
 	g_free(params->randomizer);
@@ -359,8 +360,11 @@ static int process_eir(uint8_t *eir, size_t size, struct oob_params *remote)
 	remote->name = eir_data.name;
 	eir_data.name = NULL;
 
-	remote->services = eir_data.services;
-	eir_data.services = NULL;
+	if (eir_data.uuid_count > 0) {
+		remote->uuids = g_memdup(eir_data.uuids,
+				eir_data.uuid_count * sizeof(bt_uuid_t));
+		remote->uuid_count = eir_data.uuid_count;
+	}
 
 	remote->hash = eir_data.hash;
 	eir_data.hash = NULL;
@@ -644,8 +648,9 @@ static void store_params(struct btd_adapter *adapter, struct btd_device *device,
 		btd_device_device_set_name(device, params->name);
 	}
 
-	if (params->services)
-		device_add_eir_uuids(device, params->services);
+	if (params->uuids)
+		device_add_eir_uuids(device, params->uuids,
+							params->uuid_count);
 
 	if (params->hash) {
 		btd_adapter_add_remote_oob_data(adapter, &params->address,
@@ -40,10 +40,10 @@
 #include "src/profile.h"
 
 #define CONTROL_CONNECT_TIMEOUT 2
-#define SOURCE_RETRY_TIMEOUT 2
-#define SINK_RETRY_TIMEOUT SOURCE_RETRY_TIMEOUT
-#define SOURCE_RETRIES 1
-#define SINK_RETRIES SOURCE_RETRIES
+#define RECONNECT_TIMEOUT 2
+#define RECONNECT_TIMEOUT_MAX 60
+#define RECONNECT_RETRIES 6
+#define RECONNECT_MAX_PAGING 1
 
 static unsigned int service_id = 0;
 static GSList *devices = NULL;
@@ -51,22 +51,44 @@ static GSList *devices = NULL;
 struct policy_data {
 	struct btd_device *dev;
 
-	guint source_timer;
-	uint8_t source_retries;
-	guint sink_timer;
-	uint8_t sink_retries;
 	guint ct_timer;
 	guint tg_timer;
 };
 
-static void policy_connect(struct policy_data *data,
+/*
+ * Retries of A2DP and AVRCP connections that failed with -EAGAIN are
+ * queued here instead of each device running its own timer. Once its
+ * backoff expired an entry becomes ready, and ready entries are started
+ * in priority order with at most RECONNECT_MAX_PAGING attempts in flight
+ * per adapter.
+ */
+struct reconnect {
+	struct policy_data *data;
+	const char *uuid;
+	unsigned int attempts;
+	gint64 started;
+	guint timer;
+	bool ready;
+	bool active;
+};
+
+static GSList *reconnects = NULL;
+
+static struct {
+	unsigned int scheduled;
+	unsigned int connected;
+	unsigned int failed;
+	gint64 connect_time;
+} reconnect_stats;
+
+static int policy_connect(struct policy_data *data,
 						struct btd_service *service)
 {
 	struct btd_profile *profile = btd_service_get_profile(service);
 
 	DBG("%s profile %s", device_get_path(data->dev), profile->name);
 
-	btd_service_connect(service);
+	return btd_service_connect(service);
 }
 
 static void policy_disconnect(struct policy_data *data,
@@ -116,15 +138,214 @@ static struct policy_data *find_data(struct btd_device *dev)
 	return NULL;
 }
 
+static struct reconnect *find_reconnect(struct policy_data *data,
+							const char *uuid)
+{
+	GSList *l;
+
+	for (l = reconnects; l; l = l->next) {
+		struct reconnect *reconnect = l->data;
+
+		if (reconnect->data == data &&
+					g_str_equal(reconnect->uuid, uuid))
+			return reconnect;
+	}
+
+	return NULL;
+}
+
+static void reconnect_free(struct reconnect *reconnect)
+{
+	if (reconnect->timer > 0)
+		g_source_remove(reconnect->timer);
+
+	reconnects = g_slist_remove(reconnects, reconnect);
+	g_free(reconnect);
+}
+
+/* Trusted devices first, then the most recently used ones */
+static int reconnect_cmp(const struct reconnect *a, const struct reconnect *b)
+{
+	bool trusted_a = device_is_trusted(a->data->dev);
+	bool trusted_b = device_is_trusted(b->data->dev);
+	time_t last_a, last_b;
+
+	if (trusted_a != trusted_b)
+		return trusted_a ? -1 : 1;
+
+	last_a = btd_device_get_last_used(a->data->dev);
+	last_b = btd_device_get_last_used(b->data->dev);
+
+	if (last_a != last_b)
+		return last_a > last_b ? -1 : 1;
+
+	return 0;
+}
+
+static void reconnect_process(struct btd_adapter *adapter);
+
+static void reconnect_complete(struct reconnect *reconnect, bool success)
+{
+	struct btd_adapter *adapter = device_get_adapter(reconnect->data->dev);
+
+	if (success) {
+		reconnect_stats.connected++;
+		reconnect_stats.connect_time += g_get_monotonic_time() -
+							reconnect->started;
+	} else
+		reconnect_stats.failed++;
+
+	DBG("%s %s after %u attempts, %u/%u reconnects succeeded "
+				"(%" G_GINT64_FORMAT " ms average)",
+				device_get_path(reconnect->data->dev),
+				success ? "connected" : "failed",
+				reconnect->attempts,
+				reconnect_stats.connected,
+				reconnect_stats.scheduled,
+				reconnect_stats.connected ?
+				reconnect_stats.connect_time / 1000 /
+				reconnect_stats.connected : 0);
+
+	reconnect_free(reconnect);
+
+	reconnect_process(adapter);
+}
+
+static void reconnect_start(struct reconnect *reconnect)
+{
+	struct btd_service *service;
+
+	reconnect->ready = false;
+	reconnect->attempts++;
+
+	service = btd_device_get_service(reconnect->data->dev,
+							reconnect->uuid);
+	if (service == NULL) {
+		reconnect_complete(reconnect, false);
+		return;
+	}
+
+	reconnect->active = true;
+
+	if (policy_connect(reconnect->data, service) == 0)
+		return;
+
+	/* A connection started elsewhere reports through service_cb */
+	switch (btd_service_get_state(service)) {
+	case BTD_SERVICE_STATE_CONNECTING:
+		break;
+	case BTD_SERVICE_STATE_CONNECTED:
+		reconnect_complete(reconnect, true);
+		break;
+	default:
+		reconnect_complete(reconnect, false);
+		break;
+	}
+}
+
+static void reconnect_process(struct btd_adapter *adapter)
+{
+	struct reconnect *next;
+	unsigned int paging;
+	GSList *l;
+
+	do {
+		paging = 0;
+		next = NULL;
+
+		for (l = reconnects; l; l = l->next) {
+			struct reconnect *reconnect = l->data;
+
+			if (device_get_adapter(reconnect->data->dev) != adapter)
+				continue;
+
+			if (reconnect->active)
+				paging++;
+			else if (reconnect->ready && (!next ||
+					reconnect_cmp(reconnect, next) < 0))
+				next = reconnect;
+		}
+
+		if (next == NULL || paging >= RECONNECT_MAX_PAGING)
+			return;
+
+		reconnect_start(next);
+	} while (true);
+}
+
+static gboolean reconnect_timeout(gpointer user_data)
+{
+	struct reconnect *reconnect = user_data;
+
+	reconnect->timer = 0;
+	reconnect->ready = true;
+
+	reconnect_process(device_get_adapter(reconnect->data->dev));
+
+	return FALSE;
+}
+
+static void reconnect_schedule(struct policy_data *data, const char *uuid)
+{
+	struct reconnect *reconnect;
+	unsigned int timeout;
+
+	reconnect = find_reconnect(data, uuid);
+	if (reconnect == NULL) {
+		reconnect = g_new0(struct reconnect, 1);
+		reconnect->data = data;
+		reconnect->uuid = uuid;
+		reconnect->started = g_get_monotonic_time();
+		reconnects = g_slist_prepend(reconnects, reconnect);
+		reconnect_stats.scheduled++;
+	} else if (reconnect->active) {
+		reconnect->active = false;
+
+		/* Let other devices page while this one backs off */
+		reconnect_process(device_get_adapter(data->dev));
+	}
+
+	if (reconnect->attempts >= RECONNECT_RETRIES) {
+		reconnect_complete(reconnect, false);
+		return;
+	}
+
+	timeout = MIN(RECONNECT_TIMEOUT << reconnect->attempts,
+						RECONNECT_TIMEOUT_MAX);
+
+	DBG("%s retry %u in %u seconds", device_get_path(data->dev),
+					reconnect->attempts + 1, timeout);
+
+	if (reconnect->timer > 0)
+		g_source_remove(reconnect->timer);
+
+	reconnect->timer = g_timeout_add_seconds(timeout, reconnect_timeout,
+								reconnect);
+}
+
+static void reconnect_cancel(struct policy_data *data, const char *uuid,
+								bool success)
+{
+	struct reconnect *reconnect;
+
+	reconnect = find_reconnect(data, uuid);
+	if (reconnect != NULL)
+		reconnect_complete(reconnect, success);
+}
+
 static void policy_remove(void *user_data)
 {
 	struct policy_data *data = user_data;
+	GSList *l, *next;
+
+	for (l = reconnects; l; l = next) {
+		struct reconnect *reconnect = l->data;
 
-	if (data->source_timer > 0)
-		g_source_remove(data->source_timer);
+		next = l->next;
 
-	if (data->sink_timer > 0)
-		g_source_remove(data->sink_timer);
+		if (reconnect->data == data)
+			reconnect_free(reconnect);
+	}
 
 	if (data->ct_timer > 0)
 		g_source_remove(data->ct_timer);
@@ -151,31 +372,6 @@ static struct policy_data *policy_get_data(struct btd_device *dev)
 	return data;
 }
 
-static gboolean policy_connect_sink(gpointer user_data)
-{
-	struct policy_data *data = user_data;
-	struct btd_service *service;
-
-	data->source_timer = 0;
-	data->sink_retries++;
-
-	service = btd_device_get_service(data->dev, A2DP_SINK_UUID);
-	if (service != NULL)
-		policy_connect(data, service);
-
-	return FALSE;
-}
-
-static void policy_set_sink_timer(struct policy_data *data)
-{
-	if (data->sink_timer > 0)
-		g_source_remove(data->sink_timer);
-
-	data->sink_timer = g_timeout_add_seconds(SINK_RETRY_TIMEOUT,
-							policy_connect_sink,
-							data);
-}
-
 static void sink_cb(struct btd_service *service, btd_service_state_t old_state,
 						btd_service_state_t new_state)
 {
@@ -196,15 +392,11 @@ static void sink_cb(struct btd_service *service, btd_service_state_t old_state,
 			int err = btd_service_get_error(service);
 
 			if (err == -EAGAIN) {
-				if (data->sink_retries < SINK_RETRIES)
-					policy_set_sink_timer(data);
-				else
-					data->sink_retries = 0;
+				reconnect_schedule(data, A2DP_SINK_UUID);
 				break;
-			} else if (data->sink_timer > 0) {
-				g_source_remove(data->sink_timer);
-				data->sink_timer = 0;
 			}
+
+			reconnect_cancel(data, A2DP_SINK_UUID, false);
 		}
 
 		if (data->ct_timer > 0) {
@@ -217,10 +409,8 @@ static void sink_cb(struct btd_service *service, btd_service_state_t old_state,
 	case BTD_SERVICE_STATE_CONNECTING:
 		break;
 	case BTD_SERVICE_STATE_CONNECTED:
-		if (data->sink_timer > 0) {
-			g_source_remove(data->sink_timer);
-			data->sink_timer = 0;
-		}
+		btd_device_set_last_used(data->dev);
+		reconnect_cancel(data, A2DP_SINK_UUID, true);
 
 		/* Check if service initiate the connection then proceed
 		 * immediatelly otherwise set timer
@@ -260,31 +450,6 @@ static void policy_set_tg_timer(struct policy_data *data)
 							data);
 }
 
-static gboolean policy_connect_source(gpointer user_data)
-{
-	struct policy_data *data = user_data;
-	struct btd_service *service;
-
-	data->source_timer = 0;
-	data->source_retries++;
-
-	service = btd_device_get_service(data->dev, A2DP_SOURCE_UUID);
-	if (service != NULL)
-		policy_connect(data, service);
-
-	return FALSE;
-}
-
-static void policy_set_source_timer(struct policy_data *data)
-{
-	if (data->source_timer > 0)
-		g_source_remove(data->source_timer);
-
-	data->source_timer = g_timeout_add_seconds(SOURCE_RETRY_TIMEOUT,
-							policy_connect_source,
-							data);
-}
-
 static void source_cb(struct btd_service *service,
 						btd_service_state_t old_state,
 						btd_service_state_t new_state)
@@ -306,15 +471,11 @@ static void source_cb(struct btd_service *service,
 			int err = btd_service_get_error(service);
 
 			if (err == -EAGAIN) {
-				if (data->source_retries < SOURCE_RETRIES)
-					policy_set_source_timer(data);
-				else
-					data->source_retries = 0;
+				reconnect_schedule(data, A2DP_SOURCE_UUID);
 				break;
-			} else if (data->source_timer > 0) {
-				g_source_remove(data->source_timer);
-				data->source_timer = 0;
 			}
+
+			reconnect_cancel(data, A2DP_SOURCE_UUID, false);
 		}
 
 		if (data->tg_timer > 0) {
@@ -327,10 +488,8 @@ static void source_cb(struct btd_service *service,
 	case BTD_SERVICE_STATE_CONNECTING:
 		break;
 	case BTD_SERVICE_STATE_CONNECTED:
-		if (data->source_timer > 0) {
-			g_source_remove(data->source_timer);
-			data->source_timer = 0;
-		}
+		btd_device_set_last_used(data->dev);
+		reconnect_cancel(data, A2DP_SOURCE_UUID, true);
 
 		/* Check if service initiate the connection then proceed
 		 * immediatelly otherwise set timer
@@ -360,10 +519,22 @@ static void controller_cb(struct btd_service *service,
 	switch (new_state) {
 	case BTD_SERVICE_STATE_UNAVAILABLE:
 	case BTD_SERVICE_STATE_DISCONNECTED:
+		if (old_state == BTD_SERVICE_STATE_CONNECTING) {
+			int err = btd_service_get_error(service);
+
+			if (err == -EAGAIN) {
+				reconnect_schedule(data, AVRCP_REMOTE_UUID);
+				break;
+			}
+
+			reconnect_cancel(data, AVRCP_REMOTE_UUID, false);
+		}
 		break;
 	case BTD_SERVICE_STATE_CONNECTING:
 		break;
 	case BTD_SERVICE_STATE_CONNECTED:
+		reconnect_cancel(data, AVRCP_REMOTE_UUID, true);
+
 		if (data->ct_timer > 0) {
 			g_source_remove(data->ct_timer);
 			data->ct_timer = 0;
@@ -388,10 +559,22 @@ static void target_cb(struct btd_service *service,
 	switch (new_state) {
 	case BTD_SERVICE_STATE_UNAVAILABLE:
 	case BTD_SERVICE_STATE_DISCONNECTED:
+		if (old_state == BTD_SERVICE_STATE_CONNECTING) {
+			int err = btd_service_get_error(service);
+
+			if (err == -EAGAIN) {
+				reconnect_schedule(data, AVRCP_TARGET_UUID);
+				break;
+			}
+
+			reconnect_cancel(data, AVRCP_TARGET_UUID, false);
+		}
 		break;
 	case BTD_SERVICE_STATE_CONNECTING:
 		break;
 	case BTD_SERVICE_STATE_CONNECTED:
+		reconnect_cancel(data, AVRCP_TARGET_UUID, true);
+
 		if (data->tg_timer > 0) {
 			g_source_remove(data->tg_timer);
 			data->tg_timer = 0;
@@ -402,6 +585,34 @@ static void target_cb(struct btd_service *service,
 	}
 }
 
+static void service_removed(struct btd_service *service)
+{
+	struct btd_profile *profile = btd_service_get_profile(service);
+	struct btd_device *dev = btd_service_get_device(service);
+	struct policy_data *data;
+	struct reconnect *reconnect;
+
+	data = find_data(dev);
+	if (data == NULL)
+		return;
+
+	reconnect = find_reconnect(data, profile->remote_uuid);
+	if (reconnect != NULL)
+		reconnect_complete(reconnect, false);
+
+	if (g_str_equal(profile->remote_uuid, AVRCP_REMOTE_UUID) &&
+							data->ct_timer > 0) {
+		g_source_remove(data->ct_timer);
+		data->ct_timer = 0;
+	}
+
+	if (g_str_equal(profile->remote_uuid, AVRCP_TARGET_UUID) &&
+							data->tg_timer > 0) {
+		g_source_remove(data->tg_timer);
+		data->tg_timer = 0;
+	}
+}
+
 static void service_cb(struct btd_service *service,
 						btd_service_state_t old_state,
 						btd_service_state_t new_state,
@@ -417,17 +628,41 @@ static void service_cb(struct btd_service *service,
 		controller_cb(service, old_state, new_state);
 	else if (g_str_equal(profile->remote_uuid, AVRCP_TARGET_UUID))
 		target_cb(service, old_state, new_state);
+
+	/*
+	 * Services become unavailable when they are removed, for example
+	 * together with their device, so nothing must be left pointing to
+	 * them once the state callbacks are done.
+	 */
+	if (new_state == BTD_SERVICE_STATE_UNAVAILABLE)
+		service_removed(service);
+}
+
+static void reconnect_stats_dump(void *user_data)
+{
+	info("policy: %u reconnects scheduled, %u connected, %u failed, "
+				"time to connect avg %" G_GINT64_FORMAT " ms",
+				reconnect_stats.scheduled,
+				reconnect_stats.connected,
+				reconnect_stats.failed,
+				reconnect_stats.connected ?
+				reconnect_stats.connect_time / 1000 /
+				reconnect_stats.connected : 0);
 }
 
 static int policy_init(void)
 {
 	service_id = btd_service_add_state_cb(service_cb, NULL);
 
+	btd_stats_register(reconnect_stats_dump, NULL);
+
 	return 0;
 }
 
 static void policy_exit(void)
 {
+	btd_stats_unregister(reconnect_stats_dump, NULL);
+
 	g_slist_free_full(devices, policy_remove);
 
 	btd_service_remove_state_cb(service_id);
@@ -47,6 +47,7 @@
 #include "src/profile.h"
 #include "src/error.h"
 #include "src/textfile.h"
+#include "src/keyfile.h"
 #include "src/attio.h"
 
 #define PHONE_ALERT_STATUS_SVC_UUID	0x180E
@@ -339,8 +340,7 @@ static gboolean is_notifiable_device(struct btd_device *device, uint16_t ccc)
 		return FALSE;
 	}
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = keyfile_get(filename);
 
 	str = g_key_file_get_string(key_file, handle, "Value", NULL);
 	if (!str) {
@@ -358,7 +358,6 @@ static gboolean is_notifiable_device(struct btd_device *device, uint16_t ccc)
 end:
 	g_free(str);
 	g_free(filename);
-	g_key_file_free(key_file);
 
 	return result;
 }
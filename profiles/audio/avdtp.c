@@ -33,6 +33,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <assert.h>
+#include <string.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/sdp.h>
@@ -46,6 +47,7 @@
 #include "lib/uuid.h"
 #include "src/adapter.h"
 #include "src/device.h"
+#include "src/keyfile.h"
 
 #include "avdtp.h"
 #include "sink.h"
@@ -400,6 +402,8 @@ struct avdtp {
 	guint io_id;
 
 	GSList *seps; /* Elements of type struct avdtp_remote_sep * */
+	gboolean seps_cached;	/* seps were restored from storage */
+	gboolean rediscover;	/* Cached seps were rejected by the remote */
 
 	GSList *streams; /* Elements of type struct avdtp_stream * */
 
@@ -1319,6 +1323,156 @@ static GSList *caps_to_list(uint8_t *data, int size,
 	return caps;
 }
 
+static char *seps_filename(struct avdtp *session)
+{
+	/* Only keep the endpoints of devices which will be seen again */
+	if (!device_is_bonded(session->device, BDADDR_BREDR))
+		return NULL;
+
+	return btd_device_get_storage_path(session->device, "avdtp");
+}
+
+static void store_remote_seps(struct avdtp *session)
+{
+	char *filename;
+	GKeyFile *key_file;
+	char **groups;
+	GSList *l;
+	int i;
+
+	filename = seps_filename(session);
+	if (!filename)
+		return;
+
+	key_file = keyfile_get(filename);
+
+	groups = g_key_file_get_groups(key_file, NULL);
+	for (i = 0; groups[i]; i++)
+		g_key_file_remove_group(key_file, groups[i], NULL);
+	g_strfreev(groups);
+
+	for (l = session->seps; l; l = g_slist_next(l)) {
+		struct avdtp_remote_sep *sep = l->data;
+		char group[4];
+		GString *caps;
+		GSList *c;
+
+		if (!sep->caps)
+			continue;
+
+		caps = g_string_new(NULL);
+
+		for (c = sep->caps; c; c = g_slist_next(c)) {
+			struct avdtp_service_capability *cap = c->data;
+			uint8_t *data = (uint8_t *) cap;
+			int j;
+
+			for (j = 0; j < 2 + cap->length; j++)
+				g_string_append_printf(caps, "%02X", data[j]);
+		}
+
+		sprintf(group, "%u", sep->seid);
+
+		g_key_file_set_integer(key_file, group, "Type", sep->type);
+		g_key_file_set_integer(key_file, group, "MediaType",
+							sep->media_type);
+		g_key_file_set_string(key_file, group, "Capabilities",
+								caps->str);
+
+		g_string_free(caps, TRUE);
+	}
+
+	keyfile_changed(filename);
+
+	g_free(filename);
+}
+
+static void load_remote_seps(struct avdtp *session)
+{
+	char *filename;
+	GKeyFile *key_file;
+	char **groups;
+	int i;
+
+	filename = seps_filename(session);
+	if (!filename)
+		return;
+
+	key_file = keyfile_get(filename);
+	groups = g_key_file_get_groups(key_file, NULL);
+
+	for (i = 0; groups[i]; i++) {
+		struct avdtp_remote_sep *sep;
+		uint8_t caps[1024];
+		char *str;
+		int seid;
+		size_t j, len;
+
+		seid = atoi(groups[i]);
+		if (seid <= 0 || seid > MAX_SEID)
+			continue;
+
+		str = g_key_file_get_string(key_file, groups[i],
+							"Capabilities", NULL);
+		if (!str)
+			continue;
+
+		len = strlen(str) / 2;
+		if (len > sizeof(caps))
+			len = 0;
+
+		for (j = 0; j < len; j++) {
+			if (sscanf(str + j * 2, "%02hhX", &caps[j]) != 1)
+				break;
+		}
+
+		g_free(str);
+
+		if (len == 0 || j < len)
+			continue;
+
+		sep = g_new0(struct avdtp_remote_sep, 1);
+		sep->seid = seid;
+		sep->type = g_key_file_get_integer(key_file, groups[i],
+								"Type", NULL);
+		sep->media_type = g_key_file_get_integer(key_file, groups[i],
+							"MediaType", NULL);
+		sep->caps = caps_to_list(caps, len, &sep->codec,
+							&sep->delay_reporting);
+
+		/* Unusable without a codec, rather discover again */
+		if (!sep->codec) {
+			sep_free(sep);
+			continue;
+		}
+
+		session->seps = g_slist_append(session->seps, sep);
+	}
+
+	g_strfreev(groups);
+	g_free(filename);
+
+	if (session->seps) {
+		DBG("%u remote endpoints restored",
+					g_slist_length(session->seps));
+		session->seps_cached = TRUE;
+	}
+}
+
+static void remove_remote_seps(struct avdtp *session)
+{
+	char *filename;
+
+	filename = seps_filename(session);
+	if (!filename)
+		return;
+
+	keyfile_discard(filename);
+	unlink(filename);
+
+	g_free(filename);
+}
+
 static gboolean avdtp_unknown_cmd(struct avdtp *session, uint8_t transaction,
 							uint8_t signal_id)
 {
@@ -2327,6 +2481,8 @@ static struct avdtp *avdtp_get_internal(struct btd_device *device)
 
 	session->version = get_version(session);
 
+	load_remote_seps(session);
+
 	server->sessions = g_slist_append(server->sessions, session);
 
 	return session;
@@ -2971,8 +3127,12 @@ static gboolean avdtp_parse_resp(struct avdtp *session,
 		if (!avdtp_get_capabilities_resp(session, buf, size))
 			return FALSE;
 		if (!(next && (next->signal_id == AVDTP_GET_CAPABILITIES ||
-				next->signal_id == AVDTP_GET_ALL_CAPABILITIES)))
+				next->signal_id == AVDTP_GET_ALL_CAPABILITIES))) {
+			session->seps_cached = FALSE;
+			session->rediscover = FALSE;
+			store_remote_seps(session);
 			finalize_discovery(session, 0);
+		}
 		return TRUE;
 	}
 
@@ -3095,6 +3255,14 @@ static gboolean avdtp_parse_rej(struct avdtp *session,
 			return FALSE;
 		error("SET_CONFIGURATION request rejected: %s (%d)",
 				avdtp_strerror(&err), err.err.error_code);
+		/*
+		 * The remote endpoints may have changed since they were
+		 * stored, make sure the next attempt discovers them again.
+		 */
+		if (session->seps_cached) {
+			session->rediscover = TRUE;
+			remove_remote_seps(session);
+		}
 		if (sep && sep->cfm && sep->cfm->set_configuration)
 			sep->cfm->set_configuration(session, sep, stream,
 							&err, sep->user_data);
@@ -3304,6 +3472,23 @@ static gboolean process_discover(gpointer data)
 	return FALSE;
 }
 
+static void remove_unused_seps(struct avdtp *session)
+{
+	GSList *l, *next;
+
+	for (l = session->seps; l; l = next) {
+		struct avdtp_remote_sep *sep = l->data;
+
+		next = l->next;
+
+		if (sep->stream)
+			continue;
+
+		session->seps = g_slist_delete_link(session->seps, l);
+		sep_free(sep);
+	}
+}
+
 int avdtp_discover(struct avdtp *session, avdtp_discover_cb_t cb,
 			void *user_data)
 {
@@ -3312,9 +3497,13 @@ int avdtp_discover(struct avdtp *session, avdtp_discover_cb_t cb,
 	if (session->discover)
 		return -EBUSY;
 
+	/* Don't let stale endpoints be selected again */
+	if (session->rediscover)
+		remove_unused_seps(session);
+
 	session->discover = g_new0(struct discover_callback, 1);
 
-	if (session->seps) {
+	if (session->seps && !session->rediscover) {
 		session->discover->cb = cb;
 		session->discover->user_data = user_data;
 		session->discover->id = g_idle_add(process_discover, session);
@@ -3837,6 +4026,11 @@ gboolean avdtp_has_stream(struct avdtp *session, struct avdtp_stream *stream)
 	return g_slist_find(session->streams, stream) ? TRUE : FALSE;
 }
 
+gboolean avdtp_needs_rediscover(struct avdtp *session)
+{
+	return session->rediscover;
+}
+
 unsigned int avdtp_add_state_cb(struct btd_device *dev,
 				avdtp_session_state_cb cb, void *user_data)
 {
@@ -227,6 +227,7 @@ int avdtp_discover(struct avdtp *session, avdtp_discover_cb_t cb,
 			void *user_data);
 
 gboolean avdtp_has_stream(struct avdtp *session, struct avdtp_stream *stream);
+gboolean avdtp_needs_rediscover(struct avdtp *session);
 
 unsigned int avdtp_stream_add_cb(struct avdtp *session,
 					struct avdtp_stream *stream,
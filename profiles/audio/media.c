@@ -69,6 +69,18 @@ struct endpoint_request {
 	media_endpoint_cb_t	cb;
 	GDestroyNotify		destroy;
 	void			*user_data;
+	guint			id;		/* Cached reply idle source */
+	uint8_t			*configuration;	/* Cached reply */
+	int			size;
+};
+
+/* Last configuration selected by the endpoint for a remote device */
+struct endpoint_config {
+	bdaddr_t		dst;
+	uint8_t			*capabilities;	/* Remote capabilities */
+	size_t			caps_len;
+	uint8_t			*configuration;
+	size_t			size;
 };
 
 struct media_endpoint {
@@ -85,6 +97,9 @@ struct media_endpoint {
 	GSList			*requests;
 	struct media_adapter	*adapter;
 	GSList			*transports;
+	gboolean		cache_config;	/* Reuse selected configs */
+	GSList			*configs;	/* struct endpoint_config */
+	uint32_t		cache_hits;
 };
 
 struct media_player {
@@ -116,10 +131,16 @@ static void endpoint_request_free(struct endpoint_request *request)
 	if (request->call)
 		dbus_pending_call_unref(request->call);
 
+	if (request->id > 0)
+		g_source_remove(request->id);
+
 	if (request->destroy)
 		request->destroy(request->user_data);
 
-	dbus_message_unref(request->msg);
+	if (request->msg)
+		dbus_message_unref(request->msg);
+
+	g_free(request->configuration);
 	g_free(request);
 }
 
@@ -144,6 +165,15 @@ static void media_endpoint_cancel_all(struct media_endpoint *endpoint)
 		media_endpoint_cancel(endpoint->requests->data);
 }
 
+static void endpoint_config_free(gpointer data)
+{
+	struct endpoint_config *config = data;
+
+	g_free(config->capabilities);
+	g_free(config->configuration);
+	g_free(config);
+}
+
 static void media_endpoint_destroy(struct media_endpoint *endpoint)
 {
 	DBG("sender=%s path=%s", endpoint->sender, endpoint->path);
@@ -152,6 +182,7 @@ static void media_endpoint_destroy(struct media_endpoint *endpoint)
 
 	g_slist_free_full(endpoint->transports,
 				(GDestroyNotify) media_transport_destroy);
+	g_slist_free_full(endpoint->configs, endpoint_config_free);
 
 	g_dbus_remove_watch(btd_get_dbus_connection(), endpoint->watch);
 	g_free(endpoint->capabilities);
@@ -497,16 +528,134 @@ static size_t get_capabilities(struct a2dp_sep *sep, uint8_t **capabilities,
 struct a2dp_select_data {
 	struct a2dp_setup *setup;
 	a2dp_endpoint_select_t cb;
+	bdaddr_t dst;
+	uint8_t *capabilities;
+	size_t length;
 };
 
+static void select_data_free(void *user_data)
+{
+	struct a2dp_select_data *data = user_data;
+
+	g_free(data->capabilities);
+	g_free(data);
+}
+
+static struct endpoint_config *find_config(struct media_endpoint *endpoint,
+							const bdaddr_t *dst)
+{
+	GSList *l;
+
+	for (l = endpoint->configs; l; l = l->next) {
+		struct endpoint_config *config = l->data;
+
+		if (bacmp(&config->dst, dst) == 0)
+			return config;
+	}
+
+	return NULL;
+}
+
+static void remove_config(struct media_endpoint *endpoint,
+							const bdaddr_t *dst)
+{
+	struct endpoint_config *config;
+
+	config = find_config(endpoint, dst);
+	if (!config)
+		return;
+
+	endpoint->configs = g_slist_remove(endpoint->configs, config);
+	endpoint_config_free(config);
+}
+
+static void store_config(struct media_endpoint *endpoint,
+				struct a2dp_select_data *data,
+				uint8_t *configuration, size_t size)
+{
+	struct endpoint_config *config;
+
+	remove_config(endpoint, &data->dst);
+
+	config = g_new0(struct endpoint_config, 1);
+	bacpy(&config->dst, &data->dst);
+	config->capabilities = g_memdup(data->capabilities, data->length);
+	config->caps_len = data->length;
+	config->configuration = g_memdup(configuration, size);
+	config->size = size;
+
+	endpoint->configs = g_slist_prepend(endpoint->configs, config);
+}
+
 static void select_cb(struct media_endpoint *endpoint, void *ret, int size,
 							void *user_data)
 {
 	struct a2dp_select_data *data = user_data;
 
+	if (endpoint->cache_config && ret && size > 0)
+		store_config(endpoint, data, ret, size);
+
 	data->cb(data->setup, ret, size);
 }
 
+static gboolean cached_reply(gpointer user_data)
+{
+	struct endpoint_request *request = user_data;
+	struct media_endpoint *endpoint = request->endpoint;
+
+	request->id = 0;
+
+	if (request->cb)
+		request->cb(endpoint, request->configuration, request->size,
+							request->user_data);
+
+	endpoint->requests = g_slist_remove(endpoint->requests, request);
+	endpoint_request_free(request);
+
+	return FALSE;
+}
+
+/*
+ * Reply with the configuration the endpoint selected the last time the
+ * remote device presented the same capabilities, saving the round trip.
+ */
+static gboolean select_cached_configuration(struct media_endpoint *endpoint,
+					struct a2dp_select_data *data)
+{
+	struct endpoint_config *config;
+	struct endpoint_request *request;
+
+	config = find_config(endpoint, &data->dst);
+	if (!config)
+		return FALSE;
+
+	if (config->caps_len != data->length ||
+			memcmp(config->capabilities, data->capabilities,
+							data->length) != 0) {
+		remove_config(endpoint, &data->dst);
+		return FALSE;
+	}
+
+	request = g_new0(struct endpoint_request, 1);
+	request->endpoint = endpoint;
+	request->cb = select_cb;
+	request->destroy = select_data_free;
+	request->user_data = data;
+	request->configuration = g_memdup(config->configuration,
+							config->size);
+	request->size = config->size;
+	request->id = g_idle_add(cached_reply, request);
+
+	endpoint->requests = g_slist_append(endpoint->requests, request);
+
+	endpoint->cache_hits++;
+
+	DBG("sender=%s path=%s cache hits %u", endpoint->sender,
+					endpoint->path, endpoint->cache_hits);
+
+	return TRUE;
+}
+
 static int select_config(struct a2dp_sep *sep, uint8_t *capabilities,
 				size_t length, struct a2dp_setup *setup,
 				a2dp_endpoint_select_t cb, void *user_data)
@@ -518,11 +667,22 @@ static int select_config(struct a2dp_sep *sep, uint8_t *capabilities,
 	data->setup = setup;
 	data->cb = cb;
 
+	if (endpoint->cache_config) {
+		struct btd_device *device = a2dp_setup_get_device(setup);
+
+		bacpy(&data->dst, device_get_address(device));
+		data->capabilities = g_memdup(capabilities, length);
+		data->length = length;
+
+		if (select_cached_configuration(endpoint, data))
+			return 0;
+	}
+
 	if (select_configuration(endpoint, capabilities, length,
-					select_cb, data, g_free) == TRUE)
+				select_cb, data, select_data_free) == TRUE)
 		return 0;
 
-	g_free(data);
+	select_data_free(data);
 	return -ENOMEM;
 }
 
@@ -531,6 +691,13 @@ static void config_cb(struct media_endpoint *endpoint, void *ret, int size,
 {
 	struct a2dp_config_data *data = user_data;
 
+	/* Don't offer a configuration again which failed to be set */
+	if (!ret && endpoint->configs) {
+		struct btd_device *device = a2dp_setup_get_device(data->setup);
+
+		remove_config(endpoint, device_get_address(device));
+	}
+
 	data->cb(data->setup, ret ? TRUE : FALSE);
 }
 
@@ -674,6 +841,10 @@ static void append_endpoint(struct media_endpoint *endpoint,
 	dict_append_array(&props, "Capabilities", DBUS_TYPE_BYTE,
 				&endpoint->capabilities, endpoint->size);
 
+	if (endpoint->cache_config)
+		dict_append_entry(&props, "CacheHits", DBUS_TYPE_UINT32,
+							&endpoint->cache_hits);
+
 	dbus_message_iter_close_container(&var, &props);
 	dbus_message_iter_close_container(&entry, &var);
 	dbus_message_iter_close_container(dict, &entry);
@@ -718,6 +889,7 @@ static struct media_endpoint *media_endpoint_create(struct media_adapter *adapte
 						const char *path,
 						const char *uuid,
 						gboolean delay_reporting,
+						gboolean cache_config,
 						uint8_t codec,
 						uint8_t *capabilities,
 						int size,
@@ -731,6 +903,7 @@ static struct media_endpoint *media_endpoint_create(struct media_adapter *adapte
 	endpoint->path = g_strdup(path);
 	endpoint->uuid = g_strdup(uuid);
 	endpoint->codec = codec;
+	endpoint->cache_config = cache_config;
 
 	if (size > 0) {
 		endpoint->capabilities = g_new(uint8_t, size);
@@ -784,7 +957,8 @@ static struct media_endpoint *media_endpoint_create(struct media_adapter *adapte
 }
 
 static int parse_properties(DBusMessageIter *props, const char **uuid,
-				gboolean *delay_reporting, uint8_t *codec,
+				gboolean *delay_reporting,
+				gboolean *cache_config, uint8_t *codec,
 				uint8_t **capabilities, int *size)
 {
 	gboolean has_uuid = FALSE;
@@ -816,6 +990,10 @@ static int parse_properties(DBusMessageIter *props, const char **uuid,
 			if (var != DBUS_TYPE_BOOLEAN)
 				return -EINVAL;
 			dbus_message_iter_get_basic(&value, delay_reporting);
+		} else if (strcasecmp(key, "CacheConfiguration") == 0) {
+			if (var != DBUS_TYPE_BOOLEAN)
+				return -EINVAL;
+			dbus_message_iter_get_basic(&value, cache_config);
 		} else if (strcasecmp(key, "Capabilities") == 0) {
 			DBusMessageIter array;
 
@@ -840,6 +1018,7 @@ static DBusMessage *register_endpoint(DBusConnection *conn, DBusMessage *msg,
 	DBusMessageIter args, props;
 	const char *sender, *path, *uuid;
 	gboolean delay_reporting = FALSE;
+	gboolean cache_config = FALSE;
 	uint8_t codec;
 	uint8_t *capabilities;
 	int size = 0;
@@ -859,12 +1038,13 @@ static DBusMessage *register_endpoint(DBusConnection *conn, DBusMessage *msg,
 	if (dbus_message_iter_get_arg_type(&props) != DBUS_TYPE_DICT_ENTRY)
 		return btd_error_invalid_args(msg);
 
-	if (parse_properties(&props, &uuid, &delay_reporting, &codec,
-						&capabilities, &size) < 0)
+	if (parse_properties(&props, &uuid, &delay_reporting, &cache_config,
+					&codec, &capabilities, &size) < 0)
 		return btd_error_invalid_args(msg);
 
 	if (media_endpoint_create(adapter, sender, path, uuid, delay_reporting,
-				codec, capabilities, size, &err) == NULL) {
+					cache_config, codec, capabilities,
+					size, &err) == NULL) {
 		if (err == -EPROTONOSUPPORT)
 			return btd_error_not_supported(msg);
 		else
@@ -189,6 +189,11 @@ static void stream_setup_complete(struct avdtp *session, struct a2dp_sep *sep,
 	if (stream)
 		return;
 
+	/* Stored endpoints were rejected, retry with the current ones */
+	if (avdtp_needs_rediscover(session) &&
+			sink_setup_stream(sink->service, NULL))
+		return;
+
 	avdtp_unref(sink->session);
 	sink->session = NULL;
 	if (avdtp_error_category(err) == AVDTP_ERRNO
@@ -186,6 +186,11 @@ static void stream_setup_complete(struct avdtp *session, struct a2dp_sep *sep,
 	if (stream)
 		return;
 
+	/* Stored endpoints were rejected, retry with the current ones */
+	if (avdtp_needs_rediscover(session) &&
+			source_setup_stream(source->service, NULL))
+		return;
+
 	avdtp_unref(source->session);
 	source->session = NULL;
 	if (avdtp_error_category(err) == AVDTP_ERRNO
@@ -849,7 +849,7 @@ static void attio_connected_cb(GAttrib *attrib, gpointer user_data)
 
 	csc->attrib = g_attrib_ref(attrib);
 
-	gatt_discover_char(csc->attrib, csc->svc_range->start,
+	btd_device_gatt_discover_char(csc->dev, csc->svc_range->start,
 						csc->svc_range->end, NULL,
 						discover_char_cb, csc);
 }
@@ -142,8 +142,9 @@ static void attio_connected_cb(GAttrib *attrib, gpointer user_data)
 
 	d->attrib = g_attrib_ref(attrib);
 
-	gatt_discover_char(d->attrib, d->svc_range->start, d->svc_range->end,
-					NULL, configure_deviceinfo_cb, d);
+	btd_device_gatt_discover_char(d->dev, d->svc_range->start,
+					d->svc_range->end, NULL,
+					configure_deviceinfo_cb, d);
 }
 
 static void attio_disconnected_cb(gpointer user_data)
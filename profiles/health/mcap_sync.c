@@ -61,6 +61,11 @@ struct mcap_csp {
 	guint		set_timer;	/* CSP-Slave: delayed set timer */
 	void		*set_data;	/* CSP-Slave: delayed set data */
 	void		*csp_priv_data;	/* CSP-Master: In-flight request data */
+	GSList		*clock_reqs;	/* Pending adapter clock reads */
+	gboolean	ind_pending;	/* CSP-Slave: indication waits for clock */
+	gboolean	last_btclock_valid;
+	uint32_t	last_btclock;	/* Last BT clock read from adapter */
+	struct timespec	last_btclock_time; /* Time last_btclock was read */
 };
 
 struct mcap_sync_cap_cbdata {
@@ -159,11 +164,15 @@ void mcap_sync_init(struct mcap_mcl *mcl)
 	reset_tmstamp(mcl->csp, NULL, 0);
 }
 
+static void cancel_btclock_reqs(struct mcap_mcl *mcl);
+
 void mcap_sync_stop(struct mcap_mcl *mcl)
 {
 	if (!mcl->csp)
 		return;
 
+	cancel_btclock_reqs(mcl);
+
 	if (mcl->csp->ind_timer)
 		g_source_remove(mcl->csp->ind_timer);
 
@@ -200,6 +209,11 @@ static int bt2ms(int bt)
 	return bt * 312.5 / 1000;
 }
 
+static uint32_t us2bt(uint64_t us)
+{
+	return us * 2 / 625;
+}
+
 static int btoffset(uint32_t btclk1, uint32_t btclk2)
 {
 	int offset = btclk2 - btclk1;
@@ -222,36 +236,135 @@ static gboolean valid_btclock(uint32_t btclk)
 	return btclk <= MCAP_BTCLOCK_MAX;
 }
 
-/* This call may fail; either deal with retry or use read_btclock_retry */
-static gboolean read_btclock(struct mcap_mcl *mcl, uint32_t *btclock,
-							uint16_t *btaccuracy)
+typedef void (*btclock_cb) (struct mcap_mcl *mcl, gboolean success,
+					uint32_t btclock, uint16_t btres,
+					struct timespec *recv_time,
+					int latency, void *data);
+
+struct btclock_req {
+	struct mcap_mcl		*mcl;
+	struct btd_adapter	*adapter;
+	unsigned int		id;
+	int			retries;
+	struct timespec		start;		/* When the read was sent */
+	btclock_cb		cb;
+	void			*data;		/* Freed if never completed */
+};
+
+static void btclock_req_free(void *user_data)
+{
+	struct btclock_req *req = user_data;
+
+	if (req->mcl)
+		req->mcl->csp->clock_reqs = g_slist_remove(
+					req->mcl->csp->clock_reqs, req);
+
+	btd_adapter_unref(req->adapter);
+	g_free(req->data);
+	g_free(req);
+}
+
+static gboolean read_btclock(struct mcap_mcl *mcl, int retries,
+						btclock_cb cb, void *data);
+
+static void btclock_complete(int err, uint32_t btclock, uint16_t btres,
+							void *user_data)
+{
+	struct btclock_req *req = user_data;
+	struct mcap_mcl *mcl = req->mcl;
+	struct timespec now;
+	void *data;
+
+	if (!mcl)
+		return;
+
+	clock_gettime(CLK, &now);
+
+	/* The callback takes over the data from here on */
+	data = req->data;
+	req->data = NULL;
+
+	if (err < 0) {
+		if (req->retries > 0) {
+			DBG("CSP: retrying to read bt clock...");
+			if (read_btclock(mcl, req->retries - 1, req->cb, data))
+				return;
+		}
+
+		if (req->cb)
+			req->cb(mcl, FALSE, 0, 0, &now, 0, data);
+		else
+			g_free(data);
+
+		return;
+	}
+
+	mcl->csp->last_btclock = btclock;
+	mcl->csp->last_btclock_time = now;
+	mcl->csp->last_btclock_valid = TRUE;
+
+	if (req->cb)
+		req->cb(mcl, TRUE, btclock, btres, &now,
+				time_us(&now) - time_us(&req->start), data);
+	else
+		g_free(data);
+}
+
+/*
+ * Read the piconet clock through the adapter without blocking. On success
+ * cb is called with the clock, the time the reply arrived and the round
+ * trip latency in us; it owns data from then on. On failure data still
+ * belongs to the caller.
+ */
+static gboolean read_btclock(struct mcap_mcl *mcl, int retries,
+						btclock_cb cb, void *data)
 {
-	int which = 1;
 	struct btd_adapter *adapter;
+	struct btclock_req *req;
+	unsigned int id;
 
 	adapter = adapter_find(&mcl->mi->src);
 	if (!adapter)
 		return FALSE;
 
-	if (btd_adapter_read_clock(adapter, &mcl->addr, which, 1000,
-						btclock, btaccuracy) < 0)
+	req = g_new0(struct btclock_req, 1);
+	req->mcl = mcl;
+	req->adapter = btd_adapter_ref(adapter);
+	req->retries = retries;
+	req->cb = cb;
+	req->data = data;
+
+	clock_gettime(CLK, &req->start);
+
+	id = btd_adapter_read_clock(adapter, &mcl->addr, 1, btclock_complete,
+						req, btclock_req_free);
+	if (!id) {
+		btd_adapter_unref(req->adapter);
+		g_free(req);
 		return FALSE;
+	}
+
+	req->id = id;
+	mcl->csp->clock_reqs = g_slist_prepend(mcl->csp->clock_reqs, req);
 
 	return TRUE;
 }
 
-static gboolean read_btclock_retry(struct mcap_mcl *mcl, uint32_t *btclock,
-							uint16_t *btaccuracy)
+static void cancel_btclock_reqs(struct mcap_mcl *mcl)
 {
-	int retries = 5;
+	GSList *reqs = mcl->csp->clock_reqs;
+	GSList *l;
 
-	while (--retries >= 0) {
-		if (read_btclock(mcl, btclock, btaccuracy))
-			return TRUE;
-		DBG("CSP: retrying to read bt clock...");
+	mcl->csp->clock_reqs = NULL;
+
+	for (l = reqs; l; l = l->next) {
+		struct btclock_req *req = l->data;
+
+		req->mcl = NULL;
+		btd_adapter_cancel_read_clock(req->adapter, req->id);
 	}
 
-	return FALSE;
+	g_slist_free(reqs);
 }
 
 static gboolean get_btrole(struct mcap_mcl *mcl)
@@ -291,65 +404,55 @@ uint64_t mcap_get_timestamp(struct mcap_mcl *mcl,
 	return tmstamp;
 }
 
+/*
+ * The clock is extrapolated from the last value read from the adapter,
+ * and a new read is started in the background to refresh it.
+ */
 uint32_t mcap_get_btclock(struct mcap_mcl *mcl)
 {
-	uint32_t btclock;
-	uint16_t accuracy;
+	struct timespec now;
+	uint64_t elapsed;
 
 	if (!mcl->csp)
 		return MCAP_BTCLOCK_IMMEDIATE;
 
-	if (!read_btclock_retry(mcl, &btclock, &accuracy))
-		btclock = 0xffffffff;
+	if (!mcl->csp->clock_reqs)
+		read_btclock(mcl, 5, NULL, NULL);
 
-	return btclock;
+	if (!mcl->csp->last_btclock_valid)
+		return 0xffffffff;
+
+	clock_gettime(CLK, &now);
+	elapsed = time_us(&now) - time_us(&mcl->csp->last_btclock_time);
+
+	return (mcl->csp->last_btclock + us2bt(elapsed)) % MCAP_BTCLOCK_FIELD;
 }
 
-static gboolean initialize_caps(struct mcap_mcl *mcl)
-{
-	struct timespec t1, t2;
+struct csp_calibration {
 	int latencies[SAMPLE_COUNT];
-	int latency, avg, dev;
-	uint32_t btclock;
-	uint16_t btaccuracy;
-	int i;
+	int count;
 	int retries;
+	uint16_t required_accuracy;	/* Of the pending cap request */
+};
 
-	clock_getres(CLK, &t1);
-
-	_caps.ts_res = time_us(&t1);
-	if (_caps.ts_res < 1)
-		_caps.ts_res = 1;
-
-	_caps.ts_acc = 20; /* ppm, estimated */
-
-	/* A little exercise before measuing latency */
-	clock_gettime(CLK, &t1);
-	read_btclock_retry(mcl, &btclock, &btaccuracy);
-
-	/* Read clock a number of times and measure latency */
-	avg = 0;
-	i = 0;
-	retries = MAX_RETRIES;
-	while (i < SAMPLE_COUNT && retries > 0) {
-		clock_gettime(CLK, &t1);
-		if (!read_btclock(mcl, &btclock, &btaccuracy)) {
-			retries--;
-			continue;
-		}
-		clock_gettime(CLK, &t2);
-
-		latency = time_us(&t2) - time_us(&t1);
-		latencies[i] = latency;
-		avg += latency;
-		i++;
-	}
+static void cap_req_continue(struct mcap_mcl *mcl, uint16_t required_accuracy);
+static int send_sync_cap_rsp(struct mcap_mcl *mcl, uint8_t rspcode,
+			uint8_t btclockres, uint16_t synclead,
+			uint16_t tmstampres, uint16_t tmstampacc);
 
-	if (retries <= 0)
-		return FALSE;
+static void calibration_done(struct mcap_mcl *mcl,
+					struct csp_calibration *calib)
+{
+	int *latencies = calib->latencies;
+	int latency, avg, dev;
+	int i;
 
 	/* Calculate average and deviation */
+	avg = 0;
+	for (i = 0; i < SAMPLE_COUNT; ++i)
+		avg += latencies[i];
 	avg /= SAMPLE_COUNT;
+
 	dev = 0;
 	for (i = 0; i < SAMPLE_COUNT; ++i)
 		dev += abs(latencies[i] - avg);
@@ -370,16 +473,88 @@ static gboolean initialize_caps(struct mcap_mcl *mcl)
 	_caps.syncleadtime_ms = latency * 50 / 1000;
 
 	csp_caps_initialized = TRUE;
-	return TRUE;
+}
+
+static void calibration_sample(struct mcap_mcl *mcl, gboolean success,
+					uint32_t btclock, uint16_t btres,
+					struct timespec *recv_time,
+					int latency, void *data)
+{
+	struct csp_calibration *calib = data;
+	uint16_t required_accuracy = calib->required_accuracy;
+
+	if (success)
+		calib->latencies[calib->count++] = latency;
+	else
+		calib->retries--;
+
+	if (calib->count == SAMPLE_COUNT) {
+		calibration_done(mcl, calib);
+		g_free(calib);
+		cap_req_continue(mcl, required_accuracy);
+		return;
+	}
+
+	/* Read clock a number of times and measure latency */
+	if (calib->retries > 0 &&
+			read_btclock(mcl, 0, calibration_sample, calib))
+		return;
+
+	g_free(calib);
+
+	/* Temporary failure in reading BT clock */
+	send_sync_cap_rsp(mcl, MCAP_RESOURCE_UNAVAILABLE, 0, 0, 0, 0);
+}
+
+static void calibration_start(struct mcap_mcl *mcl, gboolean success,
+					uint32_t btclock, uint16_t btres,
+					struct timespec *recv_time,
+					int latency, void *data)
+{
+	/* Warm up read done, its latency is not representative */
+	if (read_btclock(mcl, 0, calibration_sample, data))
+		return;
+
+	g_free(data);
+
+	send_sync_cap_rsp(mcl, MCAP_RESOURCE_UNAVAILABLE, 0, 0, 0, 0);
+}
+
+/*
+ * Measure the latency of reading the BT clock, answering the pending
+ * capabilities request once done.
+ */
+static gboolean initialize_caps(struct mcap_mcl *mcl,
+						uint16_t required_accuracy)
+{
+	struct csp_calibration *calib;
+	struct timespec t1;
+
+	clock_getres(CLK, &t1);
+
+	_caps.ts_res = time_us(&t1);
+	if (_caps.ts_res < 1)
+		_caps.ts_res = 1;
+
+	_caps.ts_acc = 20; /* ppm, estimated */
+
+	calib = g_new0(struct csp_calibration, 1);
+	calib->retries = MAX_RETRIES;
+	calib->required_accuracy = required_accuracy;
+
+	/* A little exercise before measuing latency */
+	if (read_btclock(mcl, 5, calibration_start, calib))
+		return TRUE;
+
+	g_free(calib);
+
+	return FALSE;
 }
 
 static struct csp_caps *caps(struct mcap_mcl *mcl)
 {
 	if (!csp_caps_initialized)
-		if (!initialize_caps(mcl)) {
-			/* Temporary failure in reading BT clock */
-			return NULL;
-		}
+		return NULL;
 
 	return &_caps;
 }
@@ -407,28 +582,35 @@ static int send_sync_cap_rsp(struct mcap_mcl *mcl, uint8_t rspcode,
 	return sent;
 }
 
-static void proc_sync_cap_req(struct mcap_mcl *mcl, uint8_t *cmd, uint32_t len)
+static void cap_req_clock(struct mcap_mcl *mcl, gboolean success,
+					uint32_t btclock, uint16_t btres,
+					struct timespec *recv_time,
+					int latency, void *data)
 {
-	mcap_md_sync_cap_req *req;
-	uint16_t required_accuracy;
-	uint16_t our_accuracy;
-	uint32_t btclock;
-	uint16_t btres;
-
-	if (len != sizeof(mcap_md_sync_cap_req)) {
-		send_sync_cap_rsp(mcl, MCAP_INVALID_PARAM_VALUE,
-					0, 0, 0, 0);
-		return;
-	}
+	uint16_t *required_accuracy = data;
 
-	if (!caps(mcl)) {
+	if (!success) {
 		send_sync_cap_rsp(mcl, MCAP_RESOURCE_UNAVAILABLE,
 					0, 0, 0, 0);
+		g_free(required_accuracy);
 		return;
 	}
 
-	req = (mcap_md_sync_cap_req *) cmd;
-	required_accuracy = ntohs(req->timest);
+	mcl->csp->remote_caps = 1;
+	mcl->csp->rem_req_acc = *required_accuracy;
+
+	send_sync_cap_rsp(mcl, MCAP_SUCCESS, btres,
+				caps(mcl)->syncleadtime_ms,
+				caps(mcl)->ts_res, caps(mcl)->ts_acc);
+
+	g_free(required_accuracy);
+}
+
+static void cap_req_continue(struct mcap_mcl *mcl, uint16_t required_accuracy)
+{
+	uint16_t our_accuracy;
+	uint16_t *data;
+
 	our_accuracy = caps(mcl)->ts_acc;
 
 	if (required_accuracy < our_accuracy || required_accuracy < 1) {
@@ -437,18 +619,38 @@ static void proc_sync_cap_req(struct mcap_mcl *mcl, uint8_t *cmd, uint32_t len)
 		return;
 	}
 
-	if (!read_btclock_retry(mcl, &btclock, &btres)) {
+	data = g_new(uint16_t, 1);
+	*data = required_accuracy;
+
+	if (!read_btclock(mcl, 5, cap_req_clock, data)) {
+		g_free(data);
 		send_sync_cap_rsp(mcl, MCAP_RESOURCE_UNAVAILABLE,
 					0, 0, 0, 0);
+	}
+}
+
+static void proc_sync_cap_req(struct mcap_mcl *mcl, uint8_t *cmd, uint32_t len)
+{
+	mcap_md_sync_cap_req *req;
+	uint16_t required_accuracy;
+
+	if (len != sizeof(mcap_md_sync_cap_req)) {
+		send_sync_cap_rsp(mcl, MCAP_INVALID_PARAM_VALUE,
+					0, 0, 0, 0);
 		return;
 	}
 
-	mcl->csp->remote_caps = 1;
-	mcl->csp->rem_req_acc = required_accuracy;
+	req = (mcap_md_sync_cap_req *) cmd;
+	required_accuracy = ntohs(req->timest);
 
-	send_sync_cap_rsp(mcl, MCAP_SUCCESS, btres,
-				caps(mcl)->syncleadtime_ms,
-				caps(mcl)->ts_res, our_accuracy);
+	if (caps(mcl)) {
+		cap_req_continue(mcl, required_accuracy);
+		return;
+	}
+
+	if (!initialize_caps(mcl, required_accuracy))
+		send_sync_cap_rsp(mcl, MCAP_RESOURCE_UNAVAILABLE,
+					0, 0, 0, 0);
 }
 
 static int send_sync_set_rsp(struct mcap_mcl *mcl, uint8_t rspcode,
@@ -472,48 +674,108 @@ static int send_sync_set_rsp(struct mcap_mcl *mcl, uint8_t rspcode,
 	return sent;
 }
 
-static gboolean get_all_clocks(struct mcap_mcl *mcl, uint32_t *btclock,
-				struct timespec *base_time,
-				uint64_t *timestamp)
+typedef void (*all_clocks_cb) (struct mcap_mcl *mcl, gboolean success,
+					uint32_t btclock,
+					struct timespec *base_time,
+					uint64_t timestamp);
+
+struct all_clocks_data {
+	int		retry;
+	gboolean	valid;
+	uint32_t	btclock;
+	struct timespec	base_time;
+	all_clocks_cb	cb;
+};
+
+static void all_clocks_read(struct mcap_mcl *mcl, gboolean success,
+					uint32_t btclock, uint16_t btres,
+					struct timespec *recv_time,
+					int latency, void *user_data)
+{
+	struct all_clocks_data *data = user_data;
+
+	if (success) {
+		data->valid = TRUE;
+		data->btclock = btclock;
+		data->base_time = *recv_time;
+
+		/* Tries to detect preemption between clock_gettime
+		 * and read_btclock by measuring transaction time
+		 */
+		if (latency <= caps(mcl)->preempt_thresh)
+			goto done;
+	}
+
+	if (--data->retry > 0 &&
+			read_btclock(mcl, 0, all_clocks_read, data))
+		return;
+
+done:
+	data->cb(mcl, data->valid, data->btclock, &data->base_time,
+				mcap_get_timestamp(mcl, &data->base_time));
+	g_free(data);
+}
+
+static gboolean get_all_clocks(struct mcap_mcl *mcl, all_clocks_cb cb)
 {
-	int latency;
-	int retry = 5;
-	uint16_t btres;
-	struct timespec t0;
+	struct all_clocks_data *data;
 
 	if (!caps(mcl))
 		return FALSE;
 
-	latency = caps(mcl)->preempt_thresh + 1;
+	data = g_new0(struct all_clocks_data, 1);
+	data->retry = 5;
+	data->cb = cb;
+
+	if (read_btclock(mcl, 0, all_clocks_read, data))
+		return TRUE;
 
-	while (latency > caps(mcl)->preempt_thresh && --retry >= 0) {
+	g_free(data);
 
-		clock_gettime(CLK, &t0);
+	return FALSE;
+}
 
-		if (!read_btclock(mcl, btclock, &btres))
-			continue;
+static void stop_indications(struct mcap_mcl *mcl)
+{
+	if (!mcl->csp->ind_timer)
+		return;
 
-		clock_gettime(CLK, base_time);
+	g_source_remove(mcl->csp->ind_timer);
+	mcl->csp->ind_timer = 0;
+}
 
-		/* Tries to detect preemption between clock_gettime
-		 * and read_btclock by measuring transaction time
-		 */
-		latency = time_us(base_time) - time_us(&t0);
+static void send_indication(struct mcap_mcl *mcl, gboolean success,
+					uint32_t btclock,
+					struct timespec *base_time,
+					uint64_t tmstamp)
+{
+	mcap_md_sync_info_ind *cmd;
+	int sent;
+
+	mcl->csp->ind_pending = FALSE;
+
+	if (!success) {
+		stop_indications(mcl);
+		return;
 	}
 
-	*timestamp = mcap_get_timestamp(mcl, base_time);
+	cmd = g_new0(mcap_md_sync_info_ind, 1);
 
-	return TRUE;
+	cmd->op = MCAP_MD_SYNC_INFO_IND;
+	cmd->btclock = htonl(btclock);
+	cmd->timestst = hton64(tmstamp);
+	cmd->timestsa = htons(caps(mcl)->latency);
+
+	sent = send_sync_cmd(mcl, cmd, sizeof(*cmd));
+	g_free(cmd);
+
+	if (sent)
+		stop_indications(mcl);
 }
 
 static gboolean sync_send_indication(gpointer user_data)
 {
 	struct mcap_mcl *mcl;
-	mcap_md_sync_info_ind *cmd;
-	uint32_t btclock;
-	uint64_t tmstamp;
-	struct timespec base_time;
-	int sent;
 
 	if (!user_data)
 		return FALSE;
@@ -523,45 +785,40 @@ static gboolean sync_send_indication(gpointer user_data)
 	if (!caps(mcl))
 		return FALSE;
 
-	if (!get_all_clocks(mcl, &btclock, &base_time, &tmstamp))
-		return FALSE;
-
-	cmd = g_new0(mcap_md_sync_info_ind, 1);
+	/* Still waiting for the clocks of the previous indication */
+	if (mcl->csp->ind_pending)
+		return TRUE;
 
-	cmd->op = MCAP_MD_SYNC_INFO_IND;
-	cmd->btclock = htonl(btclock);
-	cmd->timestst = hton64(tmstamp);
-	cmd->timestsa = htons(caps(mcl)->latency);
+	if (!get_all_clocks(mcl, send_indication))
+		return FALSE;
 
-	sent = send_sync_cmd(mcl, cmd, sizeof(*cmd));
-	g_free(cmd);
+	mcl->csp->ind_pending = TRUE;
 
-	return !sent;
+	return TRUE;
 }
 
-static gboolean proc_sync_set_req_phase2(gpointer user_data)
+static void sync_set_req_clocks(struct mcap_mcl *mcl, gboolean success,
+					uint32_t btclock,
+					struct timespec *base_time,
+					uint64_t tmstamp)
 {
-	struct mcap_mcl *mcl;
 	struct sync_set_data *data;
 	uint8_t update;
 	uint32_t sched_btclock;
 	uint64_t new_tmstamp;
 	int ind_freq;
 	int role;
-	uint32_t btclock;
-	uint64_t tmstamp;
-	struct timespec base_time;
 	uint16_t tmstampacc;
 	gboolean reset;
 	int delay;
 
-	if (!user_data)
-		return FALSE;
-
-	mcl = user_data;
+	if (!success) {
+		send_sync_set_rsp(mcl, MCAP_UNSPECIFIED_ERROR, 0, 0, 0);
+		return;
+	}
 
 	if (!mcl->csp->set_data)
-		return FALSE;
+		return;
 
 	data = mcl->csp->set_data;
 	update = data->update;
@@ -570,19 +827,9 @@ static gboolean proc_sync_set_req_phase2(gpointer user_data)
 	ind_freq = data->ind_freq;
 	role = data->role;
 
-	if (!caps(mcl)) {
-		send_sync_set_rsp(mcl, MCAP_UNSPECIFIED_ERROR, 0, 0, 0);
-		return FALSE;
-	}
-
-	if (!get_all_clocks(mcl, &btclock, &base_time, &tmstamp)) {
-		send_sync_set_rsp(mcl, MCAP_UNSPECIFIED_ERROR, 0, 0, 0);
-		return FALSE;
-	}
-
 	if (get_btrole(mcl) != role) {
 		send_sync_set_rsp(mcl, MCAP_INVALID_OPERATION, 0, 0, 0);
-		return FALSE;
+		return;
 	}
 
 	reset = (new_tmstamp != MCAP_TMSTAMP_DONTSET);
@@ -599,16 +846,13 @@ static gboolean proc_sync_set_req_phase2(gpointer user_data)
 									delay);
 		}
 
-		reset_tmstamp(mcl->csp, &base_time, new_tmstamp);
+		reset_tmstamp(mcl->csp, base_time, new_tmstamp);
 		tmstamp = new_tmstamp;
 	}
 
 	tmstampacc = caps(mcl)->latency + caps(mcl)->ts_acc;
 
-	if (mcl->csp->ind_timer) {
-		g_source_remove(mcl->csp->ind_timer);
-		mcl->csp->ind_timer = 0;
-	}
+	stop_indications(mcl);
 
 	if (update) {
 		int when = ind_freq + caps(mcl)->syncleadtime_ms;
@@ -622,55 +866,44 @@ static gboolean proc_sync_set_req_phase2(gpointer user_data)
 	/* First indication after set is immediate */
 	if (update)
 		sync_send_indication(mcl);
-
-	return FALSE;
 }
 
-static void proc_sync_set_req(struct mcap_mcl *mcl, uint8_t *cmd, uint32_t len)
+static gboolean proc_sync_set_req_phase2(gpointer user_data)
 {
-	mcap_md_sync_set_req *req;
-	uint32_t sched_btclock, cur_btclock;
-	uint16_t btres;
-	uint8_t update;
-	uint64_t timestamp;
-	struct sync_set_data *set_data;
-	int phase2_delay, ind_freq, when;
-
-	if (len != sizeof(mcap_md_sync_set_req)) {
-		send_sync_set_rsp(mcl, MCAP_INVALID_PARAM_VALUE, 0, 0, 0);
-		return;
-	}
-
-	req = (mcap_md_sync_set_req *) cmd;
-	sched_btclock = ntohl(req->btclock);
-	update = req->timestui;
-	timestamp = ntoh64(req->timestst);
+	struct mcap_mcl *mcl;
 
-	if (sched_btclock != MCAP_BTCLOCK_IMMEDIATE &&
-			!valid_btclock(sched_btclock)) {
-		send_sync_set_rsp(mcl, MCAP_INVALID_PARAM_VALUE, 0, 0, 0);
-		return;
-	}
+	if (!user_data)
+		return FALSE;
 
-	if (update > 1) {
-		send_sync_set_rsp(mcl, MCAP_INVALID_PARAM_VALUE, 0, 0, 0);
-		return;
-	}
+	mcl = user_data;
+	mcl->csp->set_timer = 0;
 
-	if (!mcl->csp->remote_caps) {
-		/* Remote side did not ask our capabilities yet */
-		send_sync_set_rsp(mcl, MCAP_INVALID_PARAM_VALUE, 0, 0, 0);
-		return;
-	}
+	if (!mcl->csp->set_data)
+		return FALSE;
 
 	if (!caps(mcl)) {
 		send_sync_set_rsp(mcl, MCAP_UNSPECIFIED_ERROR, 0, 0, 0);
-		return;
+		return FALSE;
 	}
 
-	if (!read_btclock_retry(mcl, &cur_btclock, &btres)) {
+	if (!get_all_clocks(mcl, sync_set_req_clocks))
 		send_sync_set_rsp(mcl, MCAP_UNSPECIFIED_ERROR, 0, 0, 0);
-		return;
+
+	return FALSE;
+}
+
+static void set_req_clock(struct mcap_mcl *mcl, gboolean success,
+					uint32_t cur_btclock, uint16_t btres,
+					struct timespec *recv_time,
+					int latency, void *user_data)
+{
+	struct sync_set_data *set_data = user_data;
+	uint32_t sched_btclock = set_data->sched_btclock;
+	int phase2_delay, ind_freq, when;
+
+	if (!success) {
+		send_sync_set_rsp(mcl, MCAP_UNSPECIFIED_ERROR, 0, 0, 0);
+		goto fail;
 	}
 
 	if (sched_btclock == MCAP_BTCLOCK_IMMEDIATE)
@@ -682,7 +915,7 @@ static void proc_sync_set_req(struct mcap_mcl *mcl, uint8_t *cmd, uint32_t len)
 			/* can not reset in the past tense */
 			send_sync_set_rsp(mcl, MCAP_INVALID_PARAM_VALUE,
 						0, 0, 0);
-			return;
+			goto fail;
 		}
 
 		/* Convert to miliseconds */
@@ -692,16 +925,16 @@ static void proc_sync_set_req(struct mcap_mcl *mcl, uint8_t *cmd, uint32_t len)
 			/* More than 60 seconds in the future */
 			send_sync_set_rsp(mcl, MCAP_INVALID_PARAM_VALUE,
 						0, 0, 0);
-			return;
+			goto fail;
 		} else if (phase2_delay < caps(mcl)->latency / 1000) {
 			/* Too fast for us to do in time */
 			send_sync_set_rsp(mcl, MCAP_INVALID_PARAM_VALUE,
 						0, 0, 0);
-			return;
+			goto fail;
 		}
 	}
 
-	if (update) {
+	if (set_data->update) {
 		/* Indication frequency: required accuracy divided by ours */
 		/* Converted to milisseconds */
 		ind_freq = (1000 * mcl->csp->rem_req_acc) / caps(mcl)->ts_acc;
@@ -710,27 +943,24 @@ static void proc_sync_set_req(struct mcap_mcl *mcl, uint8_t *cmd, uint32_t len)
 			/* Too frequent, we can't handle */
 			send_sync_set_rsp(mcl, MCAP_INVALID_PARAM_VALUE,
 						0, 0, 0);
-			return;
+			goto fail;
 		}
 
 		DBG("CSP: indication every %dms", ind_freq);
 	} else
 		ind_freq = 0;
 
-	if (mcl->csp->ind_timer) {
-		/* Old indications are no longer sent */
-		g_source_remove(mcl->csp->ind_timer);
-		mcl->csp->ind_timer = 0;
-	}
+	/* Old indications are no longer sent */
+	stop_indications(mcl);
 
-	if (!mcl->csp->set_data)
-		mcl->csp->set_data = g_new0(struct sync_set_data, 1);
+	if (mcl->csp->set_timer) {
+		g_source_remove(mcl->csp->set_timer);
+		mcl->csp->set_timer = 0;
+	}
 
-	set_data = (struct sync_set_data *) mcl->csp->set_data;
+	g_free(mcl->csp->set_data);
+	mcl->csp->set_data = set_data;
 
-	set_data->update = update;
-	set_data->sched_btclock = sched_btclock;
-	set_data->timestamp = timestamp;
 	set_data->ind_freq = ind_freq;
 	set_data->role = get_btrole(mcl);
 
@@ -747,8 +977,64 @@ static void proc_sync_set_req(struct mcap_mcl *mcl, uint8_t *cmd, uint32_t len)
 		proc_sync_set_req_phase2(mcl);
 
 	/* First indication is immediate */
-	if (update)
+	if (set_data->update)
 		sync_send_indication(mcl);
+
+	return;
+
+fail:
+	g_free(set_data);
+}
+
+static void proc_sync_set_req(struct mcap_mcl *mcl, uint8_t *cmd, uint32_t len)
+{
+	mcap_md_sync_set_req *req;
+	uint32_t sched_btclock;
+	uint8_t update;
+	uint64_t timestamp;
+	struct sync_set_data *set_data;
+
+	if (len != sizeof(mcap_md_sync_set_req)) {
+		send_sync_set_rsp(mcl, MCAP_INVALID_PARAM_VALUE, 0, 0, 0);
+		return;
+	}
+
+	req = (mcap_md_sync_set_req *) cmd;
+	sched_btclock = ntohl(req->btclock);
+	update = req->timestui;
+	timestamp = ntoh64(req->timestst);
+
+	if (sched_btclock != MCAP_BTCLOCK_IMMEDIATE &&
+			!valid_btclock(sched_btclock)) {
+		send_sync_set_rsp(mcl, MCAP_INVALID_PARAM_VALUE, 0, 0, 0);
+		return;
+	}
+
+	if (update > 1) {
+		send_sync_set_rsp(mcl, MCAP_INVALID_PARAM_VALUE, 0, 0, 0);
+		return;
+	}
+
+	if (!mcl->csp->remote_caps) {
+		/* Remote side did not ask our capabilities yet */
+		send_sync_set_rsp(mcl, MCAP_INVALID_PARAM_VALUE, 0, 0, 0);
+		return;
+	}
+
+	if (!caps(mcl)) {
+		send_sync_set_rsp(mcl, MCAP_UNSPECIFIED_ERROR, 0, 0, 0);
+		return;
+	}
+
+	set_data = g_new0(struct sync_set_data, 1);
+	set_data->update = update;
+	set_data->sched_btclock = sched_btclock;
+	set_data->timestamp = timestamp;
+
+	if (!read_btclock(mcl, 5, set_req_clock, set_data)) {
+		g_free(set_data);
+		send_sync_set_rsp(mcl, MCAP_UNSPECIFIED_ERROR, 0, 0, 0);
+	}
 }
 
 static void proc_sync_cap_rsp(struct mcap_mcl *mcl, uint8_t *cmd, uint32_t len)
@@ -543,8 +543,9 @@ static void attio_connected_cb(GAttrib *attrib, gpointer user_data)
 
 	hr->attrib = g_attrib_ref(attrib);
 
-	gatt_discover_char(hr->attrib, hr->svc_range->start, hr->svc_range->end,
-						NULL, discover_char_cb, hr);
+	btd_device_gatt_discover_char(hr->dev, hr->svc_range->start,
+						hr->svc_range->end, NULL,
+						discover_char_cb, hr);
 }
 
 static void attio_disconnected_cb(gpointer user_data)
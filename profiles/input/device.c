@@ -48,6 +48,7 @@
 #include "src/profile.h"
 #include "src/service.h"
 #include "src/storage.h"
+#include "src/keyfile.h"
 #include "src/dbus-common.h"
 #include "src/error.h"
 #include "src/sdp-client.h"
@@ -454,10 +455,8 @@ static int hidp_add_connection(struct input_device *idev)
 	filename[PATH_MAX] = '\0';
 	sprintf(handle, "0x%8.8X", idev->handle);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = keyfile_get(filename);
 	str = g_key_file_get_string(key_file, "ServiceRecords", handle, NULL);
-	g_key_file_free(key_file);
 
 	if (!str) {
 		error("Rejected connection from unknown device %s", dst_addr);
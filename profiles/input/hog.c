@@ -102,11 +102,6 @@ struct report {
 	struct hog_device	*hogdev;
 };
 
-struct disc_desc_cb_data {
-	uint16_t end;
-	gpointer data;
-};
-
 static gboolean suspend_supported = FALSE;
 static GSList *devices = NULL;
 
@@ -199,90 +194,58 @@ static void external_report_reference_cb(guint8 status, const guint8 *pdu,
 					guint16 plen, gpointer user_data);
 
 
-static void discover_descriptor_cb(guint8 status, const guint8 *pdu,
-					guint16 len, gpointer user_data)
+static void discover_descriptor_cb(uint8_t status, GSList *descs,
+							void *user_data)
 {
-	struct disc_desc_cb_data *ddcb_data = user_data;
 	struct report *report;
 	struct hog_device *hogdev;
-	struct att_data_list *list = NULL;
-	GAttrib *attrib = NULL;
-	uint8_t format;
-	uint16_t handle = 0xffff;
-	uint16_t end = ddcb_data->end;
-	int i;
+	bt_uuid_t ccc_uuid, report_ref_uuid, ext_report_ref_uuid;
+	GSList *l;
 
 	if (status == ATT_ECODE_ATTR_NOT_FOUND) {
 		DBG("Discover all characteristic descriptors finished");
-		goto done;
+		return;
 	}
 
-	if (status != 0) {
+	/* A partial list is handled as it would have been before */
+	if (status != 0)
 		error("Discover all characteristic descriptors failed: %s",
 							att_ecode2str(status));
-		goto done;
-	}
 
-	list = dec_find_info_resp(pdu, len, &format);
-	if (list == NULL)
-		return;
+	bt_uuid16_create(&ccc_uuid, GATT_CLIENT_CHARAC_CFG_UUID);
+	bt_uuid16_create(&report_ref_uuid, GATT_REPORT_REFERENCE);
+	bt_uuid16_create(&ext_report_ref_uuid, GATT_EXTERNAL_REPORT_REFERENCE);
+
+	for (l = descs; l; l = l->next) {
+		struct gatt_desc *desc = l->data;
+		bt_uuid_t uuid;
+
+		if (bt_string_to_uuid(&uuid, desc->uuid) < 0)
+			continue;
 
-	if (format != ATT_FIND_INFO_RESP_FMT_16BIT)
-		goto done;
-
-	for (i = 0; i < list->num; i++) {
-		uint16_t uuid16;
-		uint8_t *value;
-
-		value = list->data[i];
-		handle = get_le16(value);
-		uuid16 = get_le16(&value[2]);
-
-		switch (uuid16) {
-		case GATT_CLIENT_CHARAC_CFG_UUID:
-			report = ddcb_data->data;
-			attrib = report->hogdev->attrib;
-			write_ccc(handle, report);
-			break;
-		case GATT_REPORT_REFERENCE:
-			report = ddcb_data->data;
-			attrib = report->hogdev->attrib;
-			gatt_read_char(attrib, handle,
+		if (bt_uuid_cmp(&uuid, &ccc_uuid) == 0) {
+			report = user_data;
+			write_ccc(desc->handle, report);
+		} else if (bt_uuid_cmp(&uuid, &report_ref_uuid) == 0) {
+			report = user_data;
+			gatt_read_char(report->hogdev->attrib, desc->handle,
 						report_reference_cb, report);
-			break;
-		case GATT_EXTERNAL_REPORT_REFERENCE:
-			hogdev = ddcb_data->data;
-			attrib = hogdev->attrib;
-			gatt_read_char(attrib, handle,
+		} else if (bt_uuid_cmp(&uuid, &ext_report_ref_uuid) == 0) {
+			hogdev = user_data;
+			gatt_read_char(hogdev->attrib, desc->handle,
 					external_report_reference_cb, hogdev);
-			break;
 		}
 	}
-
-done:
-	att_data_list_free(list);
-
-	if (handle != 0xffff && handle < end)
-		gatt_discover_char_desc(attrib, handle + 1, end,
-					discover_descriptor_cb, ddcb_data);
-	else
-		g_free(ddcb_data);
 }
 
-static void discover_descriptor(GAttrib *attrib, uint16_t start, uint16_t end,
-							gpointer user_data)
+static void discover_descriptor(struct hog_device *hogdev, uint16_t start,
+					uint16_t end, gpointer user_data)
 {
-	struct disc_desc_cb_data *ddcb_data;
-
 	if (start > end)
 		return;
 
-	ddcb_data = g_new0(struct disc_desc_cb_data, 1);
-	ddcb_data->end = end;
-	ddcb_data->data = user_data;
-
-	gatt_discover_char_desc(attrib, start, end, discover_descriptor_cb,
-								ddcb_data);
+	btd_device_gatt_discover_desc(hogdev->device, start, end,
+					discover_descriptor_cb, user_data);
 }
 
 static void external_service_char_cb(uint8_t status, GSList *chars,
@@ -315,7 +278,7 @@ static void external_service_char_cb(uint8_t status, GSList *chars,
 		hogdev->reports = g_slist_append(hogdev->reports, report);
 		start = chr->value_handle + 1;
 		end = (next ? next->handle - 1 : prim->range.end);
-		discover_descriptor(hogdev->attrib, start, end, report);
+		discover_descriptor(hogdev, start, end, report);
 	}
 }
 
@@ -516,11 +479,11 @@ static void char_discovered_cb(uint8_t status, GSList *chars, void *user_data)
 			report->decl = g_memdup(chr, sizeof(*chr));
 			hogdev->reports = g_slist_append(hogdev->reports,
 								report);
-			discover_descriptor(hogdev->attrib, start, end, report);
+			discover_descriptor(hogdev, start, end, report);
 		} else if (bt_uuid_cmp(&uuid, &report_map_uuid) == 0) {
 			gatt_read_char(hogdev->attrib, chr->value_handle,
 						report_map_read_cb, hogdev);
-			discover_descriptor(hogdev->attrib, start, end, hogdev);
+			discover_descriptor(hogdev, start, end, hogdev);
 		} else if (bt_uuid_cmp(&uuid, &info_uuid) == 0)
 			info_handle = chr->value_handle;
 		else if (bt_uuid_cmp(&uuid, &proto_mode_uuid) == 0)
@@ -693,7 +656,8 @@ static void attio_connected_cb(GAttrib *attrib, gpointer user_data)
 	hogdev->attrib = g_attrib_ref(attrib);
 
 	if (hogdev->reports == NULL) {
-		gatt_discover_char(hogdev->attrib, prim->range.start,
+		btd_device_gatt_discover_char(hogdev->device,
+						prim->range.start,
 						prim->range.end, NULL,
 						char_discovered_cb, hogdev);
 		return;
@@ -1133,8 +1133,9 @@ static void attio_connected_cb(GAttrib *attrib, gpointer user_data)
 
 	t->attrib = g_attrib_ref(attrib);
 
-	gatt_discover_char(t->attrib, t->svc_range->start, t->svc_range->end,
-					NULL, configure_thermometer_cb, t);
+	btd_device_gatt_discover_char(t->dev, t->svc_range->start,
+					t->svc_range->end, NULL,
+					configure_thermometer_cb, t);
 }
 
 static void attio_disconnected_cb(gpointer user_data)
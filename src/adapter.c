@@ -48,6 +48,7 @@
 
 #include "log.h"
 #include "textfile.h"
+#include "keyfile.h"
 
 #include "lib/uuid.h"
 #include "lib/mgmt.h"
@@ -62,6 +63,7 @@
 #include "dbus-common.h"
 #include "error.h"
 #include "uuid-helper.h"
+#include "intern.h"
 #include "agent.h"
 #include "storage.h"
 #include "attrib/gattrib.h"
@@ -80,8 +82,11 @@
 #define CONN_SCAN_TIMEOUT (3)
 #define IDLE_DISCOV_TIMEOUT (5)
 #define TEMP_DEV_TIMEOUT (3 * 60)
+#define TEMP_DEV_MAX 1024
 #define BONDING_TIMEOUT (2 * 60)
 
+#define DISTANCE_VAL_INVALID	0x7FFF
+
 static DBusConnection *dbus_conn = NULL;
 
 static GList *adapter_list = NULL;
@@ -90,10 +95,22 @@ static bool powering_down = false;
 
 static GSList *adapters = NULL;
 
+/*
+ * Lookup tables mirroring the two lists above: adapter_index is indexed
+ * by controller index and holds every entry of adapter_list, while
+ * adapter_addrs maps the address of each entry of adapters.
+ */
+static GPtrArray *adapter_index = NULL;
+static GHashTable *adapter_addrs = NULL;
+
 static struct mgmt *mgmt_master = NULL;
 
 static uint8_t mgmt_version = 0;
 static uint8_t mgmt_revision = 0;
+static bool kernel_conn_control = false;
+
+/* For reporting how long it took until an adapter was first powered */
+static gint64 startup_time = 0;
 
 static GSList *adapter_drivers = NULL;
 
@@ -121,10 +138,18 @@ struct irk_info {
 	uint8_t val[16];
 };
 
+struct discovery_filter {
+	uint8_t type;		/* mask of (1 << BDADDR_*) transports */
+	int16_t rssi;		/* minimum RSSI or DISTANCE_VAL_INVALID */
+	uint16_t pathloss;	/* maximum pathloss or DISTANCE_VAL_INVALID */
+	GSList *uuids;		/* 128-bit bt_uuid_t, empty means any */
+};
+
 struct watch_client {
 	struct btd_adapter *adapter;
 	char *owner;
 	guint watch;
+	struct discovery_filter *filter;
 };
 
 struct service_auth {
@@ -174,19 +199,37 @@ struct btd_adapter {
 	uint8_t discovery_enable;	/* discovery enabled/disabled */
 	bool discovery_suspended;	/* discovery has been suspended */
 	GSList *discovery_list;		/* list of discovery clients */
-	GSList *discovery_found;	/* list of found devices */
+	GSList *filter_list;		/* clients with filter, not started */
+	struct discovery_filter *current_filter; /* merged client filters */
+	GHashTable *discovery_found;	/* set of found devices */
 	guint discovery_idle_timeout;	/* timeout between discovery runs */
 	guint passive_scan_timeout;	/* timeout between passive scans */
 	guint temp_devices_timeout;	/* timeout for temporary devices */
+	GQueue *temp_devices;		/* temporary devices by expiry */
+	GHashTable *temp_index;		/* device -> link in temp_devices */
+	unsigned long reports_parsed;	/* reports fully processed, total */
+	unsigned long reports_skipped;	/* reports with known payload */
+	gint64 scan_epoch;		/* first scan start (usec) */
+	gint64 scan_start;		/* current scan start (usec) */
+	gint64 scan_time;		/* total time spent scanning (usec) */
 
 	guint pairable_timeout_id;	/* pairable timeout id */
 	guint auth_idle_id;		/* Pending authorization dequeue */
 	GQueue *auths;			/* Ongoing and pending auths */
 	bool pincode_requested;		/* PIN requested during last bonding */
 	GSList *connections;		/* Connected devices */
+	GHashTable *connected_set;	/* Set of connected devices */
 	GSList *devices;		/* Devices structure pointers */
+	GHashTable *devices_by_addr;	/* bdaddr -> list of devices */
+	GHashTable *devices_by_path;	/* object path -> device */
 	GSList *connect_list;		/* Devices to connect when found */
+	GHashTable *connect_set;	/* connect_list device -> added at */
+	unsigned int reconnects;	/* auto connections completed */
+	guint64 reconnect_total;	/* sum of their latencies (ms) */
+	unsigned int reconnect_min;	/* shortest latency (ms) */
+	unsigned int reconnect_max;	/* longest latency (ms) */
 	struct btd_device *connect_le;	/* LE device waiting to be connected */
+	unsigned int le_connecting;	/* LE connection attempts ongoing */
 	sdp_list_t *services;		/* Services associated to adapter */
 
 	gboolean initialized;
@@ -208,21 +251,37 @@ struct btd_adapter {
 	guint pair_device_timeout;
 
 	bool is_default;		/* true if adapter is default one */
+	bool powered_once;		/* powered since the daemon started */
+	unsigned int stored_devices;	/* devices loaded from storage */
 };
 
 static struct btd_adapter *btd_adapter_lookup(uint16_t index)
 {
-	GList *list;
+	if (!adapter_index || index >= adapter_index->len)
+		return NULL;
 
-	for (list = g_list_first(adapter_list); list;
-						list = g_list_next(list)) {
-		struct btd_adapter *adapter = list->data;
+	return g_ptr_array_index(adapter_index, index);
+}
 
-		if (adapter->dev_id == index)
-			return adapter;
-	}
+static void adapter_list_add(struct btd_adapter *adapter)
+{
+	if (!adapter_index)
+		adapter_index = g_ptr_array_new();
 
-	return NULL;
+	if (adapter->dev_id >= adapter_index->len)
+		g_ptr_array_set_size(adapter_index, adapter->dev_id + 1);
+
+	adapter_index->pdata[adapter->dev_id] = adapter;
+
+	adapter_list = g_list_append(adapter_list, adapter);
+}
+
+static void adapter_list_remove(struct btd_adapter *adapter)
+{
+	if (btd_adapter_lookup(adapter->dev_id) == adapter)
+		adapter_index->pdata[adapter->dev_id] = NULL;
+
+	adapter_list = g_list_remove(adapter_list, adapter);
 }
 
 struct btd_adapter *btd_adapter_get_default(void)
@@ -309,6 +368,45 @@ static void set_dev_class_complete(uint8_t status, uint16_t length,
 	dev_class_changed_callback(adapter->dev_id, length, param, adapter);
 }
 
+static void set_scan_params_complete(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	struct btd_adapter *adapter = user_data;
+
+	if (status != MGMT_STATUS_SUCCESS)
+		error("Failed to set scan parameters for index %u: %s (0x%02x)",
+				adapter->dev_id, mgmt_errstr(status), status);
+}
+
+static void set_scan_params(struct btd_adapter *adapter)
+{
+	struct mgmt_cp_set_scan_params cp;
+
+	if (!(adapter->supported_settings & MGMT_SETTING_LE))
+		return;
+
+	if (!main_opts.le_scan_interval || !main_opts.le_scan_window)
+		return;
+
+	/*
+	 * The kernel uses the parameters for its background scanning and
+	 * for the scanning done while creating LE connections. Scanning
+	 * through Start Discovery always uses fixed kernel parameters.
+	 */
+	cp.interval = htobs(main_opts.le_scan_interval);
+	cp.window = htobs(main_opts.le_scan_window);
+
+	DBG("sending set scan parameters command for index %u",
+							adapter->dev_id);
+
+	if (mgmt_send(adapter->mgmt, MGMT_OP_SET_SCAN_PARAMS,
+				adapter->dev_id, sizeof(cp), &cp,
+				set_scan_params_complete, adapter, NULL) > 0)
+		return;
+
+	error("Failed to set scan parameters for index %u", adapter->dev_id);
+}
+
 static void set_dev_class(struct btd_adapter *adapter)
 {
 	struct mgmt_cp_set_dev_class cp;
@@ -379,11 +477,14 @@ static void store_adapter_info(struct btd_adapter *adapter)
 	GKeyFile *key_file;
 	char filename[PATH_MAX + 1];
 	char address[18];
-	char *str;
-	gsize length = 0;
 	gboolean discoverable;
 
-	key_file = g_key_file_new();
+	ba2str(&adapter->bdaddr, address);
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/settings", address);
+	filename[PATH_MAX] = '\0';
+
+	key_file = keyfile_get(filename);
+	g_key_file_remove_group(key_file, "General", NULL);
 
 	if (adapter->pairable_timeout != main_opts.pairto)
 		g_key_file_set_integer(key_file, "General", "PairableTimeout",
@@ -407,17 +508,7 @@ static void store_adapter_info(struct btd_adapter *adapter)
 		g_key_file_set_string(key_file, "General", "Alias",
 							adapter->stored_alias);
 
-	ba2str(&adapter->bdaddr, address);
-	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/settings", address);
-	filename[PATH_MAX] = '\0';
-
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
-
-	g_key_file_free(key_file);
+	keyfile_changed(filename);
 }
 
 static void trigger_pairable_timeout(struct btd_adapter *adapter);
@@ -715,28 +806,129 @@ int adapter_set_name(struct btd_adapter *adapter, const char *name)
 	return set_name(adapter, name);
 }
 
+static guint bdaddr_hash(gconstpointer key)
+{
+	const bdaddr_t *ba = key;
+
+	/* The LAP octets vary the most between devices */
+	return ba->b[0] | ba->b[1] << 8 | ba->b[2] << 16 | ba->b[3] << 24;
+}
+
+static gboolean bdaddr_equal(gconstpointer a, gconstpointer b)
+{
+	return bacmp(a, b) == 0;
+}
+
+/*
+ * Devices are indexed by their address only; the address type and
+ * bearer checks of device_addr_type_cmp() are done on the (nearly
+ * always single entry) list of devices sharing that address. This
+ * keeps the index valid when the bearers supported by a device change.
+ */
+static void adapter_index_device(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	const bdaddr_t *bdaddr = device_get_address(device);
+	GSList *bucket;
+
+	bucket = g_hash_table_lookup(adapter->devices_by_addr, bdaddr);
+	if (bucket)
+		bucket = g_slist_append(bucket, device);
+	else
+		g_hash_table_insert(adapter->devices_by_addr,
+					g_memdup(bdaddr, sizeof(*bdaddr)),
+					g_slist_prepend(NULL, device));
+
+	g_hash_table_insert(adapter->devices_by_path,
+				(gpointer) device_get_path(device), device);
+}
+
+static void adapter_unindex_device(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	const bdaddr_t *bdaddr = device_get_address(device);
+	GSList *bucket;
+
+	g_hash_table_remove(adapter->devices_by_path,
+						device_get_path(device));
+
+	bucket = g_hash_table_lookup(adapter->devices_by_addr, bdaddr);
+	if (!bucket)
+		return;
+
+	bucket = g_slist_remove(bucket, device);
+	if (bucket)
+		g_hash_table_insert(adapter->devices_by_addr,
+					g_memdup(bdaddr, sizeof(*bdaddr)),
+					bucket);
+	else
+		g_hash_table_remove(adapter->devices_by_addr, bdaddr);
+}
+
+static gboolean free_device_bucket(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	g_slist_free(value);
+
+	return TRUE;
+}
+
+static void adapter_clear_device_index(struct btd_adapter *adapter)
+{
+	g_hash_table_foreach_remove(adapter->devices_by_addr,
+						free_device_bucket, NULL);
+	g_hash_table_remove_all(adapter->devices_by_path);
+}
+
+static void adapter_add_device(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	adapter->devices = g_slist_prepend(adapter->devices, device);
+	adapter_index_device(adapter, device);
+}
+
+static struct btd_device *adapter_find_device_by_address(
+						struct btd_adapter *adapter,
+						const bdaddr_t *bdaddr)
+{
+	GSList *bucket;
+
+	bucket = g_hash_table_lookup(adapter->devices_by_addr, bdaddr);
+	if (!bucket)
+		return NULL;
+
+	return bucket->data;
+}
+
+static struct btd_device *adapter_find_device_by_path(
+						struct btd_adapter *adapter,
+						const char *path)
+{
+	return g_hash_table_lookup(adapter->devices_by_path, path);
+}
+
 struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 							const bdaddr_t *dst,
 							uint8_t bdaddr_type)
 {
 	struct device_addr_type addr;
-	struct btd_device *device;
-	GSList *list;
+	GSList *bucket, *list;
 
 	if (!adapter)
 		return NULL;
 
+	bucket = g_hash_table_lookup(adapter->devices_by_addr, dst);
+	if (!bucket)
+		return NULL;
+
 	bacpy(&addr.bdaddr, dst);
 	addr.bdaddr_type = bdaddr_type;
 
-	list = g_slist_find_custom(adapter->devices, &addr,
-							device_addr_type_cmp);
+	list = g_slist_find_custom(bucket, &addr, device_addr_type_cmp);
 	if (!list)
 		return NULL;
 
-	device = list->data;
-
-	return device;
+	return list->data;
 }
 
 static void uuid_to_uuid128(uuid_t *uuid128, const uuid_t *uuid)
@@ -1042,7 +1234,7 @@ static struct btd_device *adapter_create_device(struct btd_adapter *adapter,
 
 	btd_device_set_temporary(device, TRUE);
 
-	adapter->devices = g_slist_append(adapter->devices, device);
+	adapter_add_device(adapter, device);
 
 	return device;
 }
@@ -1068,19 +1260,31 @@ static void service_auth_cancel(struct service_auth *auth)
 	g_free(auth);
 }
 
+static void remove_kernel_device(struct btd_adapter *adapter,
+						struct btd_device *device);
+
 void btd_adapter_remove_device(struct btd_adapter *adapter,
 				struct btd_device *dev)
 {
 	GList *l;
 
-	adapter->connect_list = g_slist_remove(adapter->connect_list, dev);
+	if (g_hash_table_remove(adapter->connect_set, dev)) {
+		adapter->connect_list = g_slist_remove(adapter->connect_list,
+									dev);
+		if (kernel_conn_control)
+			remove_kernel_device(adapter, dev);
+	}
 
+	adapter_unindex_device(adapter, dev);
 	adapter->devices = g_slist_remove(adapter->devices, dev);
 
-	adapter->discovery_found = g_slist_remove(adapter->discovery_found,
-									dev);
+	adapter_temp_device_cancel(adapter, dev);
+
+	g_hash_table_remove(adapter->discovery_found, dev);
 
-	adapter->connections = g_slist_remove(adapter->connections, dev);
+	if (g_hash_table_remove(adapter->connected_set, dev))
+		adapter->connections = g_slist_remove(adapter->connections,
+									dev);
 
 	if (adapter->connect_le == dev)
 		adapter->connect_le = NULL;
@@ -1125,6 +1329,55 @@ sdp_list_t *btd_adapter_get_services(struct btd_adapter *adapter)
 	return adapter->services;
 }
 
+/*
+ * Keep track of how much of the time the controller has been scanning,
+ * no matter if for discovery or for passive scanning.
+ */
+static unsigned int scan_duty_cycle(struct btd_adapter *adapter, gint64 now)
+{
+	gint64 elapsed, scan_time = adapter->scan_time;
+
+	if (adapter->scan_start)
+		scan_time += now - adapter->scan_start;
+
+	elapsed = now - adapter->scan_epoch;
+	if (!adapter->scan_epoch || elapsed <= 0)
+		return 0;
+
+	/* In tenths of a percent */
+	return scan_time * 1000 / elapsed;
+}
+
+static void set_discovery_enable(struct btd_adapter *adapter, uint8_t enable)
+{
+	unsigned int duty;
+	gint64 now;
+
+	if (adapter->discovery_enable == enable)
+		return;
+
+	adapter->discovery_enable = enable;
+
+	now = g_get_monotonic_time();
+
+	if (enable) {
+		adapter->scan_start = now;
+		if (!adapter->scan_epoch)
+			adapter->scan_epoch = now;
+		return;
+	}
+
+	if (!adapter->scan_start)
+		return;
+
+	adapter->scan_time += now - adapter->scan_start;
+	adapter->scan_start = 0;
+
+	duty = scan_duty_cycle(adapter, now);
+
+	DBG("%s scan duty cycle %u.%u%%", adapter->path, duty / 10, duty % 10);
+}
+
 static void passive_scanning_complete(uint8_t status, uint16_t length,
 					const void *param, void *user_data)
 {
@@ -1140,7 +1393,7 @@ static void passive_scanning_complete(uint8_t status, uint16_t length,
 
 	if (status == MGMT_STATUS_SUCCESS) {
 		adapter->discovery_type = rp->type;
-		adapter->discovery_enable = 0x01;
+		set_discovery_enable(adapter, 0x01);
 	}
 }
 
@@ -1165,6 +1418,10 @@ static void trigger_passive_scanning(struct btd_adapter *adapter)
 	if (!(adapter->current_settings & MGMT_SETTING_LE))
 		return;
 
+	/* The kernel does the scanning for the connect list by itself */
+	if (kernel_conn_control)
+		return;
+
 	DBG("");
 
 	if (adapter->passive_scan_timeout > 0) {
@@ -1199,7 +1456,9 @@ static void trigger_passive_scanning(struct btd_adapter *adapter)
 	if (!adapter->connect_list)
 		return;
 
-	adapter->passive_scan_timeout = g_timeout_add_seconds(CONN_SCAN_TIMEOUT,
+	adapter->passive_scan_timeout = g_timeout_add_seconds(
+					main_opts.continuous_scan ? 0 :
+					CONN_SCAN_TIMEOUT,
 					passive_scanning_timeout, adapter);
 }
 
@@ -1222,7 +1481,7 @@ static void stop_passive_scanning_complete(uint8_t status, uint16_t length,
 	}
 
 	adapter->discovery_type = 0x00;
-	adapter->discovery_enable = 0x00;
+	set_discovery_enable(adapter, 0x00);
 
 	if (!dev) {
 		DBG("Device removed while stopping passive scanning");
@@ -1289,7 +1548,7 @@ static void start_discovery_complete(uint8_t status, uint16_t length,
 
 	if (status == MGMT_STATUS_SUCCESS) {
 		adapter->discovery_type = rp->type;
-		adapter->discovery_enable = 0x01;
+		set_discovery_enable(adapter, 0x01);
 
 		if (adapter->discovering)
 			return;
@@ -1325,6 +1584,11 @@ static gboolean start_discovery_timeout(gpointer user_data)
 	if (adapter->current_settings & MGMT_SETTING_LE)
 		new_type |= (1 << BDADDR_LE_PUBLIC) | (1 << BDADDR_LE_RANDOM);
 
+	/* Only scan the transports the discovery clients are interested in */
+	if (adapter->current_filter &&
+				(new_type & adapter->current_filter->type))
+		new_type &= adapter->current_filter->type;
+
 	if (adapter->discovery_enable == 0x01) {
 		/*
 		 * If there is an already running discovery and it has the
@@ -1397,7 +1661,7 @@ static void suspend_discovery_complete(uint8_t status, uint16_t length,
 
 	if (status == MGMT_STATUS_SUCCESS) {
 		adapter->discovery_type = 0x00;
-		adapter->discovery_enable = 0x00;
+		set_discovery_enable(adapter, 0x00);
 		return;
 	}
 }
@@ -1477,7 +1741,7 @@ static void discovering_callback(uint16_t index, uint16_t length,
 		return;
 
 	adapter->discovery_type = ev->type;
-	adapter->discovery_enable = ev->discovering;
+	set_discovery_enable(adapter, ev->discovering);
 
 	/*
 	 * Check for existing discoveries triggered by client applications
@@ -1496,7 +1760,19 @@ static void discovering_callback(uint16_t index, uint16_t length,
 
 	switch (adapter->discovery_enable) {
 	case 0x00:
-		trigger_start_discovery(adapter, IDLE_DISCOV_TIMEOUT);
+		if (!main_opts.continuous_scan) {
+			trigger_start_discovery(adapter, IDLE_DISCOV_TIMEOUT);
+			break;
+		}
+
+		/*
+		 * In continuous mode there is no idle phase between runs.
+		 * Creating an LE connection fails on older kernels while
+		 * scanning, so wait for pending attempts to finish first,
+		 * see adapter_le_connecting().
+		 */
+		if (!adapter->le_connecting)
+			trigger_start_discovery(adapter, 0);
 		break;
 
 	case 0x01:
@@ -1517,7 +1793,7 @@ static void stop_discovery_complete(uint8_t status, uint16_t length,
 
 	if (status == MGMT_STATUS_SUCCESS) {
 		adapter->discovery_type = 0x00;
-		adapter->discovery_enable = 0x00;
+		set_discovery_enable(adapter, 0x00);
 
 		adapter->discovering = false;
 		g_dbus_emit_property_changed(dbus_conn, adapter->path,
@@ -1535,37 +1811,301 @@ static int compare_sender(gconstpointer a, gconstpointer b)
 	return g_strcmp0(client->owner, sender);
 }
 
-static void invalidate_rssi(gpointer a)
+static void free_discovery_filter(struct discovery_filter *filter)
+{
+	if (!filter)
+		return;
+
+	g_slist_free_full(filter->uuids, g_free);
+	g_free(filter);
+}
+
+static int uuid128_cmp(gconstpointer a, gconstpointer b)
+{
+	return memcmp(a, b, sizeof(bt_uuid_t));
+}
+
+/*
+ * Merge the filters of all discovery clients into the least restrictive
+ * filter that still lets through everything any of them asked for. A
+ * single client without filter disables filtering altogether. Returns
+ * true if the set of transports to scan changed.
+ */
+static bool update_discovery_filter(struct btd_adapter *adapter)
+{
+	struct discovery_filter *merged = NULL;
+	uint8_t old_type;
+	bool any_uuid = false, any_distance = false;
+	GSList *l, *u;
+
+	old_type = adapter->current_filter ? adapter->current_filter->type :
+									0xff;
+
+	free_discovery_filter(adapter->current_filter);
+	adapter->current_filter = NULL;
+
+	for (l = adapter->discovery_list; l != NULL; l = g_slist_next(l)) {
+		struct watch_client *client = l->data;
+		struct discovery_filter *filter = client->filter;
+
+		if (!filter) {
+			free_discovery_filter(merged);
+			merged = NULL;
+			break;
+		}
+
+		if (!merged) {
+			merged = g_new0(struct discovery_filter, 1);
+			merged->rssi = DISTANCE_VAL_INVALID;
+			merged->pathloss = DISTANCE_VAL_INVALID;
+		}
+
+		merged->type |= filter->type;
+
+		if (filter->rssi == DISTANCE_VAL_INVALID &&
+				filter->pathloss == DISTANCE_VAL_INVALID)
+			any_distance = true;
+
+		if (filter->rssi != DISTANCE_VAL_INVALID &&
+					(merged->rssi == DISTANCE_VAL_INVALID ||
+					filter->rssi < merged->rssi))
+			merged->rssi = filter->rssi;
+
+		if (filter->pathloss != DISTANCE_VAL_INVALID &&
+				(merged->pathloss == DISTANCE_VAL_INVALID ||
+				filter->pathloss > merged->pathloss))
+			merged->pathloss = filter->pathloss;
+
+		if (!filter->uuids)
+			any_uuid = true;
+
+		for (u = filter->uuids; u != NULL && !any_uuid; u = u->next) {
+			if (g_slist_find_custom(merged->uuids, u->data,
+								uuid128_cmp))
+				continue;
+
+			merged->uuids = g_slist_prepend(merged->uuids,
+					g_memdup(u->data, sizeof(bt_uuid_t)));
+		}
+	}
+
+	if (merged && any_distance) {
+		merged->rssi = DISTANCE_VAL_INVALID;
+		merged->pathloss = DISTANCE_VAL_INVALID;
+	}
+
+	if (merged && any_uuid) {
+		g_slist_free_full(merged->uuids, g_free);
+		merged->uuids = NULL;
+	}
+
+	adapter->current_filter = merged;
+
+	return old_type != (merged ? merged->type : 0xff);
+}
+
+static bool discovery_filter_match(const struct discovery_filter *filter,
+					uint8_t bdaddr_type, int8_t rssi,
+					const struct eir_data *eir)
 {
-	struct btd_device *dev = a;
+	unsigned int i;
+
+	if (!(filter->type & (1 << bdaddr_type)))
+		return false;
+
+	if (filter->rssi != DISTANCE_VAL_INVALID ||
+				filter->pathloss != DISTANCE_VAL_INVALID) {
+		bool close = false;
+
+		/* 127 means the RSSI is not available */
+		if (rssi == 127)
+			return false;
+
+		if (filter->rssi != DISTANCE_VAL_INVALID &&
+						rssi >= filter->rssi)
+			close = true;
+
+		if (!close && filter->pathloss != DISTANCE_VAL_INVALID &&
+				eir->tx_power != 127 &&
+				eir->tx_power - rssi <= filter->pathloss)
+			close = true;
+
+		if (!close)
+			return false;
+	}
+
+	if (!filter->uuids)
+		return true;
+
+	for (i = 0; i < eir->uuid_count; i++) {
+		bt_uuid_t uuid;
+
+		bt_uuid_to_uuid128(&eir->uuids[i], &uuid);
+
+		if (g_slist_find_custom(filter->uuids, &uuid, uuid128_cmp))
+			return true;
+	}
+
+	return false;
+}
+
+static void invalidate_rssi(gpointer key, gpointer value, gpointer user_data)
+{
+	struct btd_device *dev = key;
 
 	device_set_rssi(dev, 0);
 }
 
 static void discovery_cleanup(struct btd_adapter *adapter)
 {
-	g_slist_free_full(adapter->discovery_found, invalidate_rssi);
-	adapter->discovery_found = NULL;
+	DBG("%lu reports processed, %lu with unchanged payload skipped",
+			adapter->reports_parsed, adapter->reports_skipped);
+
+	g_hash_table_foreach(adapter->discovery_found, invalidate_rssi, NULL);
+	g_hash_table_remove_all(adapter->discovery_found);
+}
+
+/*
+ * Temporary devices expire TEMP_DEV_TIMEOUT seconds after they were last
+ * seen. As the timeout is the same for all of them, a queue ordered by
+ * last seen time is also ordered by expiry: refreshing a device moves it
+ * to the tail and only the head ever needs to be checked.
+ */
+struct temp_device {
+	struct btd_device *device;
+	gint64 expiry;			/* monotonic time in seconds */
+};
+
+static gint64 monotonic_seconds(void)
+{
+	return g_get_monotonic_time() / G_USEC_PER_SEC;
+}
+
+static gboolean remove_temp_devices(gpointer user_data);
+
+static void schedule_temp_devices(struct btd_adapter *adapter)
+{
+	struct temp_device *temp;
+	gint64 delay;
+
+	if (adapter->temp_devices_timeout > 0) {
+		g_source_remove(adapter->temp_devices_timeout);
+		adapter->temp_devices_timeout = 0;
+	}
+
+	temp = g_queue_peek_head(adapter->temp_devices);
+	if (!temp)
+		return;
+
+	if (g_queue_get_length(adapter->temp_devices) > TEMP_DEV_MAX)
+		delay = 1;
+	else
+		delay = MAX(temp->expiry - monotonic_seconds(), 0);
+
+	adapter->temp_devices_timeout = g_timeout_add_seconds(delay,
+						remove_temp_devices, adapter);
+}
+
+void adapter_temp_device_update(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	struct temp_device *temp;
+	GList *link;
+
+	link = g_hash_table_lookup(adapter->temp_index, device);
+	if (link) {
+		g_queue_unlink(adapter->temp_devices, link);
+		temp = link->data;
+	} else {
+		temp = g_new0(struct temp_device, 1);
+		temp->device = device;
+		link = g_list_alloc();
+		link->data = temp;
+		g_hash_table_insert(adapter->temp_index, device, link);
+	}
+
+	temp->expiry = monotonic_seconds() + TEMP_DEV_TIMEOUT;
+	g_queue_push_tail_link(adapter->temp_devices, link);
+
+	/* The head only changes if the queue was empty or got too long */
+	if (adapter->temp_devices_timeout == 0 ||
+			g_queue_get_length(adapter->temp_devices) == 1 ||
+			g_queue_get_length(adapter->temp_devices) > TEMP_DEV_MAX)
+		schedule_temp_devices(adapter);
+}
+
+void adapter_temp_device_cancel(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	GList *link;
+
+	link = g_hash_table_lookup(adapter->temp_index, device);
+	if (!link)
+		return;
+
+	g_hash_table_remove(adapter->temp_index, device);
+	g_queue_unlink(adapter->temp_devices, link);
+
+	g_free(link->data);
+	g_list_free_1(link);
+}
+
+static void clear_temp_devices(struct btd_adapter *adapter)
+{
+	struct temp_device *temp;
+
+	if (adapter->temp_devices_timeout > 0) {
+		g_source_remove(adapter->temp_devices_timeout);
+		adapter->temp_devices_timeout = 0;
+	}
+
+	while ((temp = g_queue_pop_head(adapter->temp_devices)))
+		g_free(temp);
+
+	g_hash_table_remove_all(adapter->temp_index);
 }
 
 static gboolean remove_temp_devices(gpointer user_data)
 {
 	struct btd_adapter *adapter = user_data;
-	GSList *l, *next;
-
-	DBG("%s", adapter->path);
+	unsigned int checked = 0, removed = 0;
+	struct temp_device *temp;
+	gint64 now;
 
 	adapter->temp_devices_timeout = 0;
 
-	for (l = adapter->devices; l != NULL; l = next) {
-		struct btd_device *dev = l->data;
+	now = monotonic_seconds();
 
-		next = g_slist_next(l);
+	while ((temp = g_queue_peek_head(adapter->temp_devices))) {
+		struct btd_device *dev = temp->device;
 
-		if (device_is_temporary(dev))
-			btd_adapter_remove_device(adapter, dev);
+		if (temp->expiry > now &&
+			g_queue_get_length(adapter->temp_devices) <= TEMP_DEV_MAX)
+			break;
+
+		/* Don't loop forever if only busy devices are left */
+		if (checked++ > TEMP_DEV_MAX)
+			break;
+
+		/* Devices in use are given another period */
+		if (btd_device_is_connected(dev) ||
+					device_is_bonding(dev, NULL) ||
+					device_is_retrying(dev)) {
+			adapter_temp_device_update(adapter, dev);
+			continue;
+		}
+
+		btd_adapter_remove_device(adapter, dev);
+		removed++;
 	}
 
+	DBG("%s removed %u temporary devices, %u left, %ld bytes shared",
+				adapter->path, removed,
+				g_queue_get_length(adapter->temp_devices),
+				intern_bytes_saved());
+
+	schedule_temp_devices(adapter);
+
 	return FALSE;
 }
 
@@ -1579,6 +2119,7 @@ static void discovery_destroy(void *user_data)
 	adapter->discovery_list = g_slist_remove(adapter->discovery_list,
 								client);
 
+	free_discovery_filter(client->filter);
 	g_free(client->owner);
 	g_free(client);
 
@@ -1586,8 +2127,13 @@ static void discovery_destroy(void *user_data)
 	 * If there are other client discoveries in progress, then leave
 	 * it active. If not, then make sure to stop the restart timeout.
 	 */
-	if (adapter->discovery_list)
+	if (adapter->discovery_list) {
+		if (update_discovery_filter(adapter))
+			trigger_start_discovery(adapter, 0);
 		return;
+	}
+
+	update_discovery_filter(adapter);
 
 	adapter->discovery_type = 0x00;
 
@@ -1596,15 +2142,7 @@ static void discovery_destroy(void *user_data)
 		adapter->discovery_idle_timeout = 0;
 	}
 
-	if (adapter->temp_devices_timeout > 0) {
-		g_source_remove(adapter->temp_devices_timeout);
-		adapter->temp_devices_timeout = 0;
-	}
-
 	discovery_cleanup(adapter);
-
-	adapter->temp_devices_timeout = g_timeout_add_seconds(TEMP_DEV_TIMEOUT,
-						remove_temp_devices, adapter);
 }
 
 static void discovery_disconnect(DBusConnection *conn, void *user_data)
@@ -1648,11 +2186,24 @@ static void discovery_disconnect(DBusConnection *conn, void *user_data)
 				stop_discovery_complete, adapter, NULL);
 }
 
+static void filter_client_destroy(void *user_data)
+{
+	struct watch_client *client = user_data;
+	struct btd_adapter *adapter = client->adapter;
+
+	adapter->filter_list = g_slist_remove(adapter->filter_list, client);
+
+	free_discovery_filter(client->filter);
+	g_free(client->owner);
+	g_free(client);
+}
+
 static DBusMessage *start_discovery(DBusConnection *conn,
 					DBusMessage *msg, void *user_data)
 {
 	struct btd_adapter *adapter = user_data;
 	const char *sender = dbus_message_get_sender(msg);
+	struct discovery_filter *filter = NULL;
 	struct watch_client *client;
 	GSList *list;
 
@@ -1670,10 +2221,21 @@ static DBusMessage *start_discovery(DBusConnection *conn,
 	if (list)
 		return btd_error_busy(msg);
 
+	/* Take over a filter set before the discovery was started */
+	list = g_slist_find_custom(adapter->filter_list, sender,
+						compare_sender);
+	if (list) {
+		client = list->data;
+		filter = client->filter;
+		client->filter = NULL;
+		g_dbus_remove_watch(dbus_conn, client->watch);
+	}
+
 	client = g_new0(struct watch_client, 1);
 
 	client->adapter = adapter;
 	client->owner = g_strdup(sender);
+	client->filter = filter;
 	client->watch = g_dbus_add_disconnect_watch(dbus_conn, sender,
 						discovery_disconnect, client,
 						discovery_destroy);
@@ -1681,6 +2243,8 @@ static DBusMessage *start_discovery(DBusConnection *conn,
 	adapter->discovery_list = g_slist_prepend(adapter->discovery_list,
 								client);
 
+	update_discovery_filter(adapter);
+
 	/*
 	 * Just trigger the discovery here. In case an already running
 	 * discovery in idle phase exists, it will be restarted right
@@ -1691,6 +2255,217 @@ static DBusMessage *start_discovery(DBusConnection *conn,
 	return dbus_message_new_method_return(msg);
 }
 
+static int parse_filter_uuids(struct discovery_filter *filter,
+						DBusMessageIter *value)
+{
+	DBusMessageIter arr;
+
+	if (dbus_message_iter_get_arg_type(value) != DBUS_TYPE_ARRAY)
+		return -EINVAL;
+
+	dbus_message_iter_recurse(value, &arr);
+
+	while (dbus_message_iter_get_arg_type(&arr) == DBUS_TYPE_STRING) {
+		bt_uuid_t uuid, uuid128;
+		const char *str;
+
+		dbus_message_iter_get_basic(&arr, &str);
+
+		if (bt_string_to_uuid(&uuid, str) < 0)
+			return -EINVAL;
+
+		bt_uuid_to_uuid128(&uuid, &uuid128);
+
+		filter->uuids = g_slist_prepend(filter->uuids,
+					g_memdup(&uuid128, sizeof(uuid128)));
+
+		dbus_message_iter_next(&arr);
+	}
+
+	return 0;
+}
+
+static int parse_filter_opt(struct discovery_filter *filter, const char *key,
+						DBusMessageIter *value)
+{
+	int type = dbus_message_iter_get_arg_type(value);
+	const char *str;
+	dbus_int16_t i16;
+	dbus_uint16_t u16;
+
+	if (g_str_equal(key, "UUIDs"))
+		return parse_filter_uuids(filter, value);
+
+	if (g_str_equal(key, "RSSI")) {
+		if (type != DBUS_TYPE_INT16)
+			return -EINVAL;
+
+		dbus_message_iter_get_basic(value, &i16);
+		if (i16 < -127 || i16 > 20)
+			return -EINVAL;
+
+		filter->rssi = i16;
+	} else if (g_str_equal(key, "Pathloss")) {
+		if (type != DBUS_TYPE_UINT16)
+			return -EINVAL;
+
+		dbus_message_iter_get_basic(value, &u16);
+		if (u16 > 137)
+			return -EINVAL;
+
+		filter->pathloss = u16;
+	} else if (g_str_equal(key, "Transport")) {
+		if (type != DBUS_TYPE_STRING)
+			return -EINVAL;
+
+		dbus_message_iter_get_basic(value, &str);
+
+		if (g_str_equal(str, "bredr"))
+			filter->type = (1 << BDADDR_BREDR);
+		else if (g_str_equal(str, "le"))
+			filter->type = (1 << BDADDR_LE_PUBLIC) |
+						(1 << BDADDR_LE_RANDOM);
+		else if (g_str_equal(str, "auto"))
+			filter->type = (1 << BDADDR_BREDR) |
+						(1 << BDADDR_LE_PUBLIC) |
+						(1 << BDADDR_LE_RANDOM);
+		else
+			return -EINVAL;
+	} else
+		return -EINVAL;
+
+	return 0;
+}
+
+static int parse_discovery_filter(DBusMessage *msg,
+					struct discovery_filter **filter)
+{
+	struct discovery_filter *f;
+	DBusMessageIter args, dict;
+	bool empty = true;
+
+	dbus_message_iter_init(msg, &args);
+
+	if (dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_ARRAY)
+		return -EINVAL;
+
+	dbus_message_iter_recurse(&args, &dict);
+
+	f = g_new0(struct discovery_filter, 1);
+	f->type = (1 << BDADDR_BREDR) | (1 << BDADDR_LE_PUBLIC) |
+						(1 << BDADDR_LE_RANDOM);
+	f->rssi = DISTANCE_VAL_INVALID;
+	f->pathloss = DISTANCE_VAL_INVALID;
+
+	while (dbus_message_iter_get_arg_type(&dict) == DBUS_TYPE_DICT_ENTRY) {
+		DBusMessageIter entry, value;
+		const char *key;
+
+		dbus_message_iter_recurse(&dict, &entry);
+
+		if (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_STRING)
+			goto failed;
+
+		dbus_message_iter_get_basic(&entry, &key);
+		dbus_message_iter_next(&entry);
+
+		if (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_VARIANT)
+			goto failed;
+
+		dbus_message_iter_recurse(&entry, &value);
+
+		if (parse_filter_opt(f, key, &value) < 0)
+			goto failed;
+
+		empty = false;
+
+		dbus_message_iter_next(&dict);
+	}
+
+	/* RSSI and Pathloss can't be combined in one filter */
+	if (f->rssi != DISTANCE_VAL_INVALID &&
+				f->pathloss != DISTANCE_VAL_INVALID)
+		goto failed;
+
+	/* An empty filter removes the filter of the client */
+	if (empty) {
+		free_discovery_filter(f);
+		f = NULL;
+	}
+
+	*filter = f;
+
+	return 0;
+
+failed:
+	free_discovery_filter(f);
+	return -EINVAL;
+}
+
+static DBusMessage *set_discovery_filter(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	struct btd_adapter *adapter = user_data;
+	const char *sender = dbus_message_get_sender(msg);
+	struct discovery_filter *filter;
+	struct watch_client *client;
+	GSList *list;
+
+	DBG("sender %s", sender);
+
+	if (!(adapter->current_settings & MGMT_SETTING_POWERED))
+		return btd_error_not_ready(msg);
+
+	if (parse_discovery_filter(msg, &filter) < 0)
+		return btd_error_invalid_args(msg);
+
+	list = g_slist_find_custom(adapter->discovery_list, sender,
+						compare_sender);
+	if (list) {
+		client = list->data;
+
+		free_discovery_filter(client->filter);
+		client->filter = filter;
+
+		if (update_discovery_filter(adapter))
+			trigger_start_discovery(adapter, 0);
+
+		return dbus_message_new_method_return(msg);
+	}
+
+	/* Keep the filter around until the client starts discovery */
+	list = g_slist_find_custom(adapter->filter_list, sender,
+						compare_sender);
+	if (list) {
+		client = list->data;
+
+		if (!filter) {
+			g_dbus_remove_watch(dbus_conn, client->watch);
+			return dbus_message_new_method_return(msg);
+		}
+
+		free_discovery_filter(client->filter);
+		client->filter = filter;
+
+		return dbus_message_new_method_return(msg);
+	}
+
+	if (!filter)
+		return dbus_message_new_method_return(msg);
+
+	client = g_new0(struct watch_client, 1);
+
+	client->adapter = adapter;
+	client->owner = g_strdup(sender);
+	client->filter = filter;
+	client->watch = g_dbus_add_disconnect_watch(dbus_conn, sender, NULL,
+						client, filter_client_destroy);
+
+	adapter->filter_list = g_slist_prepend(adapter->filter_list, client);
+
+	return dbus_message_new_method_return(msg);
+}
+
 static DBusMessage *stop_discovery(DBusConnection *conn,
 					DBusMessage *msg, void *user_data)
 {
@@ -2158,36 +2933,24 @@ static gboolean property_get_modalias(const GDBusPropertyTable *property,
 	return TRUE;
 }
 
-static int device_path_cmp(gconstpointer a, gconstpointer b)
-{
-	const struct btd_device *device = a;
-	const char *path = b;
-	const char *dev_path = device_get_path(device);
-
-	return strcasecmp(dev_path, path);
-}
-
 static DBusMessage *remove_device(DBusConnection *conn,
 					DBusMessage *msg, void *user_data)
 {
 	struct btd_adapter *adapter = user_data;
 	struct btd_device *device;
 	const char *path;
-	GSList *list;
 
 	if (dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &path,
 						DBUS_TYPE_INVALID) == FALSE)
 		return btd_error_invalid_args(msg);
 
-	list = g_slist_find_custom(adapter->devices, path, device_path_cmp);
-	if (!list)
+	device = adapter_find_device_by_path(adapter, path);
+	if (!device)
 		return btd_error_does_not_exist(msg);
 
 	if (!(adapter->current_settings & MGMT_SETTING_POWERED))
 		return btd_error_not_ready(msg);
 
-	device = list->data;
-
 	btd_device_set_temporary(device, TRUE);
 
 	if (!btd_device_is_connected(device)) {
@@ -2203,6 +2966,9 @@ static DBusMessage *remove_device(DBusConnection *conn,
 static const GDBusMethodTable adapter_methods[] = {
 	{ GDBUS_METHOD("StartDiscovery", NULL, NULL, start_discovery) },
 	{ GDBUS_METHOD("StopDiscovery", NULL, NULL, stop_discovery) },
+	{ GDBUS_METHOD("SetDiscoveryFilter",
+			GDBUS_ARGS({ "properties", "a{sv}" }), NULL,
+			set_discovery_filter) },
 	{ GDBUS_ASYNC_METHOD("RemoveDevice",
 			GDBUS_ARGS({ "device", "o" }), NULL, remove_device) },
 	{ }
@@ -2676,6 +3442,10 @@ static void load_devices(struct btd_adapter *adapter)
 	GSList *irks = NULL;
 	DIR *dir;
 	struct dirent *entry;
+	unsigned int count = 0;
+	gint64 start;
+
+	start = g_get_monotonic_time();
 
 	ba2str(&adapter->bdaddr, srcaddr);
 
@@ -2696,6 +3466,7 @@ static void load_devices(struct btd_adapter *adapter)
 		GSList *list, *ltk_info;
 		struct irk_info *irk_info;
 		uint8_t bdaddr_type;
+		bdaddr_t bdaddr;
 
 		if (entry->d_type != DT_DIR || bachk(entry->d_name) < 0)
 			continue;
@@ -2703,38 +3474,45 @@ static void load_devices(struct btd_adapter *adapter)
 		snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", srcaddr,
 				entry->d_name);
 
-		key_file = g_key_file_new();
-		g_key_file_load_from_file(key_file, filename, 0, NULL);
+		key_file = keyfile_get(filename);
 
+		/*
+		 * Prepend to keep loading linear in the number of stored
+		 * devices, the order of the keys does not matter.
+		 */
 		key_info = get_key_info(key_file, entry->d_name);
 		if (key_info)
-			keys = g_slist_append(keys, key_info);
+			keys = g_slist_prepend(keys, key_info);
 
 		bdaddr_type = get_le_addr_type(key_file);
 
 		ltk_info = get_ltk_info(key_file, entry->d_name, bdaddr_type);
-		ltks = g_slist_concat(ltks, ltk_info);
+		ltks = g_slist_concat(ltk_info, ltks);
 
 		irk_info = get_irk_info(key_file, entry->d_name, bdaddr_type);
 		if (irk_info)
-			irks = g_slist_append(irks, irk_info);
+			irks = g_slist_prepend(irks, irk_info);
 
-		list = g_slist_find_custom(adapter->devices, entry->d_name,
-							device_address_cmp);
-		if (list) {
-			device = list->data;
+		str2ba(entry->d_name, &bdaddr);
+
+		device = adapter_find_device_by_address(adapter, &bdaddr);
+		if (device)
 			goto device_exist;
-		}
 
 		device = device_create_from_storage(adapter, entry->d_name,
 							key_file);
 		if (!device)
-			goto free;
+			continue;
 
 		btd_device_set_temporary(device, FALSE);
-		adapter->devices = g_slist_append(adapter->devices, device);
+		adapter_add_device(adapter, device);
+		count++;
 
-		/* TODO: register services from pre-loaded list of primaries */
+		/*
+		 * Primary services and their characteristics have been
+		 * restored from the attribute cache, so LE profiles can be
+		 * probed without rediscovering the database on reconnect.
+		 */
 
 		list = btd_device_get_uuids(device);
 		if (list)
@@ -2750,13 +3528,16 @@ device_exist:
 			device_set_paired(device, bdaddr_type);
 			device_set_bonded(device, bdaddr_type);
 		}
-
-free:
-		g_key_file_free(key_file);
 	}
 
 	closedir(dir);
 
+	adapter->stored_devices = count;
+
+	info("hci%u %u stored devices loaded in %" G_GINT64_FORMAT " ms",
+					adapter->dev_id, count,
+					(g_get_monotonic_time() - start) / 1000);
+
 	load_link_keys(adapter, keys, main_opts.debug_keys);
 	g_slist_free_full(keys, g_free);
 
@@ -2889,11 +3670,12 @@ static void adapter_add_connection(struct btd_adapter *adapter,
 {
 	device_add_connection(device, bdaddr_type);
 
-	if (g_slist_find(adapter->connections, device)) {
+	if (g_hash_table_lookup(adapter->connected_set, device)) {
 		error("Device is already marked as connected");
 		return;
 	}
 
+	g_hash_table_insert(adapter->connected_set, device, device);
 	adapter->connections = g_slist_append(adapter->connections, device);
 }
 
@@ -2938,63 +3720,184 @@ static void get_connections_complete(uint8_t status, uint16_t length,
 		if (device)
 			adapter_add_connection(adapter, device, addr->type);
 	}
-}
+}
+
+static void load_connections(struct btd_adapter *adapter)
+{
+	DBG("sending get connections command for index %u", adapter->dev_id);
+
+	if (mgmt_send(adapter->mgmt, MGMT_OP_GET_CONNECTIONS,
+				adapter->dev_id, 0, NULL,
+				get_connections_complete, adapter, NULL) > 0)
+		return;
+
+	error("Failed to get connections for index %u", adapter->dev_id);
+}
+
+bool btd_adapter_get_pairable(struct btd_adapter *adapter)
+{
+	if (adapter->current_settings & MGMT_SETTING_PAIRABLE)
+		return true;
+
+	return false;
+}
+
+bool btd_adapter_get_powered(struct btd_adapter *adapter)
+{
+	if (adapter->current_settings & MGMT_SETTING_POWERED)
+		return true;
+
+	return false;
+}
+
+bool btd_adapter_get_connectable(struct btd_adapter *adapter)
+{
+	if (adapter->current_settings & MGMT_SETTING_CONNECTABLE)
+		return true;
+
+	return false;
+}
+
+uint32_t btd_adapter_get_class(struct btd_adapter *adapter)
+{
+	return adapter->dev_class;
+}
+
+const char *btd_adapter_get_name(struct btd_adapter *adapter)
+{
+	if (adapter->stored_alias)
+		return adapter->stored_alias;
+
+	if (adapter->system_name)
+		return adapter->system_name;
+
+	return NULL;
+}
+
+static void add_kernel_device_complete(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	const struct mgmt_rp_add_device *rp = param;
+	char addr[18];
+
+	if (length < sizeof(*rp)) {
+		error("Too small Add Device complete event");
+		return;
+	}
+
+	ba2str(&rp->addr.bdaddr, addr);
+
+	if (status != MGMT_STATUS_SUCCESS) {
+		error("Failed to add device %s (%u): %s (0x%02x)",
+			addr, rp->addr.type, mgmt_errstr(status), status);
+		return;
+	}
+
+	DBG("%s (%u) added", addr, rp->addr.type);
+}
+
+static void add_kernel_device(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	struct mgmt_cp_add_device cp;
+
+	memset(&cp, 0, sizeof(cp));
+	bacpy(&cp.addr.bdaddr, device_get_address(device));
+	cp.addr.type = btd_device_get_bdaddr_type(device);
+	cp.action = 0x02;	/* Auto-connect */
+
+	mgmt_send(adapter->mgmt, MGMT_OP_ADD_DEVICE,
+				adapter->dev_id, sizeof(cp), &cp,
+				add_kernel_device_complete, adapter, NULL);
+}
+
+static void remove_kernel_device_complete(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	const struct mgmt_rp_remove_device *rp = param;
+	char addr[18];
+
+	if (length < sizeof(*rp)) {
+		error("Too small Remove Device complete event");
+		return;
+	}
 
-static void load_connections(struct btd_adapter *adapter)
-{
-	DBG("sending get connections command for index %u", adapter->dev_id);
+	ba2str(&rp->addr.bdaddr, addr);
 
-	if (mgmt_send(adapter->mgmt, MGMT_OP_GET_CONNECTIONS,
-				adapter->dev_id, 0, NULL,
-				get_connections_complete, adapter, NULL) > 0)
+	if (status != MGMT_STATUS_SUCCESS) {
+		error("Failed to remove device %s (%u): %s (0x%02x)",
+			addr, rp->addr.type, mgmt_errstr(status), status);
 		return;
+	}
 
-	error("Failed to get connections for index %u", adapter->dev_id);
+	DBG("%s (%u) removed", addr, rp->addr.type);
 }
 
-bool btd_adapter_get_pairable(struct btd_adapter *adapter)
+static void remove_kernel_device(struct btd_adapter *adapter,
+						struct btd_device *device)
 {
-	if (adapter->current_settings & MGMT_SETTING_PAIRABLE)
-		return true;
+	struct mgmt_cp_remove_device cp;
 
-	return false;
+	memset(&cp, 0, sizeof(cp));
+	bacpy(&cp.addr.bdaddr, device_get_address(device));
+	cp.addr.type = btd_device_get_bdaddr_type(device);
+
+	mgmt_send(adapter->mgmt, MGMT_OP_REMOVE_DEVICE,
+				adapter->dev_id, sizeof(cp), &cp,
+				remove_kernel_device_complete, adapter, NULL);
 }
 
-bool btd_adapter_get_powered(struct btd_adapter *adapter)
+/*
+ * Drop the devices a previous instance of the daemon left in the kernel
+ * list, the connect list is added again when loading the devices.
+ */
+static void clear_kernel_devices(struct btd_adapter *adapter)
 {
-	if (adapter->current_settings & MGMT_SETTING_POWERED)
-		return true;
+	struct mgmt_cp_remove_device cp;
 
-	return false;
+	/* The kernel only accepts BDADDR_ANY with the BR/EDR type */
+	memset(&cp, 0, sizeof(cp));
+	bacpy(&cp.addr.bdaddr, BDADDR_ANY);
+	cp.addr.type = BDADDR_BREDR;
+
+	mgmt_send(adapter->mgmt, MGMT_OP_REMOVE_DEVICE,
+				adapter->dev_id, sizeof(cp), &cp,
+				remove_kernel_device_complete, adapter, NULL);
 }
 
-bool btd_adapter_get_connectable(struct btd_adapter *adapter)
+/* Account the time between adding a device and it being connected */
+static void reconnect_complete(struct btd_adapter *adapter,
+					struct btd_device *device,
+					const gint64 *added)
 {
-	if (adapter->current_settings & MGMT_SETTING_CONNECTABLE)
-		return true;
+	unsigned int latency;
 
-	return false;
-}
+	if (!added || !btd_device_is_connected(device))
+		return;
 
-uint32_t btd_adapter_get_class(struct btd_adapter *adapter)
-{
-	return adapter->dev_class;
-}
+	latency = (g_get_monotonic_time() - *added) / 1000;
 
-const char *btd_adapter_get_name(struct btd_adapter *adapter)
-{
-	if (adapter->stored_alias)
-		return adapter->stored_alias;
+	if (!adapter->reconnects || latency < adapter->reconnect_min)
+		adapter->reconnect_min = latency;
 
-	if (adapter->system_name)
-		return adapter->system_name;
+	if (latency > adapter->reconnect_max)
+		adapter->reconnect_max = latency;
 
-	return NULL;
+	adapter->reconnects++;
+	adapter->reconnect_total += latency;
+
+	DBG("%s reconnected after %u ms (count %u avg %" G_GUINT64_FORMAT
+				" min %u max %u)", device_get_path(device),
+				latency, adapter->reconnects,
+				adapter->reconnect_total / adapter->reconnects,
+				adapter->reconnect_min, adapter->reconnect_max);
 }
 
 int adapter_connect_list_add(struct btd_adapter *adapter,
 					struct btd_device *device)
 {
+	gint64 now;
+
 	/*
 	 * If the adapter->connect_le device is getting added back to
 	 * the connect list it probably means that the connect attempt
@@ -3003,7 +3906,7 @@ int adapter_connect_list_add(struct btd_adapter *adapter,
 	if (device == adapter->connect_le)
 		adapter->connect_le = NULL;
 
-	if (g_slist_find(adapter->connect_list, device)) {
+	if (g_hash_table_lookup(adapter->connect_set, device)) {
 		DBG("ignoring already added device %s",
 						device_get_path(device));
 		return 0;
@@ -3015,10 +3918,22 @@ int adapter_connect_list_add(struct btd_adapter *adapter,
 		return -ENOTSUP;
 	}
 
+	now = g_get_monotonic_time();
+	g_hash_table_insert(adapter->connect_set, device,
+					g_memdup(&now, sizeof(now)));
 	adapter->connect_list = g_slist_append(adapter->connect_list, device);
 	DBG("%s added to %s's connect_list", device_get_path(device),
 							adapter->system_name);
 
+	/*
+	 * The kernel keeps all devices of the list in the controller
+	 * white list and connects to whichever device shows up first.
+	 */
+	if (kernel_conn_control) {
+		add_kernel_device(adapter, device);
+		return 0;
+	}
+
 	if (!(adapter->current_settings & MGMT_SETTING_POWERED))
 		return 0;
 
@@ -3030,6 +3945,8 @@ int adapter_connect_list_add(struct btd_adapter *adapter,
 void adapter_connect_list_remove(struct btd_adapter *adapter,
 					struct btd_device *device)
 {
+	gint64 *added;
+
 	/*
 	 * If the adapter->connect_le device is being removed from the
 	 * connect list it means the connection was successful and hence
@@ -3038,16 +3955,26 @@ void adapter_connect_list_remove(struct btd_adapter *adapter,
 	if (device == adapter->connect_le)
 		adapter->connect_le = NULL;
 
-	if (!g_slist_find(adapter->connect_list, device)) {
+	added = g_hash_table_lookup(adapter->connect_set, device);
+	if (!added) {
 		DBG("device %s is not on the list, ignoring",
 						device_get_path(device));
 		return;
 	}
 
+	reconnect_complete(adapter, device, added);
+
+	g_hash_table_remove(adapter->connect_set, device);
+
 	adapter->connect_list = g_slist_remove(adapter->connect_list, device);
 	DBG("%s removed from %s's connect_list", device_get_path(device),
 							adapter->system_name);
 
+	if (kernel_conn_control) {
+		remove_kernel_device(adapter, device);
+		return;
+	}
+
 	if (!adapter->connect_list) {
 		stop_passive_scanning(adapter);
 		return;
@@ -3059,6 +3986,34 @@ void adapter_connect_list_remove(struct btd_adapter *adapter,
 	trigger_passive_scanning(adapter);
 }
 
+void adapter_le_connecting(struct btd_adapter *adapter, bool connecting)
+{
+	if (connecting) {
+		adapter->le_connecting++;
+		return;
+	}
+
+	if (adapter->le_connecting == 0)
+		return;
+
+	adapter->le_connecting--;
+
+	/*
+	 * In continuous mode discovery is not restarted while an LE
+	 * connection is being created, so pick it up again once the
+	 * last attempt has finished.
+	 */
+	if (adapter->le_connecting || !main_opts.continuous_scan)
+		return;
+
+	if (!adapter->discovery_list || adapter->discovery_enable == 0x01 ||
+					adapter->discovery_suspended ||
+					adapter->discovery_idle_timeout > 0)
+		return;
+
+	trigger_start_discovery(adapter, 0);
+}
+
 static void adapter_start(struct btd_adapter *adapter)
 {
 	g_dbus_emit_property_changed(dbus_conn, adapter->path,
@@ -3066,6 +4021,15 @@ static void adapter_start(struct btd_adapter *adapter)
 
 	DBG("adapter %s has been enabled", adapter->path);
 
+	if (!adapter->powered_once) {
+		adapter->powered_once = true;
+		info("hci%u powered %" G_GINT64_FORMAT
+				" ms after startup with %u stored devices",
+				adapter->dev_id,
+				(g_get_monotonic_time() - startup_time) / 1000,
+				adapter->stored_devices);
+	}
+
 	trigger_passive_scanning(adapter);
 }
 
@@ -3163,6 +4127,16 @@ static void adapter_free(gpointer user_data)
 	sdp_list_free(adapter->services, NULL);
 
 	g_slist_free(adapter->connections);
+	g_hash_table_destroy(adapter->connected_set);
+	g_hash_table_destroy(adapter->connect_set);
+	g_hash_table_destroy(adapter->discovery_found);
+	g_hash_table_destroy(adapter->devices_by_path);
+	g_hash_table_foreach_remove(adapter->devices_by_addr,
+						free_device_bucket, NULL);
+	g_hash_table_destroy(adapter->devices_by_addr);
+	clear_temp_devices(adapter);
+	g_queue_free(adapter->temp_devices);
+	g_hash_table_destroy(adapter->temp_index);
 
 	g_free(adapter->path);
 	g_free(adapter->name);
@@ -4063,17 +5037,18 @@ static void load_config(struct btd_adapter *adapter)
 
 	ba2str(&adapter->bdaddr, address);
 
-	key_file = g_key_file_new();
-
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/settings", address);
 	filename[PATH_MAX] = '\0';
 
 	if (stat(filename, &st) < 0) {
+		key_file = g_key_file_new();
 		convert_config(adapter, filename, key_file);
+		g_key_file_free(key_file);
+
 		convert_device_storage(adapter);
 	}
 
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = keyfile_get(filename);
 
 	/* Get alias */
 	adapter->stored_alias = g_key_file_get_string(key_file, "General",
@@ -4110,8 +5085,6 @@ static void load_config(struct btd_adapter *adapter)
 		g_error_free(gerr);
 		gerr = NULL;
 	}
-
-	g_key_file_free(key_file);
 }
 
 static struct btd_adapter *btd_adapter_new(uint16_t index)
@@ -4153,6 +5126,15 @@ static struct btd_adapter *btd_adapter_new(uint16_t index)
 
 	adapter->auths = g_queue_new();
 
+	adapter->devices_by_addr = g_hash_table_new_full(bdaddr_hash,
+						bdaddr_equal, g_free, NULL);
+	adapter->devices_by_path = g_hash_table_new(g_str_hash, g_str_equal);
+	adapter->discovery_found = g_hash_table_new(NULL, NULL);
+	adapter->connected_set = g_hash_table_new(NULL, NULL);
+	adapter->connect_set = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+	adapter->temp_devices = g_queue_new();
+	adapter->temp_index = g_hash_table_new(NULL, NULL);
+
 	return btd_adapter_ref(adapter);
 }
 
@@ -4167,15 +5149,15 @@ static void adapter_remove(struct btd_adapter *adapter)
 		adapter->discovery_idle_timeout = 0;
 	}
 
-	if (adapter->temp_devices_timeout > 0) {
-		g_source_remove(adapter->temp_devices_timeout);
-		adapter->temp_devices_timeout = 0;
-	}
+	clear_temp_devices(adapter);
 
 	discovery_cleanup(adapter);
 
 	g_slist_free(adapter->connect_list);
 	adapter->connect_list = NULL;
+	g_hash_table_remove_all(adapter->connect_set);
+
+	adapter_clear_device_index(adapter);
 
 	for (l = adapter->devices; l; l = l->next)
 		device_remove(l->data, FALSE);
@@ -4295,9 +5277,34 @@ static void update_found_devices(struct btd_adapter *adapter,
 	struct btd_device *dev;
 	struct eir_data eir_data;
 	bool name_known, discoverable;
-	struct device_addr_type addr_type;
+	uint64_t fingerprint;
 	char addr[18];
-	GSList *list;
+
+	fingerprint = eir_fingerprint(data, data_len);
+
+	dev = btd_adapter_find_device(adapter, bdaddr, bdaddr_type);
+
+	/*
+	 * Most devices repeat the same payload over and over again, in
+	 * which case everything derived from it is already up to date.
+	 */
+	if (dev && device_eir_is_known(dev, fingerprint)) {
+		adapter->reports_skipped++;
+
+		device_update_last_seen(dev, bdaddr_type);
+
+		if (device_is_temporary(dev) && !adapter->discovery_list)
+			return;
+
+		device_set_legacy(dev, legacy);
+		device_set_rssi(dev, rssi);
+
+		name_known = device_name_known(dev);
+
+		goto found;
+	}
+
+	adapter->reports_parsed++;
 
 	memset(&eir_data, 0, sizeof(eir_data));
 	eir_parse(&eir_data, data, data_len);
@@ -4309,12 +5316,7 @@ static void update_found_devices(struct btd_adapter *adapter,
 
 	ba2str(bdaddr, addr);
 
-	bacpy(&addr_type.bdaddr, bdaddr);
-	addr_type.bdaddr_type = bdaddr_type;
-
-	list = g_slist_find_custom(adapter->devices, &addr_type,
-							device_addr_type_cmp);
-	if (!list) {
+	if (!dev) {
 		/*
 		 * If no client has requested discovery, then do not
 		 * create new device objects.
@@ -4324,15 +5326,22 @@ static void update_found_devices(struct btd_adapter *adapter,
 			return;
 		}
 
+		/*
+		 * Reports not matching what any discovery client asked for
+		 * must not cause a device object to be created.
+		 */
+		if (adapter->current_filter &&
+				!discovery_filter_match(adapter->current_filter,
+							bdaddr_type, rssi,
+							&eir_data)) {
+			eir_data_free(&eir_data);
+			return;
+		}
+
 		if (discoverable)
 			dev = adapter_create_device(adapter, bdaddr,
 								bdaddr_type);
-		else
-			dev = btd_adapter_find_device(adapter, bdaddr,
-								bdaddr_type);
-
-	} else
-		dev = list->data;
+	}
 
 	if (!dev) {
 		error("Unable to create object for found device %s", addr);
@@ -4387,10 +5396,13 @@ static void update_found_devices(struct btd_adapter *adapter,
 							eir_data.did_product,
 							eir_data.did_version);
 
-	device_add_eir_uuids(dev, eir_data.services);
+	device_add_eir_uuids(dev, eir_data.uuids, eir_data.uuid_count);
 
 	eir_data_free(&eir_data);
 
+	device_set_eir_fingerprint(dev, fingerprint);
+
+found:
 	/*
 	 * Only if at least one client has requested discovery, maintain
 	 * list of found devices and name confirming for legacy devices.
@@ -4400,18 +5412,21 @@ static void update_found_devices(struct btd_adapter *adapter,
 	if (!adapter->discovery_list)
 		goto connect_le;
 
-	if (g_slist_find(adapter->discovery_found, dev))
+	if (g_hash_table_lookup(adapter->discovery_found, dev))
 		return;
 
 	if (confirm)
 		confirm_name(adapter, bdaddr, bdaddr_type, name_known);
 
-	adapter->discovery_found = g_slist_prepend(adapter->discovery_found,
-									dev);
+	g_hash_table_insert(adapter->discovery_found, dev, dev);
 
 	return;
 
 connect_le:
+	/* Connections to the connect_list devices are up to the kernel */
+	if (kernel_conn_control)
+		return;
+
 	/*
 	 * If we're in the process of stopping passive scanning and
 	 * connecting another (or maybe even the same) LE device just
@@ -4426,7 +5441,7 @@ connect_le:
 	 * attempt to it can be made
 	 */
 	if (bdaddr_type != BDADDR_BREDR && !btd_device_is_connected(dev) &&
-				g_slist_find(adapter->connect_list, dev)) {
+			g_hash_table_lookup(adapter->connect_set, dev)) {
 		adapter->connect_le = dev;
 		stop_passive_scanning(adapter);
 	}
@@ -4486,7 +5501,7 @@ static void adapter_remove_connection(struct btd_adapter *adapter,
 {
 	DBG("");
 
-	if (!g_slist_find(adapter->connections, device)) {
+	if (!g_hash_table_lookup(adapter->connected_set, device)) {
 		error("No matching connection for device");
 		return;
 	}
@@ -4500,6 +5515,7 @@ static void adapter_remove_connection(struct btd_adapter *adapter,
 	if (btd_device_is_connected(device))
 		return;
 
+	g_hash_table_remove(adapter->connected_set, device);
 	adapter->connections = g_slist_remove(adapter->connections, device);
 
 	if (device_is_temporary(device) && !device_is_retrying(device)) {
@@ -4529,6 +5545,14 @@ static void adapter_stop(struct btd_adapter *adapter)
 		g_dbus_remove_watch(dbus_conn, client->watch);
 	}
 
+	while (adapter->filter_list) {
+		struct watch_client *client;
+
+		client = adapter->filter_list->data;
+
+		g_dbus_remove_watch(dbus_conn, client->watch);
+	}
+
 	adapter->discovering = false;
 
 	while (adapter->connections) {
@@ -4691,7 +5715,7 @@ static int adapter_authorize(struct btd_adapter *adapter, const bdaddr_t *dst,
 		return 0;
 
 	/* Device connected? */
-	if (!g_slist_find(adapter->connections, device))
+	if (!g_hash_table_lookup(adapter->connected_set, device))
 		error("Authorization request for non-connected device!?");
 
 	auth = g_try_new0(struct service_auth, 1);
@@ -4813,14 +5837,88 @@ int btd_adapter_set_fast_connectable(struct btd_adapter *adapter,
 	return 0;
 }
 
-int btd_adapter_read_clock(struct btd_adapter *adapter, const bdaddr_t *bdaddr,
-				int which, int timeout, uint32_t *clock,
-				uint16_t *accuracy)
+struct read_clock_data {
+	int which;
+	btd_adapter_read_clock_cb_t cb;
+	void *user_data;
+	GDestroyNotify destroy;
+};
+
+static void read_clock_complete(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	const struct mgmt_rp_get_clock_info *rp = param;
+	struct read_clock_data *data = user_data;
+
+	if (status != MGMT_STATUS_SUCCESS) {
+		error("Failed to read clock: %s (0x%02x)",
+						mgmt_errstr(status), status);
+		data->cb(-EIO, 0, 0, data->user_data);
+		return;
+	}
+
+	if (length < sizeof(*rp)) {
+		error("Too small read clock response");
+		data->cb(-EIO, 0, 0, data->user_data);
+		return;
+	}
+
+	if (data->which)
+		data->cb(0, btohl(rp->piconet_clock), btohs(rp->accuracy),
+							data->user_data);
+	else
+		data->cb(0, btohl(rp->local_clock), 0, data->user_data);
+}
+
+static void read_clock_free(void *user_data)
 {
+	struct read_clock_data *data = user_data;
+
+	if (data->destroy)
+		data->destroy(data->user_data);
+
+	g_free(data);
+}
+
+unsigned int btd_adapter_read_clock(struct btd_adapter *adapter,
+					const bdaddr_t *bdaddr, int which,
+					btd_adapter_read_clock_cb_t cb,
+					void *user_data,
+					GDestroyNotify destroy)
+{
+	struct mgmt_cp_get_clock_info cp;
+	struct read_clock_data *data;
+	unsigned int id;
+
 	if (!(adapter->current_settings & MGMT_SETTING_POWERED))
-		return -EINVAL;
+		return 0;
+
+	memset(&cp, 0, sizeof(cp));
+	cp.addr.type = BDADDR_BREDR;
+
+	/* The local clock is requested with BDADDR_ANY */
+	if (which)
+		bacpy(&cp.addr.bdaddr, bdaddr);
+
+	data = g_new0(struct read_clock_data, 1);
+	data->which = which;
+	data->cb = cb;
+	data->user_data = user_data;
+	data->destroy = destroy;
+
+	id = mgmt_send(adapter->mgmt, MGMT_OP_GET_CLOCK_INFO,
+				adapter->dev_id, sizeof(cp), &cp,
+				read_clock_complete, data, read_clock_free);
+	if (id == 0)
+		g_free(data);
+
+	return id;
+}
 
-	return -ENOSYS;
+bool btd_adapter_cancel_read_clock(struct btd_adapter *adapter,
+							unsigned int id)
+{
+	return mgmt_cancel(adapter->mgmt, id);
 }
 
 int btd_adapter_remove_bonding(struct btd_adapter *adapter,
@@ -5479,9 +6577,7 @@ static void store_link_key(struct btd_adapter *adapter,
 	char device_addr[18];
 	char filename[PATH_MAX + 1];
 	GKeyFile *key_file;
-	gsize length = 0;
 	char key_str[33];
-	char *str;
 	int i;
 
 	ba2str(btd_adapter_get_address(adapter), adapter_addr);
@@ -5491,8 +6587,7 @@ static void store_link_key(struct btd_adapter *adapter,
 								device_addr);
 	filename[PATH_MAX] = '\0';
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = keyfile_get(filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(key_str + (i * 2), "%2.2X", key[i]);
@@ -5502,13 +6597,8 @@ static void store_link_key(struct btd_adapter *adapter,
 	g_key_file_set_integer(key_file, "LinkKey", "Type", type);
 	g_key_file_set_integer(key_file, "LinkKey", "PINLength", pin_length);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
-
-	g_key_file_free(key_file);
+	keyfile_changed(filename);
+	keyfile_sync(filename);
 }
 
 static void new_link_key_callback(uint16_t index, uint16_t length,
@@ -5569,8 +6659,6 @@ static void store_longtermkey(const bdaddr_t *local, const bdaddr_t *peer,
 	char filename[PATH_MAX + 1];
 	GKeyFile *key_file;
 	char key_str[33];
-	gsize length = 0;
-	char *str;
 	int i;
 
 	if (master != 0x00 && master != 0x01) {
@@ -5585,8 +6673,7 @@ static void store_longtermkey(const bdaddr_t *local, const bdaddr_t *peer,
 								device_addr);
 	filename[PATH_MAX] = '\0';
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = keyfile_get(filename);
 
 	/* Old files may contain this so remove it in case it exists */
 	g_key_file_remove_key(key_file, "LongTermKey", "Master", NULL);
@@ -5603,13 +6690,8 @@ static void store_longtermkey(const bdaddr_t *local, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, group, "EDiv", ediv);
 	g_key_file_set_uint64(key_file, group, "Rand", rand);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
-
-	g_key_file_free(key_file);
+	keyfile_changed(filename);
+	keyfile_sync(filename);
 }
 
 static void new_long_term_key_callback(uint16_t index, uint16_t length,
@@ -5687,8 +6769,6 @@ static void store_csrk(const bdaddr_t *local, const bdaddr_t *peer,
 	char filename[PATH_MAX + 1];
 	GKeyFile *key_file;
 	char key_str[33];
-	gsize length = 0;
-	char *str;
 	int i;
 
 	if (master == 0x00)
@@ -5706,21 +6786,15 @@ static void store_csrk(const bdaddr_t *local, const bdaddr_t *peer,
 	snprintf(filename, sizeof(filename), STORAGEDIR "/%s/%s/info",
 						adapter_addr, device_addr);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = keyfile_get(filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(key_str + (i * 2), "%2.2X", key[i]);
 
 	g_key_file_set_string(key_file, group, "Key", key_str);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
-
-	g_key_file_free(key_file);
+	keyfile_changed(filename);
+	keyfile_sync(filename);
 }
 
 static void new_csrk_callback(uint16_t index, uint16_t length,
@@ -5767,9 +6841,7 @@ static void store_irk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	char device_addr[18];
 	char filename[PATH_MAX + 1];
 	GKeyFile *key_file;
-	char *store_data;
 	char str[33];
-	size_t length = 0;
 	int i;
 
 	ba2str(&adapter->bdaddr, adapter_addr);
@@ -5779,21 +6851,15 @@ static void store_irk(struct btd_adapter *adapter, const bdaddr_t *peer,
 								device_addr);
 	filename[PATH_MAX] = '\0';
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = keyfile_get(filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(str + (i * 2), "%2.2X", key[i]);
 
 	g_key_file_set_string(key_file, "IdentityResolvingKey", "Key", str);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	store_data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, store_data, length, NULL);
-	g_free(store_data);
-
-	g_key_file_free(key_file);
+	keyfile_changed(filename);
+	keyfile_sync(filename);
 }
 
 static void new_irk_callback(uint16_t index, uint16_t length,
@@ -5835,7 +6901,9 @@ static void new_irk_callback(uint16_t index, uint16_t length,
 		return;
 	}
 
+	adapter_unindex_device(adapter, device);
 	device_update_addr(device, &addr->bdaddr, addr->type);
+	adapter_index_device(adapter, device);
 
 	if (duplicate)
 		device_merge_duplicate(device, duplicate);
@@ -5986,35 +7054,58 @@ static int adapter_cmp(gconstpointer a, gconstpointer b)
 	return bacmp(&adapter->bdaddr, bdaddr);
 }
 
-static int adapter_id_cmp(gconstpointer a, gconstpointer b)
+static void adapters_add(struct btd_adapter *adapter)
 {
-	struct btd_adapter *adapter = (struct btd_adapter *) a;
-	uint16_t id = GPOINTER_TO_UINT(b);
+	if (!adapter_addrs)
+		adapter_addrs = g_hash_table_new(bdaddr_hash, bdaddr_equal);
+
+	/* Keep the first adapter in case of duplicate addresses */
+	if (!g_hash_table_lookup(adapter_addrs, &adapter->bdaddr))
+		g_hash_table_insert(adapter_addrs, &adapter->bdaddr, adapter);
 
-	return adapter->dev_id == id ? 0 : -1;
+	adapters = g_slist_append(adapters, adapter);
 }
 
-struct btd_adapter *adapter_find(const bdaddr_t *sba)
+static void adapters_remove(struct btd_adapter *adapter)
 {
 	GSList *match;
 
-	match = g_slist_find_custom(adapters, sba, adapter_cmp);
-	if (!match)
+	adapters = g_slist_remove(adapters, adapter);
+
+	if (g_hash_table_lookup(adapter_addrs, &adapter->bdaddr) != adapter)
+		return;
+
+	g_hash_table_remove(adapter_addrs, &adapter->bdaddr);
+
+	match = g_slist_find_custom(adapters, &adapter->bdaddr, adapter_cmp);
+	if (match) {
+		struct btd_adapter *dup = match->data;
+
+		g_hash_table_insert(adapter_addrs, &dup->bdaddr, dup);
+	}
+}
+
+struct btd_adapter *adapter_find(const bdaddr_t *sba)
+{
+	if (!adapter_addrs)
 		return NULL;
 
-	return match->data;
+	return g_hash_table_lookup(adapter_addrs, sba);
 }
 
 struct btd_adapter *adapter_find_by_id(int id)
 {
-	GSList *match;
+	struct btd_adapter *adapter;
+
+	if (id < 0 || id > UINT16_MAX)
+		return NULL;
 
-	match = g_slist_find_custom(adapters, GINT_TO_POINTER(id),
-							adapter_id_cmp);
-	if (!match)
+	/* The path is only set for adapters that have been registered */
+	adapter = btd_adapter_lookup(id);
+	if (!adapter || !adapter->path)
 		return NULL;
 
-	return match->data;
+	return adapter;
 }
 
 void adapter_foreach(adapter_cb func, gpointer user_data)
@@ -6069,7 +7160,7 @@ static int adapter_register(struct btd_adapter *adapter)
 	if (adapters == NULL)
 		adapter->is_default = true;
 
-	adapters = g_slist_append(adapters, adapter);
+	adapters_add(adapter);
 
 	agent = agent_get(NULL);
 	if (agent) {
@@ -6085,6 +7176,10 @@ static int adapter_register(struct btd_adapter *adapter)
 	load_drivers(adapter);
 	btd_profile_foreach(probe_profile, adapter);
 	clear_blocked(adapter);
+
+	if (kernel_conn_control)
+		clear_kernel_devices(adapter);
+
 	load_devices(adapter);
 
 	/* retrieve the active connections: address the scenario where
@@ -6111,7 +7206,8 @@ static int adapter_unregister(struct btd_adapter *adapter)
 {
 	DBG("Unregister path: %s", adapter->path);
 
-	adapters = g_slist_remove(adapters, adapter);
+	adapters_remove(adapter);
+	adapter_list_remove(adapter);
 
 	if (adapter->is_default && adapters != NULL) {
 		struct btd_adapter *new_default;
@@ -6123,8 +7219,6 @@ static int adapter_unregister(struct btd_adapter *adapter)
 		new_default->is_default = true;
 	}
 
-	adapter_list = g_list_remove(adapter_list, adapter);
-
 	adapter_remove(adapter);
 	btd_adapter_unref(adapter);
 
@@ -6480,6 +7574,8 @@ static void read_info_complete(uint8_t status, uint16_t length,
 
 	set_name(adapter, btd_adapter_get_name(adapter));
 
+	set_scan_params(adapter);
+
 	if ((adapter->supported_settings & MGMT_SETTING_SSP) &&
 			!(adapter->current_settings & MGMT_SETTING_SSP))
 		set_mode(adapter, MGMT_OP_SET_SSP, 0x01);
@@ -6509,7 +7605,7 @@ failed:
 	 * This is a simplification to avoid constant checks if the
 	 * adapter is ready to do anything.
 	 */
-	adapter_list = g_list_remove(adapter_list, adapter);
+	adapter_list_remove(adapter);
 
 	btd_adapter_unref(adapter);
 }
@@ -6544,7 +7640,7 @@ static void index_added(uint16_t index, uint16_t length, const void *param,
 	 * present, the second notification will cause a warning. If the
 	 * command fails the adapter is removed from the list again.
 	 */
-	adapter_list = g_list_append(adapter_list, adapter);
+	adapter_list_add(adapter);
 
 	DBG("sending read info command for index %u", index);
 
@@ -6554,7 +7650,7 @@ static void index_added(uint16_t index, uint16_t length, const void *param,
 
 	error("Failed to read controller info for index %u", index);
 
-	adapter_list = g_list_remove(adapter_list, adapter);
+	adapter_list_remove(adapter);
 
 	btd_adapter_unref(adapter);
 }
@@ -6624,6 +7720,7 @@ static void read_commands_complete(uint8_t status, uint16_t length,
 {
 	const struct mgmt_rp_read_commands *rp = param;
 	uint16_t num_commands, num_events;
+	size_t i;
 
 	if (status != MGMT_STATUS_SUCCESS) {
 		error("Failed to read supported commands: %s (0x%02x)",
@@ -6641,6 +7738,20 @@ static void read_commands_complete(uint8_t status, uint16_t length,
 
 	DBG("Number of commands: %d", num_commands);
 	DBG("Number of events: %d", num_events);
+
+	if (length < sizeof(*rp) + num_commands * sizeof(uint16_t)) {
+		error("Wrong size of read commands response");
+		return;
+	}
+
+	for (i = 0; i < num_commands; i++) {
+		uint16_t op = get_le16(rp->opcodes + i);
+
+		if (op == MGMT_OP_ADD_DEVICE) {
+			DBG("enabling kernel-side connection control");
+			kernel_conn_control = true;
+		}
+	}
 }
 
 static void read_version_complete(uint8_t status, uint16_t length,
@@ -6702,10 +7813,45 @@ static void mgmt_debug(const char *str, void *user_data)
 	info("%s%s", prefix, str);
 }
 
+static void adapter_stats(gpointer data, gpointer user_data)
+{
+	struct btd_adapter *adapter = data;
+	unsigned int duty;
+
+	info("hci%u: %lu discovery reports processed, %lu with unchanged "
+				"payload skipped", adapter->dev_id,
+				adapter->reports_parsed,
+				adapter->reports_skipped);
+
+	duty = scan_duty_cycle(adapter, g_get_monotonic_time());
+
+	info("hci%u: scanning %u.%u%% of the time since the first scan%s",
+				adapter->dev_id, duty / 10, duty % 10,
+				adapter->scan_start ? ", scanning now" : "");
+
+	if (!adapter->reconnects)
+		return;
+
+	info("hci%u: %u auto connections, latency avg %" G_GUINT64_FORMAT
+				" ms min %u ms max %u ms", adapter->dev_id,
+				adapter->reconnects,
+				adapter->reconnect_total / adapter->reconnects,
+				adapter->reconnect_min, adapter->reconnect_max);
+}
+
+static void dump_stats(void *user_data)
+{
+	g_slist_foreach(adapters, adapter_stats, NULL);
+}
+
 int adapter_init(void)
 {
+	startup_time = g_get_monotonic_time();
+
 	dbus_conn = btd_get_dbus_connection();
 
+	btd_stats_register(dump_stats, NULL);
+
 	mgmt_master = mgmt_new_default();
 	if (!mgmt_master) {
 		error("Failed to access management interface");
@@ -6729,7 +7875,15 @@ int adapter_init(void)
 
 void adapter_cleanup(void)
 {
+	btd_stats_unregister(dump_stats, NULL);
+
 	g_list_free(adapter_list);
+	adapter_list = NULL;
+
+	if (adapter_index) {
+		g_ptr_array_free(adapter_index, TRUE);
+		adapter_index = NULL;
+	}
 
 	while (adapters) {
 		struct btd_adapter *adapter = adapters->data;
@@ -6739,6 +7893,11 @@ void adapter_cleanup(void)
 		btd_adapter_unref(adapter);
 	}
 
+	if (adapter_addrs) {
+		g_hash_table_destroy(adapter_addrs);
+		adapter_addrs = NULL;
+	}
+
 	/*
 	 * In case there is another reference active, clear out
 	 * registered handlers for index added and index removed.
@@ -136,9 +136,20 @@ bool btd_adapter_pin_cb_iter_end(struct btd_adapter_pin_cb_iter *iter);
 int btd_adapter_set_fast_connectable(struct btd_adapter *adapter,
 							gboolean enable);
 
-int btd_adapter_read_clock(struct btd_adapter *adapter, const bdaddr_t *bdaddr,
-				int which, int timeout, uint32_t *clock,
-				uint16_t *accuracy);
+typedef void (*btd_adapter_read_clock_cb_t) (int err, uint32_t clock,
+						uint16_t accuracy,
+						void *user_data);
+
+/* Read the local (which = 0) or piconet (which = 1) clock. Returns a request
+ * id for btd_adapter_cancel_read_clock() or 0 on failure, in which case
+ * neither the callback nor destroy are called. */
+unsigned int btd_adapter_read_clock(struct btd_adapter *adapter,
+					const bdaddr_t *bdaddr, int which,
+					btd_adapter_read_clock_cb_t cb,
+					void *user_data,
+					GDestroyNotify destroy);
+bool btd_adapter_cancel_read_clock(struct btd_adapter *adapter,
+							unsigned int id);
 
 int btd_adapter_block_address(struct btd_adapter *adapter,
 				const bdaddr_t *bdaddr, uint8_t bdaddr_type);
@@ -191,6 +202,11 @@ int adapter_connect_list_add(struct btd_adapter *adapter,
 					struct btd_device *device);
 void adapter_connect_list_remove(struct btd_adapter *adapter,
 						struct btd_device *device);
+void adapter_le_connecting(struct btd_adapter *adapter, bool connecting);
+void adapter_temp_device_update(struct btd_adapter *adapter,
+						struct btd_device *device);
+void adapter_temp_device_cancel(struct btd_adapter *adapter,
+						struct btd_device *device);
 
 void btd_adapter_set_oob_handler(struct btd_adapter *adapter,
 						struct oob_handler *handler);
@@ -49,24 +49,54 @@
 #include "attrib/gatt.h"
 #include "attrib/att-database.h"
 #include "textfile.h"
+#include "keyfile.h"
 #include "storage.h"
 
 #include "attrib-server.h"
 
 static GSList *servers = NULL;
 
+enum {
+	DB_INDEX_PRIMARY,
+	DB_INDEX_SECONDARY,
+	DB_INDEX_INCLUDE,
+	DB_INDEX_CHARAC,
+	DB_INDEX_COUNT,
+};
+
 struct gatt_server {
 	struct btd_adapter *adapter;
 	GIOChannel *l2cap_io;
 	GIOChannel *le_io;
 	uint32_t gatt_sdp_handle;
 	uint32_t gap_sdp_handle;
-	GList *database;
+	GPtrArray *database;		/* Attributes sorted by handle */
+	/*
+	 * Derived from database and rebuilt on demand once stale: the
+	 * positions of the declarations of each indexed type, and the end
+	 * handle of each service indexed by the position of its declaration.
+	 */
+	gboolean index_stale;
+	GArray *type_index[DB_INDEX_COUNT];
+	GArray *group_end;
 	GSList *clients;
+	GSList *ccc_states;
 	uint16_t name_handle;
 	uint16_t appearance_handle;
 };
 
+/*
+ * Client Characteristic Configuration values of a device, shared by all its
+ * channels. Changes are written through the key file cache, which persists
+ * them later so ATT responses never wait for the storage.
+ */
+struct ccc_state {
+	struct btd_device *device;
+	char *filename;
+	GHashTable *values;
+	unsigned int refs;
+};
+
 struct gatt_channel {
 	GAttrib *attrib;
 	guint mtu;
@@ -76,6 +106,7 @@ struct gatt_channel {
 	struct gatt_server *server;
 	guint cleanup_id;
 	struct btd_device *device;
+	struct ccc_state *ccc;
 };
 
 struct group_elem {
@@ -85,19 +116,18 @@ struct group_elem {
 	uint16_t len;
 };
 
-static bt_uuid_t prim_uuid = {
-			.type = BT_UUID16,
-			.value.u16 = GATT_PRIM_SVC_UUID
-};
-static bt_uuid_t snd_uuid = {
-			.type = BT_UUID16,
-			.value.u16 = GATT_SND_SVC_UUID
-};
 static bt_uuid_t ccc_uuid = {
 			.type = BT_UUID16,
 			.value.u16 = GATT_CLIENT_CHARAC_CFG_UUID
 };
 
+static const uint16_t index_uuids[DB_INDEX_COUNT] = {
+	[DB_INDEX_PRIMARY] = GATT_PRIM_SVC_UUID,
+	[DB_INDEX_SECONDARY] = GATT_SND_SVC_UUID,
+	[DB_INDEX_INCLUDE] = GATT_INCLUDE_UUID,
+	[DB_INDEX_CHARAC] = GATT_CHARAC_UUID,
+};
+
 static inline void put_uuid_le(const bt_uuid_t *src, void *dst)
 {
 	if (src->type == BT_UUID16)
@@ -115,8 +145,110 @@ static void attrib_free(void *data)
 	g_free(a);
 }
 
+static void ccc_state_unref(struct gatt_server *server,
+						struct ccc_state *state)
+{
+	if (state == NULL)
+		return;
+
+	if (--state->refs > 0)
+		return;
+
+	server->ccc_states = g_slist_remove(server->ccc_states, state);
+
+	g_hash_table_destroy(state->values);
+	g_free(state->filename);
+	btd_device_unref(state->device);
+	g_free(state);
+}
+
+static void ccc_state_load(struct ccc_state *state)
+{
+	GKeyFile *key_file;
+	char **groups;
+	int i;
+
+	key_file = keyfile_get(state->filename);
+
+	groups = g_key_file_get_groups(key_file, NULL);
+
+	for (i = 0; groups[i]; i++) {
+		unsigned int handle, config;
+		char *str;
+
+		if (sscanf(groups[i], "%u", &handle) != 1 || handle == 0 ||
+							handle > UINT16_MAX)
+			continue;
+
+		str = g_key_file_get_string(key_file, groups[i], "Value",
+									NULL);
+		if (str && sscanf(str, "%04X", &config) == 1)
+			g_hash_table_insert(state->values,
+						GUINT_TO_POINTER(handle),
+						GUINT_TO_POINTER(config));
+
+		g_free(str);
+	}
+
+	g_strfreev(groups);
+}
+
+static struct ccc_state *ccc_state_get(struct gatt_server *server,
+						struct btd_device *device)
+{
+	struct ccc_state *state;
+	char *filename;
+	GSList *l;
+
+	for (l = server->ccc_states; l; l = l->next) {
+		state = l->data;
+
+		if (state->device == device) {
+			state->refs++;
+			return state;
+		}
+	}
+
+	filename = btd_device_get_storage_path(device, "ccc");
+	if (!filename) {
+		warn("Unable to get ccc storage path for device");
+		return NULL;
+	}
+
+	state = g_new0(struct ccc_state, 1);
+	state->device = btd_device_ref(device);
+	state->filename = filename;
+	state->values = g_hash_table_new(NULL, NULL);
+	state->refs = 1;
+
+	ccc_state_load(state);
+
+	server->ccc_states = g_slist_prepend(server->ccc_states, state);
+
+	return state;
+}
+
+static void ccc_state_set(struct ccc_state *state, uint16_t handle,
+							uint16_t value)
+{
+	gpointer key = GUINT_TO_POINTER(handle);
+	gpointer old;
+	char group[6], str[5];
+
+	if (g_hash_table_lookup_extended(state->values, key, NULL, &old) &&
+					GPOINTER_TO_UINT(old) == value)
+		return;
+
+	g_hash_table_insert(state->values, key, GUINT_TO_POINTER(value));
+
+	sprintf(group, "%hu", handle);
+	sprintf(str, "%hX", value);
+	keyfile_set_string(state->filename, group, "Value", str);
+}
+
 static void channel_free(struct gatt_channel *channel)
 {
+	ccc_state_unref(channel->server, channel->ccc);
 
 	if (channel->cleanup_id)
 		g_source_remove(channel->cleanup_id);
@@ -130,7 +262,14 @@ static void channel_free(struct gatt_channel *channel)
 
 static void gatt_server_free(struct gatt_server *server)
 {
-	g_list_free_full(server->database, attrib_free);
+	int i;
+
+	g_ptr_array_unref(server->database);
+
+	for (i = 0; i < DB_INDEX_COUNT; i++)
+		g_array_free(server->type_index[i], TRUE);
+
+	g_array_free(server->group_end, TRUE);
 
 	if (server->l2cap_io != NULL) {
 		g_io_channel_shutdown(server->l2cap_io, FALSE, NULL);
@@ -247,54 +386,155 @@ static sdp_record_t *server_record_new(uuid_t *uuid, uint16_t start, uint16_t en
 	return record;
 }
 
-static int handle_cmp(gconstpointer a, gconstpointer b)
+#define db_attr(server, pos) \
+	((struct attribute *) g_ptr_array_index((server)->database, (pos)))
+
+/* Position of the first attribute with a handle not below the given one */
+static guint db_lower_bound(struct gatt_server *server, uint16_t handle)
 {
-	const struct attribute *attrib = a;
-	uint16_t handle = GPOINTER_TO_UINT(b);
+	guint lo = 0, hi = server->database->len;
+
+	while (lo < hi) {
+		guint mid = (lo + hi) / 2;
 
-	return attrib->handle - handle;
+		if (db_attr(server, mid)->handle < handle)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
 }
 
-static int attribute_cmp(gconstpointer a1, gconstpointer a2)
+static struct attribute *db_find(struct gatt_server *server, uint16_t handle,
+								guint *pos)
 {
-	const struct attribute *attrib1 = a1;
-	const struct attribute *attrib2 = a2;
+	guint i = db_lower_bound(server, handle);
+	struct attribute *a;
 
-	return attrib1->handle - attrib2->handle;
+	if (i == server->database->len)
+		return NULL;
+
+	a = db_attr(server, i);
+	if (a->handle != handle)
+		return NULL;
+
+	if (pos)
+		*pos = i;
+
+	return a;
+}
+
+static int db_index_type(const bt_uuid_t *uuid)
+{
+	int i;
+
+	for (i = 0; i < DB_INDEX_COUNT; i++) {
+		bt_uuid_t u;
+
+		if (uuid->type == BT_UUID16) {
+			if (uuid->value.u16 == index_uuids[i])
+				return i;
+
+			continue;
+		}
+
+		/* Peers may use the 128-bit form of the declaration types */
+		bt_uuid16_create(&u, index_uuids[i]);
+		if (bt_uuid_cmp(uuid, &u) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+static gboolean is_service(const struct attribute *a)
+{
+	int type = db_index_type(&a->uuid);
+
+	return type == DB_INDEX_PRIMARY || type == DB_INDEX_SECONDARY;
+}
+
+static void db_index_update(struct gatt_server *server)
+{
+	guint pos, last_svc = 0;
+	gboolean in_svc = FALSE;
+	int i;
+
+	if (!server->index_stale)
+		return;
+
+	for (i = 0; i < DB_INDEX_COUNT; i++)
+		g_array_set_size(server->type_index[i], 0);
+
+	g_array_set_size(server->group_end, server->database->len);
+
+	for (pos = 0; pos < server->database->len; pos++) {
+		struct attribute *a = db_attr(server, pos);
+		int type = db_index_type(&a->uuid);
+
+		if (type < 0)
+			continue;
+
+		g_array_append_val(server->type_index[type], pos);
+
+		if (type != DB_INDEX_PRIMARY && type != DB_INDEX_SECONDARY)
+			continue;
+
+		/* The previous service ends where this one starts */
+		if (in_svc)
+			g_array_index(server->group_end, uint16_t, last_svc) =
+						db_attr(server, pos - 1)->handle;
+
+		last_svc = pos;
+		in_svc = TRUE;
+	}
+
+	if (in_svc)
+		g_array_index(server->group_end, uint16_t, last_svc) =
+			db_attr(server, server->database->len - 1)->handle;
+
+	server->index_stale = FALSE;
+}
+
+/* Position in index of the first declaration with a handle >= start */
+static guint index_lower_bound(struct gatt_server *server, GArray *index,
+							uint16_t start)
+{
+	guint lo = 0, hi = index->len;
+
+	while (lo < hi) {
+		guint mid = (lo + hi) / 2;
+		guint pos = g_array_index(index, guint, mid);
+
+		if (db_attr(server, pos)->handle < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
 }
 
 static struct attribute *find_svc_range(struct gatt_server *server,
 					uint16_t start, uint16_t *end)
 {
 	struct attribute *attrib;
-	guint h = start;
-	GList *l;
+	guint pos;
 
 	if (end == NULL)
 		return NULL;
 
-	l = g_list_find_custom(server->database, GUINT_TO_POINTER(h),
-								handle_cmp);
-	if (!l)
+	attrib = db_find(server, start, &pos);
+	if (!attrib)
 		return NULL;
 
-	attrib = l->data;
-
-	if (bt_uuid_cmp(&attrib->uuid, &prim_uuid) != 0 &&
-			bt_uuid_cmp(&attrib->uuid, &snd_uuid) != 0)
+	if (!is_service(attrib))
 		return NULL;
 
-	*end = start;
-
-	for (l = l->next; l; l = l->next) {
-		struct attribute *a = l->data;
+	db_index_update(server);
 
-		if (bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
-				bt_uuid_cmp(&a->uuid, &snd_uuid) == 0)
-			break;
-
-		*end = a->handle;
-	}
+	*end = g_array_index(server->group_end, uint16_t, pos);
 
 	return attrib;
 }
@@ -350,12 +590,13 @@ static struct attribute *attrib_db_add_new(struct gatt_server *server,
 				const uint8_t *value, size_t len)
 {
 	struct attribute *a;
-	guint h = handle;
+	GPtrArray *db = server->database;
+	guint pos;
 
 	DBG("handle=0x%04x", handle);
 
-	if (g_list_find_custom(server->database, GUINT_TO_POINTER(h),
-								handle_cmp))
+	pos = db_lower_bound(server, handle);
+	if (pos < db->len && db_attr(server, pos)->handle == handle)
 		return NULL;
 
 	a = g_new0(struct attribute, 1);
@@ -366,8 +607,13 @@ static struct attribute *attrib_db_add_new(struct gatt_server *server,
 	a->read_req = read_req;
 	a->write_req = write_req;
 
-	server->database = g_list_insert_sorted(server->database, a,
-								attribute_cmp);
+	/* Insert at pos, keeping the array sorted */
+	g_ptr_array_add(db, NULL);
+	memmove(&db->pdata[pos + 1], &db->pdata[pos],
+				(db->len - pos - 1) * sizeof(gpointer));
+	db->pdata[pos] = a;
+
+	server->index_stale = TRUE;
 
 	return a;
 }
@@ -410,14 +656,16 @@ static uint16_t read_by_group(struct gatt_channel *channel, uint16_t start,
 						uint16_t end, bt_uuid_t *uuid,
 						uint8_t *pdu, size_t len)
 {
+	struct gatt_server *server = channel->server;
 	struct att_data_list *adl;
 	struct attribute *a;
-	struct group_elem *cur, *old = NULL;
+	struct group_elem *cur;
 	GSList *l, *groups;
-	GList *dl, *database;
-	uint16_t length, last_handle, last_size = 0;
+	GArray *index;
+	uint16_t length, last_size = 0;
 	uint8_t status;
-	int i;
+	guint i;
+	int type;
 
 	if (start > end || start == 0x0000)
 		return enc_error_resp(ATT_OP_READ_BY_GROUP_REQ, start,
@@ -428,36 +676,23 @@ static uint16_t read_by_group(struct gatt_channel *channel, uint16_t start,
 	 * types may be used in the Read By Group Type Request.
 	 */
 
-	if (bt_uuid_cmp(uuid, &prim_uuid) != 0 &&
-		bt_uuid_cmp(uuid, &snd_uuid) != 0)
+	type = db_index_type(uuid);
+	if (type != DB_INDEX_PRIMARY && type != DB_INDEX_SECONDARY)
 		return enc_error_resp(ATT_OP_READ_BY_GROUP_REQ, 0x0000,
 					ATT_ECODE_UNSUPP_GRP_TYPE, pdu, len);
 
-	last_handle = end;
-	database = channel->server->database;
-	for (dl = database, groups = NULL, cur = NULL; dl; dl = dl->next) {
+	db_index_update(server);
 
-		a = dl->data;
+	index = server->type_index[type];
 
-		if (a->handle < start)
-			continue;
+	for (i = index_lower_bound(server, index, start), groups = NULL;
+						i < index->len; i++) {
+		guint pos = g_array_index(index, guint, i);
 
-		if (a->handle >= end)
-			break;
+		a = db_attr(server, pos);
 
-		/* The old group ends when a new one starts */
-		if (old && (bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
-				bt_uuid_cmp(&a->uuid, &snd_uuid) == 0)) {
-			old->end = last_handle;
-			old = NULL;
-		}
-
-		if (bt_uuid_cmp(&a->uuid, uuid) != 0) {
-			/* Still inside a service, update its last handle */
-			if (old)
-				last_handle = a->handle;
-			continue;
-		}
+		if (a->handle > end)
+			break;
 
 		if (last_size && (last_size != a->len))
 			break;
@@ -477,6 +712,7 @@ static uint16_t read_by_group(struct gatt_channel *channel, uint16_t start,
 
 		cur = g_new0(struct group_elem, 1);
 		cur->handle = a->handle;
+		cur->end = g_array_index(server->group_end, uint16_t, pos);
 		cur->data = a->data;
 		cur->len = a->len;
 
@@ -484,19 +720,12 @@ static uint16_t read_by_group(struct gatt_channel *channel, uint16_t start,
 		groups = g_slist_append(groups, cur);
 
 		last_size = a->len;
-		old = cur;
-		last_handle = cur->handle;
 	}
 
 	if (groups == NULL)
 		return enc_error_resp(ATT_OP_READ_BY_GROUP_REQ, start,
 					ATT_ECODE_ATTR_NOT_FOUND, pdu, len);
 
-	if (dl == NULL)
-		cur->end = a->handle;
-	else
-		cur->end = last_handle;
-
 	length = g_slist_length(groups);
 
 	adl = att_data_list_alloc(length, last_size + 4);
@@ -531,30 +760,42 @@ static uint16_t read_by_type(struct gatt_channel *channel, uint16_t start,
 						uint16_t end, bt_uuid_t *uuid,
 						uint8_t *pdu, size_t len)
 {
+	struct gatt_server *server = channel->server;
 	struct att_data_list *adl;
 	GSList *l, *types;
-	GList *dl, *database;
+	GArray *index = NULL;
 	struct attribute *a;
 	uint16_t num, length;
 	uint8_t status;
-	int i;
+	guint i, count;
+	int type;
 
 	if (start > end || start == 0x0000)
 		return enc_error_resp(ATT_OP_READ_BY_TYPE_REQ, start,
 					ATT_ECODE_INVALID_HANDLE, pdu, len);
 
-	database = channel->server->database;
-	for (dl = database, length = 0, types = NULL; dl; dl = dl->next) {
-
-		a = dl->data;
+	/* Declarations are looked up in their index, others scanned */
+	type = db_index_type(uuid);
+	if (type >= 0) {
+		db_index_update(server);
+		index = server->type_index[type];
+		i = index_lower_bound(server, index, start);
+		count = index->len;
+	} else {
+		i = db_lower_bound(server, start);
+		count = server->database->len;
+	}
 
-		if (a->handle < start)
-			continue;
+	for (length = 0, types = NULL; i < count; i++) {
+		if (index)
+			a = db_attr(server, g_array_index(index, guint, i));
+		else
+			a = db_attr(server, i);
 
 		if (a->handle > end)
 			break;
 
-		if (bt_uuid_cmp(&a->uuid, uuid)  != 0)
+		if (!index && bt_uuid_cmp(&a->uuid, uuid) != 0)
 			continue;
 
 		status = att_check_reqs(channel, ATT_OP_READ_BY_TYPE_REQ,
@@ -619,24 +860,22 @@ static uint16_t read_by_type(struct gatt_channel *channel, uint16_t start,
 static uint16_t find_info(struct gatt_channel *channel, uint16_t start,
 				uint16_t end, uint8_t *pdu, size_t len)
 {
+	struct gatt_server *server = channel->server;
 	struct attribute *a;
 	struct att_data_list *adl;
 	GSList *l, *info;
-	GList *dl, *database;
 	uint8_t format, last_type = BT_UUID_UNSPEC;
 	uint16_t length, num;
+	guint pos;
 	int i;
 
 	if (start > end || start == 0x0000)
 		return enc_error_resp(ATT_OP_FIND_INFO_REQ, start,
 					ATT_ECODE_INVALID_HANDLE, pdu, len);
 
-	database = channel->server->database;
-	for (dl = database, info = NULL, num = 0; dl; dl = dl->next) {
-		a = dl->data;
-
-		if (a->handle < start)
-			continue;
+	for (pos = db_lower_bound(server, start), info = NULL, num = 0;
+				pos < server->database->len; pos++) {
+		a = db_attr(server, pos);
 
 		if (a->handle > end)
 			break;
@@ -701,23 +940,52 @@ static uint16_t find_by_type(struct gatt_channel *channel, uint16_t start,
 				const uint8_t *value, size_t vlen,
 				uint8_t *opdu, size_t mtu)
 {
+	struct gatt_server *server = channel->server;
 	struct attribute *a;
 	struct att_range *range;
 	GSList *matches;
-	GList *dl, *database;
 	uint16_t len;
+	guint i, pos;
+	int type;
 
 	if (start > end || start == 0x0000)
 		return enc_error_resp(ATT_OP_FIND_BY_TYPE_REQ, start,
 					ATT_ECODE_INVALID_HANDLE, opdu, mtu);
 
-	/* Searching first requested handle number */
-	database = channel->server->database;
-	for (dl = database, matches = NULL, range = NULL; dl; dl = dl->next) {
-		a = dl->data;
+	/* Service discovery by UUID: only visit the service declarations */
+	type = db_index_type(uuid);
+	if (type == DB_INDEX_PRIMARY || type == DB_INDEX_SECONDARY) {
+		GArray *index;
 
-		if (a->handle < start)
-			continue;
+		db_index_update(server);
+		index = server->type_index[type];
+
+		for (i = index_lower_bound(server, index, start),
+					matches = NULL; i < index->len; i++) {
+			pos = g_array_index(index, guint, i);
+			a = db_attr(server, pos);
+
+			if (a->handle > end)
+				break;
+
+			if (a->len != vlen || memcmp(a->data, value, vlen))
+				continue;
+
+			range = g_new0(struct att_range, 1);
+			range->start = a->handle;
+			range->end = MIN(end, g_array_index(server->group_end,
+							uint16_t, pos));
+
+			matches = g_slist_append(matches, range);
+		}
+
+		goto done;
+	}
+
+	/* Searching first requested handle number */
+	for (pos = db_lower_bound(server, start), matches = NULL, range = NULL;
+				pos < server->database->len; pos++) {
+		a = db_attr(server, pos);
 
 		if (a->handle > end)
 			break;
@@ -737,14 +1005,14 @@ static uint16_t find_by_type(struct gatt_channel *channel, uint16_t start,
 			/* Update the last found handle or reset the pointer
 			 * to track that a new group started: Primary or
 			 * Secondary service. */
-			if (bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
-					bt_uuid_cmp(&a->uuid, &snd_uuid) == 0)
+			if (is_service(a))
 				range = NULL;
 			else
 				range->end = a->handle;
 		}
 	}
 
+done:
 	if (matches == NULL)
 		return enc_error_resp(ATT_OP_FIND_BY_TYPE_REQ, start,
 				ATT_ECODE_ATTR_NOT_FOUND, opdu, mtu);
@@ -756,38 +1024,21 @@ static uint16_t find_by_type(struct gatt_channel *channel, uint16_t start,
 	return len;
 }
 
-static int read_device_ccc(struct btd_device *device, uint16_t handle,
+static int read_device_ccc(struct gatt_channel *channel, uint16_t handle,
 				uint16_t *value)
 {
-	char *filename;
-	GKeyFile *key_file;
-	char group[6];
-	char *str;
-	unsigned int config;
-	int err = 0;
+	gpointer config;
 
-	filename = btd_device_get_storage_path(device, "ccc");
-	if (!filename) {
-		warn("Unable to get ccc storage path for device");
+	if (!channel->ccc)
 		return -ENOENT;
-	}
-
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
 
-	sprintf(group, "%hu", handle);
-
-	str = g_key_file_get_string(key_file, group, "Value", NULL);
-	if (!str || sscanf(str, "%04X", &config) != 1)
-		err = -ENOENT;
-	else
-		*value = config;
+	if (!g_hash_table_lookup_extended(channel->ccc->values,
+					GUINT_TO_POINTER(handle), NULL, &config))
+		return -ENOENT;
 
-	g_free(str);
-	g_free(filename);
-	g_key_file_free(key_file);
+	*value = GPOINTER_TO_UINT(config);
 
-	return err;
+	return 0;
 }
 
 static uint16_t read_value(struct gatt_channel *channel, uint16_t handle,
@@ -795,20 +1046,15 @@ static uint16_t read_value(struct gatt_channel *channel, uint16_t handle,
 {
 	struct attribute *a;
 	uint8_t status;
-	GList *l;
 	uint16_t cccval;
-	guint h = handle;
 
-	l = g_list_find_custom(channel->server->database,
-					GUINT_TO_POINTER(h), handle_cmp);
-	if (!l)
+	a = db_find(channel->server, handle, NULL);
+	if (!a)
 		return enc_error_resp(ATT_OP_READ_REQ, handle,
 					ATT_ECODE_INVALID_HANDLE, pdu, len);
 
-	a = l->data;
-
 	if (bt_uuid_cmp(&ccc_uuid, &a->uuid) == 0 &&
-		read_device_ccc(channel->device, handle, &cccval) == 0) {
+		read_device_ccc(channel, handle, &cccval) == 0) {
 		uint8_t config[2];
 
 		put_le16(cccval, config);
@@ -832,24 +1078,19 @@ static uint16_t read_blob(struct gatt_channel *channel, uint16_t handle,
 {
 	struct attribute *a;
 	uint8_t status;
-	GList *l;
 	uint16_t cccval;
-	guint h = handle;
 
-	l = g_list_find_custom(channel->server->database,
-					GUINT_TO_POINTER(h), handle_cmp);
-	if (!l)
+	a = db_find(channel->server, handle, NULL);
+	if (!a)
 		return enc_error_resp(ATT_OP_READ_BLOB_REQ, handle,
 					ATT_ECODE_INVALID_HANDLE, pdu, len);
 
-	a = l->data;
-
 	if (a->len <= offset)
 		return enc_error_resp(ATT_OP_READ_BLOB_REQ, handle,
 					ATT_ECODE_INVALID_OFFSET, pdu, len);
 
 	if (bt_uuid_cmp(&ccc_uuid, &a->uuid) == 0 &&
-		read_device_ccc(channel->device, handle, &cccval) == 0) {
+		read_device_ccc(channel, handle, &cccval) == 0) {
 		uint8_t config[2];
 
 		put_le16(cccval, config);
@@ -875,17 +1116,12 @@ static uint16_t write_value(struct gatt_channel *channel, uint16_t handle,
 {
 	struct attribute *a;
 	uint8_t status;
-	GList *l;
-	guint h = handle;
 
-	l = g_list_find_custom(channel->server->database,
-					GUINT_TO_POINTER(h), handle_cmp);
-	if (!l)
+	a = db_find(channel->server, handle, NULL);
+	if (!a)
 		return enc_error_resp(ATT_OP_WRITE_REQ, handle,
 				ATT_ECODE_INVALID_HANDLE, pdu, len);
 
-	a = l->data;
-
 	status = att_check_reqs(channel, ATT_OP_WRITE_REQ, a->write_req);
 	if (status)
 		return enc_error_resp(ATT_OP_WRITE_REQ, handle, status, pdu,
@@ -904,37 +1140,12 @@ static uint16_t write_value(struct gatt_channel *channel, uint16_t handle,
 							status, pdu, len);
 		}
 	} else {
-		uint16_t cccval = get_le16(value);
-		char *filename;
-		GKeyFile *key_file;
-		char group[6], value[5];
-		char *data;
-		gsize length = 0;
-
-		filename = btd_device_get_storage_path(channel->device, "ccc");
-		if (!filename) {
-			warn("Unable to get ccc storage path for device");
+		if (!channel->ccc)
 			return enc_error_resp(ATT_OP_WRITE_REQ, handle,
 						ATT_ECODE_WRITE_NOT_PERM,
 						pdu, len);
-		}
 
-		key_file = g_key_file_new();
-		g_key_file_load_from_file(key_file, filename, 0, NULL);
-
-		sprintf(group, "%hu", handle);
-		sprintf(value, "%hX", cccval);
-		g_key_file_set_string(key_file, group, "Value", value);
-
-		data = g_key_file_to_data(key_file, &length, NULL);
-		if (length > 0) {
-			create_file(filename, S_IRUSR | S_IWUSR);
-			g_file_set_contents(filename, data, length, NULL);
-		}
-
-		g_free(data);
-		g_free(filename);
-		g_key_file_free(key_file);
+		ccc_state_set(channel->ccc, handle, get_le16(value));
 	}
 
 	return enc_write_resp(pdu);
@@ -1184,11 +1395,18 @@ guint attrib_channel_attach(GAttrib *attrib)
 
 		filename = btd_device_get_storage_path(device, "ccc");
 		if (filename) {
+			keyfile_discard(filename);
 			unlink(filename);
 			g_free(filename);
 		}
 	}
 
+	channel->ccc = ccc_state_get(server, device);
+
+	/* Configurations of a device which isn't bonded don't survive */
+	if (channel->ccc && !device_is_bonded(device, bdaddr_type))
+		g_hash_table_remove_all(channel->ccc->values);
+
 	if (cid != ATT_CID) {
 		channel->le = FALSE;
 		channel->mtu = mtu;
@@ -1288,7 +1506,12 @@ static void connect_event(GIOChannel *io, GError *gerr, void *user_data)
 	if (!device)
 		return;
 
-	device_attach_attrib(device, io);
+	/*
+	 * Connections created by the kernel for devices on the connect
+	 * list show up here as well.
+	 */
+	if (device_attach_attrib(device, io))
+		device_att_connected(device);
 }
 
 static gboolean register_core_services(struct gatt_server *server)
@@ -1354,17 +1577,43 @@ static gboolean register_core_services(struct gatt_server *server)
 	return TRUE;
 }
 
+static void channel_stats(gpointer data, gpointer user_data)
+{
+	struct gatt_channel *channel = data;
+	guint queued, sent, dropped;
+
+	g_attrib_get_stats(channel->attrib, &queued, &sent, &dropped);
+
+	info("%s: ATT PDUs queued %u sent %u dropped %u",
+			channel->device ? device_get_path(channel->device) :
+			"unknown device", queued, sent, dropped);
+}
+
+static void server_stats(void *user_data)
+{
+	struct gatt_server *server = user_data;
+
+	g_slist_foreach(server->clients, channel_stats, NULL);
+}
+
 int btd_adapter_gatt_server_start(struct btd_adapter *adapter)
 {
 	struct gatt_server *server;
 	GError *gerr = NULL;
 	const bdaddr_t *addr;
+	int i;
 
 	DBG("Start GATT server in hci%d", btd_adapter_get_index(adapter));
 
 	server = g_new0(struct gatt_server, 1);
 	server->adapter = btd_adapter_ref(adapter);
 
+	server->database = g_ptr_array_new_with_free_func(attrib_free);
+	for (i = 0; i < DB_INDEX_COUNT; i++)
+		server->type_index[i] = g_array_new(FALSE, FALSE,
+							sizeof(guint));
+	server->group_end = g_array_new(FALSE, TRUE, sizeof(uint16_t));
+
 	addr = btd_adapter_get_address(server->adapter);
 
 	/* BR/EDR socket */
@@ -1401,6 +1650,8 @@ int btd_adapter_gatt_server_start(struct btd_adapter *adapter)
 		/* Doesn't have LE support, continue */
 	}
 
+	btd_stats_register(server_stats, server);
+
 	servers = g_slist_prepend(servers, server);
 	return 0;
 }
@@ -1418,6 +1669,7 @@ void btd_adapter_gatt_server_stop(struct btd_adapter *adapter)
 
 	server = l->data;
 	servers = g_slist_remove(servers, server);
+	btd_stats_unregister(server_stats, server);
 	gatt_server_free(server);
 }
 
@@ -1443,27 +1695,24 @@ static uint16_t find_uuid16_avail(struct btd_adapter *adapter, uint16_t nitems)
 	struct gatt_server *server;
 	uint16_t handle;
 	GSList *l;
-	GList *dl;
+	guint pos;
 
 	l = g_slist_find_custom(servers, adapter, adapter_cmp);
 	if (l == NULL)
 		return 0;
 
 	server = l->data;
-	if (server->database == NULL)
+	if (server->database->len == 0)
 		return 0x0001;
 
-	for (dl = server->database, handle = 0x0001; dl; dl = dl->next) {
-		struct attribute *a = dl->data;
+	for (pos = 0, handle = 0x0001; pos < server->database->len; pos++) {
+		struct attribute *a = db_attr(server, pos);
 
-		if ((bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
-				bt_uuid_cmp(&a->uuid, &snd_uuid) == 0) &&
-				a->handle - handle >= nitems)
+		if (is_service(a) && a->handle - handle >= nitems)
 			/* Note: the range above excludes the current handle */
 			return handle;
 
-		if (a->len == 16 && (bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
-				bt_uuid_cmp(&a->uuid, &snd_uuid) == 0)) {
+		if (a->len == 16 && is_service(a)) {
 			/* 128 bit UUID service definition */
 			return 0;
 		}
@@ -1484,25 +1733,24 @@ static uint16_t find_uuid128_avail(struct btd_adapter *adapter, uint16_t nitems)
 {
 	uint16_t handle = 0, end = 0xffff;
 	struct gatt_server *server;
-	GList *dl;
 	GSList *l;
+	guint pos;
 
 	l = g_slist_find_custom(servers, adapter, adapter_cmp);
 	if (l == NULL)
 		return 0;
 
 	server = l->data;
-	if (server->database == NULL)
+	if (server->database->len == 0)
 		return 0xffff - nitems + 1;
 
-	for (dl = g_list_last(server->database); dl; dl = dl->prev) {
-		struct attribute *a = dl->data;
+	for (pos = server->database->len; pos > 0; pos--) {
+		struct attribute *a = db_attr(server, pos - 1);
 
 		if (handle == 0)
 			handle = a->handle;
 
-		if (bt_uuid_cmp(&a->uuid, &prim_uuid) != 0 &&
-				bt_uuid_cmp(&a->uuid, &snd_uuid) != 0)
+		if (!is_service(a))
 			continue;
 
 		if (end - handle >= nitems)
@@ -1567,8 +1815,6 @@ int attrib_db_update(struct btd_adapter *adapter, uint16_t handle,
 	struct gatt_server *server;
 	struct attribute *a;
 	GSList *l;
-	GList *dl;
-	guint h = handle;
 
 	l = g_slist_find_custom(servers, adapter, adapter_cmp);
 	if (l == NULL)
@@ -1578,13 +1824,10 @@ int attrib_db_update(struct btd_adapter *adapter, uint16_t handle,
 
 	DBG("handle=0x%04x", handle);
 
-	dl = g_list_find_custom(server->database, GUINT_TO_POINTER(h),
-								handle_cmp);
-	if (dl == NULL)
+	a = db_find(server, handle, NULL);
+	if (a == NULL)
 		return -ENOENT;
 
-	a = dl->data;
-
 	a->data = g_try_realloc(a->data, len);
 	if (len && a->data == NULL)
 		return -ENOMEM;
@@ -1592,8 +1835,10 @@ int attrib_db_update(struct btd_adapter *adapter, uint16_t handle,
 	a->len = len;
 	memcpy(a->data, value, len);
 
-	if (uuid != NULL)
+	if (uuid != NULL) {
 		a->uuid = *uuid;
+		server->index_stale = TRUE;
+	}
 
 	if (attr)
 		*attr = a;
@@ -1604,10 +1849,8 @@ int attrib_db_update(struct btd_adapter *adapter, uint16_t handle,
 int attrib_db_del(struct btd_adapter *adapter, uint16_t handle)
 {
 	struct gatt_server *server;
-	struct attribute *a;
 	GSList *l;
-	GList *dl;
-	guint h = handle;
+	guint pos;
 
 	l = g_slist_find_custom(servers, adapter, adapter_cmp);
 	if (l == NULL)
@@ -1617,15 +1860,11 @@ int attrib_db_del(struct btd_adapter *adapter, uint16_t handle)
 
 	DBG("handle=0x%04x", handle);
 
-	dl = g_list_find_custom(server->database, GUINT_TO_POINTER(h),
-								handle_cmp);
-	if (dl == NULL)
+	if (db_find(server, handle, &pos) == NULL)
 		return -ENOENT;
 
-	a = dl->data;
-	server->database = g_list_remove(server->database, a);
-	g_free(a->data);
-	g_free(a);
+	g_ptr_array_remove_index(server->database, pos);
+	server->index_stale = TRUE;
 
 	return 0;
 }
@@ -63,6 +63,8 @@
 #include "attrib/gatt.h"
 #include "agent.h"
 #include "textfile.h"
+#include "keyfile.h"
+#include "intern.h"
 #include "storage.h"
 #include "attrib-server.h"
 
@@ -121,6 +123,12 @@ struct browse_req {
 	int reconnect_attempt;
 	guint listener_id;
 	uint16_t sdp_flags;
+	sdp_list_t *cached;		/* Records stored by a previous browse */
+	sdp_list_t *states;		/* Record handles and states */
+	GSList *fetch;			/* Classes of changed records, uuid_t */
+	bool skip_store;		/* Records come from storage */
+	bool db_state_valid;
+	uint32_t db_state;		/* Remote ServiceDatabaseState */
 };
 
 struct included_search {
@@ -161,6 +169,22 @@ struct bearer_state {
 	bool svc_resolved;
 };
 
+struct char_cache {
+	struct att_range range;
+	GSList *chars;				/* struct gatt_char */
+	GSList *desc_ranges;			/* struct att_range */
+	GSList *descs;				/* struct gatt_desc */
+};
+
+struct char_discovery {
+	struct btd_device *device;
+	struct att_range range;
+	bt_uuid_t uuid;
+	bool filter;
+	gatt_cb_t func;
+	gpointer user_data;
+};
+
 struct btd_device {
 	int ref_count;
 
@@ -172,9 +196,9 @@ struct btd_device {
 	bool		pending_paired;		/* "Paired" waiting for SDP */
 	bool		svc_refreshed;
 	GSList		*svc_callbacks;
-	GSList		*eir_uuids;
-	char		name[MAX_NAME_LENGTH + 1];
-	char		*alias;
+	GSList		*eir_uuids;		/* Interned bt_uuid_t */
+	const char	*name;			/* Interned, never NULL */
+	const char	*alias;			/* Interned */
 	uint32_t	class;
 	uint16_t	vendor_src;
 	uint16_t	vendor;
@@ -185,6 +209,8 @@ struct btd_device {
 	struct btd_adapter	*adapter;
 	GSList		*uuids;
 	GSList		*primaries;		/* List of primary services */
+	GSList		*char_caches;		/* Characteristics by service */
+	GSList		*char_discoveries;	/* Pending discoveries */
 	GSList		*services;		/* List of btd_service */
 	GSList		*pending;		/* Pending services */
 	GSList		*watches;		/* List of disconnect_data */
@@ -209,6 +235,7 @@ struct btd_device {
 
 	time_t		bredr_seen;
 	time_t		le_seen;
+	time_t		last_used;		/* Last profile connection */
 
 	gboolean	trusted;
 	gboolean	blocked;
@@ -219,6 +246,10 @@ struct btd_device {
 	bool		legacy;
 	int8_t		rssi;
 
+	/* Advertising data and scan response seen last, see eir.h */
+	uint64_t	eir_fingerprint[2];
+	unsigned int	eir_fingerprint_next;
+
 	GIOChannel	*att_io;
 	guint		cleanup_id;
 	guint		store_id;
@@ -233,6 +264,7 @@ static const uint16_t uuid_list[] = {
 
 static int device_browse_primary(struct btd_device *device, DBusMessage *msg);
 static int device_browse_sdp(struct btd_device *device, DBusMessage *msg);
+static sdp_list_t *read_device_records(struct btd_device *device);
 
 static struct bearer_state *get_state(struct btd_device *dev,
 							uint8_t bdaddr_type)
@@ -304,10 +336,8 @@ static gboolean store_device_info_cb(gpointer user_data)
 	char filename[PATH_MAX + 1];
 	char adapter_addr[18];
 	char device_addr[18];
-	char *str;
 	char class[9];
 	char **uuids = NULL;
-	gsize length = 0;
 
 	device->store_id = 0;
 
@@ -317,8 +347,7 @@ static gboolean store_device_info_cb(gpointer user_data)
 			device_addr);
 	filename[PATH_MAX] = '\0';
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = keyfile_get(filename);
 
 	g_key_file_set_string(key_file, "General", "Name", device->name);
 
@@ -350,6 +379,10 @@ static gboolean store_device_info_cb(gpointer user_data)
 	g_key_file_set_boolean(key_file, "General", "Blocked",
 							device->blocked);
 
+	if (device->last_used)
+		g_key_file_set_uint64(key_file, "General", "LastUsed",
+							device->last_used);
+
 	if (device->uuids) {
 		GSList *l;
 		int i;
@@ -376,13 +409,8 @@ static gboolean store_device_info_cb(gpointer user_data)
 		g_key_file_remove_group(key_file, "DeviceID", NULL);
 	}
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
+	keyfile_changed(filename);
 
-	g_key_file_free(key_file);
 	g_free(uuids);
 
 	return FALSE;
@@ -420,9 +448,6 @@ void device_store_cached_name(struct btd_device *dev, const char *name)
 {
 	char filename[PATH_MAX + 1];
 	char s_addr[18], d_addr[18];
-	GKeyFile *key_file;
-	char *data;
-	gsize length = 0;
 
 	if (device_address_is_private(dev)) {
 		warn("Can't store name for private addressed device %s",
@@ -434,17 +459,8 @@ void device_store_cached_name(struct btd_device *dev, const char *name)
 	ba2str(&dev->bdaddr, d_addr);
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", s_addr, d_addr);
 	filename[PATH_MAX] = '\0';
-	create_file(filename, S_IRUSR | S_IWUSR);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
-	g_key_file_set_string(key_file, "General", "Name", name);
-
-	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, data, length, NULL);
-	g_free(data);
-
-	g_key_file_free(key_file);
+	keyfile_set_string(filename, "General", "Name", name);
 }
 
 static void browse_request_free(struct browse_req *req)
@@ -454,8 +470,13 @@ static void browse_request_free(struct browse_req *req)
 	if (req->msg)
 		dbus_message_unref(req->msg);
 	g_slist_free_full(req->profiles_added, g_free);
+	g_slist_free_full(req->fetch, g_free);
 	if (req->records)
 		sdp_list_free(req->records, (sdp_free_func_t) sdp_record_free);
+	if (req->cached)
+		sdp_list_free(req->cached, (sdp_free_func_t) sdp_record_free);
+	if (req->states)
+		sdp_list_free(req->states, (sdp_free_func_t) sdp_record_free);
 
 	g_free(req);
 }
@@ -476,6 +497,7 @@ static void attio_cleanup(struct btd_device *device)
 		g_io_channel_shutdown(device->att_io, FALSE, NULL);
 		g_io_channel_unref(device->att_io);
 		device->att_io = NULL;
+		adapter_le_connecting(device->adapter, false);
 	}
 
 	if (device->attrib) {
@@ -511,12 +533,52 @@ static void svc_dev_remove(gpointer user_data)
 	g_free(cb);
 }
 
+static void uuid_str_unref(gpointer data)
+{
+	intern_uuid_str_unref(data);
+}
+
+static void uuid_unref(gpointer data)
+{
+	intern_uuid_unref(data);
+}
+
+static void device_set_name_str(struct btd_device *device, const char *name)
+{
+	char *str = g_strndup(name, MAX_NAME_LENGTH);
+
+	intern_string_unref(device->name);
+	device->name = intern_string(str);
+
+	g_free(str);
+}
+
+static void char_cache_free(gpointer data)
+{
+	struct char_cache *cache = data;
+
+	g_slist_free_full(cache->chars, g_free);
+	g_slist_free_full(cache->desc_ranges, g_free);
+	g_slist_free_full(cache->descs, g_free);
+	g_free(cache);
+}
+
+static void char_discovery_orphan(gpointer data, gpointer user_data)
+{
+	struct char_discovery *disc = data;
+
+	disc->device = NULL;
+}
+
 static void device_free(gpointer user_data)
 {
 	struct btd_device *device = user_data;
 
-	g_slist_free_full(device->uuids, g_free);
+	g_slist_free_full(device->uuids, uuid_str_unref);
 	g_slist_free_full(device->primaries, g_free);
+	g_slist_free_full(device->char_caches, char_cache_free);
+	g_slist_foreach(device->char_discoveries, char_discovery_orphan, NULL);
+	g_slist_free(device->char_discoveries);
 	g_slist_free_full(device->attios, g_free);
 	g_slist_free_full(device->attios_offline, g_free);
 	g_slist_free_full(device->svc_callbacks, svc_dev_remove);
@@ -549,10 +611,11 @@ static void device_free(gpointer user_data)
 	}
 
 	if (device->eir_uuids)
-		g_slist_free_full(device->eir_uuids, g_free);
+		g_slist_free_full(device->eir_uuids, uuid_unref);
 
 	g_free(device->path);
-	g_free(device->alias);
+	intern_string_unref(device->name);
+	intern_string_unref(device->alias);
 	free(device->modalias);
 	g_free(device);
 }
@@ -644,8 +707,8 @@ static void set_alias(GDBusPendingPropertySet id, const char *alias,
 		return;
 	}
 
-	g_free(device->alias);
-	device->alias = g_str_equal(alias, "") ? NULL : g_strdup(alias);
+	intern_string_unref(device->alias);
+	device->alias = g_str_equal(alias, "") ? NULL : intern_string(alias);
 
 	store_device_info(device);
 
@@ -933,17 +996,24 @@ static gboolean dev_property_get_uuids(const GDBusPropertyTable *property,
 	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
 				DBUS_TYPE_STRING_AS_STRING, &entry);
 
-	if (dev->bredr_state.svc_resolved || dev->le_state.svc_resolved)
-		l = dev->uuids;
-	else if (dev->eir_uuids)
-		l = dev->eir_uuids;
-	else
-		l = dev->uuids;
+	if (!dev->bredr_state.svc_resolved && !dev->le_state.svc_resolved &&
+							dev->eir_uuids) {
+		/* EIR UUIDs are kept in binary form, interned with a string */
+		for (l = dev->eir_uuids; l != NULL; l = l->next) {
+			const char *ptr = intern_uuid_to_str(l->data);
+
+			dbus_message_iter_append_basic(&entry,
+						DBUS_TYPE_STRING, &ptr);
+		}
+
+		goto done;
+	}
 
-	for (; l != NULL; l = l->next)
+	for (l = dev->uuids; l != NULL; l = l->next)
 		dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING,
 							&l->data);
 
+done:
 	dbus_message_iter_close_container(iter, &entry);
 
 	return TRUE;
@@ -1248,20 +1318,33 @@ done:
 	dev->connect = NULL;
 }
 
-void device_add_eir_uuids(struct btd_device *dev, GSList *uuids)
+static int uuid128_cmp(gconstpointer a, gconstpointer b)
 {
-	GSList *l;
+	const bt_uuid_t *u1 = a;
+	const bt_uuid_t *u2 = b;
+
+	return memcmp(&u1->value.u128, &u2->value.u128, sizeof(uint128_t));
+}
+
+void device_add_eir_uuids(struct btd_device *dev, const bt_uuid_t *uuids,
+							unsigned int count)
+{
+	bt_uuid_t uuid128;
 	bool added = false;
+	unsigned int i;
 
 	if (dev->bredr_state.svc_resolved || dev->le_state.svc_resolved)
 		return;
 
-	for (l = uuids; l != NULL; l = l->next) {
-		const char *str = l->data;
-		if (g_slist_find_custom(dev->eir_uuids, str, bt_uuid_strcmp))
+	for (i = 0; i < count; i++) {
+		bt_uuid_to_uuid128(&uuids[i], &uuid128);
+
+		if (g_slist_find_custom(dev->eir_uuids, &uuid128, uuid128_cmp))
 			continue;
+
 		added = true;
-		dev->eir_uuids = g_slist_append(dev->eir_uuids, g_strdup(str));
+		dev->eir_uuids = g_slist_append(dev->eir_uuids,
+					(gpointer) intern_uuid(&uuid128));
 	}
 
 	if (added)
@@ -1549,7 +1632,7 @@ static void device_svc_resolved(struct btd_device *dev, uint8_t bdaddr_type,
 	if (state->connected)
 		dev->svc_refreshed = true;
 
-	g_slist_free_full(dev->eir_uuids, g_free);
+	g_slist_free_full(dev->eir_uuids, uuid_unref);
 	dev->eir_uuids = NULL;
 
 	if (dev->pending_paired) {
@@ -1863,6 +1946,24 @@ static DBusMessage *cancel_pairing(DBusConnection *conn, DBusMessage *msg,
 	return dbus_message_new_method_return(msg);
 }
 
+static DBusMessage *refresh_services(DBusConnection *conn, DBusMessage *msg,
+								void *data)
+{
+	struct btd_device *device = data;
+
+	DBG("");
+
+	if (device->bdaddr_type == BDADDR_BREDR)
+		return btd_error_not_supported(msg);
+
+	if (device->browse)
+		return btd_error_in_progress(msg);
+
+	btd_device_gatt_cache_invalidate(device);
+
+	return dbus_message_new_method_return(msg);
+}
+
 static const GDBusMethodTable device_methods[] = {
 	{ GDBUS_ASYNC_METHOD("Disconnect", NULL, NULL, dev_disconnect) },
 	{ GDBUS_ASYNC_METHOD("Connect", NULL, NULL, dev_connect) },
@@ -1872,6 +1973,8 @@ static const GDBusMethodTable device_methods[] = {
 						NULL, disconnect_profile) },
 	{ GDBUS_ASYNC_METHOD("Pair", NULL, NULL, pair_device) },
 	{ GDBUS_METHOD("CancelPairing", NULL, NULL, cancel_pairing) },
+	{ GDBUS_EXPERIMENTAL_METHOD("RefreshServices", NULL, NULL,
+						refresh_services) },
 	{ }
 };
 
@@ -2014,16 +2117,13 @@ static char *load_cached_name(struct btd_device *device, const char *local,
 {
 	char filename[PATH_MAX + 1];
 	GKeyFile *key_file;
-	char *str = NULL;
+	char *str;
 	int len;
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 	filename[PATH_MAX] = '\0';
 
-	key_file = g_key_file_new();
-
-	if (!g_key_file_load_from_file(key_file, filename, 0, NULL))
-		goto failed;
+	key_file = keyfile_get(filename);
 
 	str = g_key_file_get_string(key_file, "General", "Name", NULL);
 	if (str) {
@@ -2032,9 +2132,6 @@ static char *load_cached_name(struct btd_device *device, const char *local,
 			str[HCI_MAX_NAME_LENGTH] = '\0';
 	}
 
-failed:
-	g_key_file_free(key_file);
-
 	return str;
 }
 
@@ -2059,13 +2156,16 @@ static void load_info(struct btd_device *device, const char *local,
 	}
 
 	if (str) {
-		strcpy(device->name, str);
+		device_set_name_str(device, str);
 		g_free(str);
 	}
 
 	/* Load alias */
-	device->alias = g_key_file_get_string(key_file, "General", "Alias",
-									NULL);
+	str = g_key_file_get_string(key_file, "General", "Alias", NULL);
+	if (str) {
+		device->alias = intern_string(str);
+		g_free(str);
+	}
 
 	/* Load class */
 	str = g_key_file_get_string(key_file, "General", "Class", NULL);
@@ -2122,6 +2222,10 @@ next:
 	device->trusted = g_key_file_get_boolean(key_file, "General",
 							"Trusted", NULL);
 
+	/* Load when a profile was last connected */
+	device->last_used = g_key_file_get_uint64(key_file, "General",
+							"LastUsed", NULL);
+
 	/* Load device blocked */
 	blocked = g_key_file_get_boolean(key_file, "General", "Blocked", NULL);
 	if (blocked)
@@ -2134,6 +2238,7 @@ next:
 		char **uuid;
 
 		for (uuid = uuids; *uuid; uuid++) {
+			const char *str;
 			GSList *match;
 
 			match = g_slist_find_custom(device->uuids, *uuid,
@@ -2141,9 +2246,13 @@ next:
 			if (match)
 				continue;
 
+			str = intern_uuid_str(*uuid);
+			if (!str)
+				continue;
+
 			device->uuids = g_slist_insert_sorted(device->uuids,
-								g_strdup(*uuid),
-								bt_uuid_strcmp);
+							(gpointer) str,
+							bt_uuid_strcmp);
 		}
 		g_strfreev(uuids);
 
@@ -2170,6 +2279,168 @@ next:
 		store_device_info(device);
 }
 
+static GSList *load_cached_char(GKeyFile *key_file, const char *group,
+								GSList *chars)
+{
+	struct gatt_char *chr;
+	char *str;
+	int value_handle;
+
+	str = g_key_file_get_string(key_file, group, "Value", NULL);
+	if (!str)
+		return chars;
+
+	value_handle = g_key_file_get_integer(key_file, group, "ValueHandle",
+									NULL);
+	if (value_handle == 0 || strlen(str) > MAX_LEN_UUID_STR) {
+		g_free(str);
+		return chars;
+	}
+
+	chr = g_new0(struct gatt_char, 1);
+	chr->handle = atoi(group);
+	chr->value_handle = value_handle;
+	chr->properties = g_key_file_get_integer(key_file, group,
+							"Properties", NULL);
+	strcpy(chr->uuid, str);
+	g_free(str);
+
+	return g_slist_prepend(chars, chr);
+}
+
+static GSList *load_cached_desc(const char *group, const char *uuid,
+								GSList *descs)
+{
+	struct gatt_desc *desc;
+
+	if (strlen(uuid) > MAX_LEN_UUID_STR)
+		return descs;
+
+	desc = g_new0(struct gatt_desc, 1);
+	desc->handle = atoi(group);
+	strcpy(desc->uuid, uuid);
+
+	return g_slist_prepend(descs, desc);
+}
+
+static GSList *load_desc_ranges(GKeyFile *key_file, const char *group,
+								GSList *ranges)
+{
+	int *list;
+	gsize len, i;
+
+	list = g_key_file_get_integer_list(key_file, group,
+					"DescriptorRanges", &len, NULL);
+	if (!list)
+		return ranges;
+
+	for (i = 0; i + 1 < len; i += 2) {
+		struct att_range *range;
+
+		if (list[i] <= 0 || list[i] > list[i + 1])
+			continue;
+
+		range = g_new0(struct att_range, 1);
+		range->start = list[i];
+		range->end = list[i + 1];
+		ranges = g_slist_prepend(ranges, range);
+	}
+
+	g_free(list);
+
+	return ranges;
+}
+
+static int char_handle_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct gatt_char *chr1 = a;
+	const struct gatt_char *chr2 = b;
+
+	return chr1->handle - chr2->handle;
+}
+
+static int desc_handle_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct gatt_desc *desc1 = a;
+	const struct gatt_desc *desc2 = b;
+
+	return desc1->handle - desc2->handle;
+}
+
+/*
+ * Characteristics are only ever stored for fully discovered services, and
+ * descriptors only for fully discovered ranges of those services.
+ */
+static void char_caches_from_storage(struct btd_device *device, GSList *chars,
+					GSList *desc_ranges, GSList *descs)
+{
+	GSList *l;
+
+	chars = g_slist_sort(chars, char_handle_cmp);
+	descs = g_slist_sort(descs, desc_handle_cmp);
+
+	for (l = device->primaries; l; l = l->next) {
+		struct gatt_primary *prim = l->data;
+		struct char_cache *cache = NULL;
+		GSList *c, *next;
+
+		for (c = chars; c; c = next) {
+			struct gatt_char *chr = c->data;
+
+			next = c->next;
+
+			if (chr->handle < prim->range.start ||
+					chr->handle > prim->range.end)
+				continue;
+
+			if (!cache) {
+				cache = g_new0(struct char_cache, 1);
+				cache->range = prim->range;
+			}
+
+			chars = g_slist_remove_link(chars, c);
+			cache->chars = g_slist_concat(cache->chars, c);
+		}
+
+		if (!cache)
+			continue;
+
+		for (c = desc_ranges; c; c = next) {
+			struct att_range *range = c->data;
+
+			next = c->next;
+
+			if (range->start < prim->range.start ||
+					range->end > prim->range.end)
+				continue;
+
+			desc_ranges = g_slist_remove_link(desc_ranges, c);
+			cache->desc_ranges = g_slist_concat(cache->desc_ranges,
+									c);
+		}
+
+		for (c = descs; c; c = next) {
+			struct gatt_desc *desc = c->data;
+
+			next = c->next;
+
+			if (desc->handle < prim->range.start ||
+					desc->handle > prim->range.end)
+				continue;
+
+			descs = g_slist_remove_link(descs, c);
+			cache->descs = g_slist_concat(cache->descs, c);
+		}
+
+		device->char_caches = g_slist_append(device->char_caches,
+									cache);
+	}
+
+	g_slist_free_full(chars, g_free);
+	g_slist_free_full(desc_ranges, g_free);
+	g_slist_free_full(descs, g_free);
+}
+
 static void load_att_info(struct btd_device *device, const char *local,
 				const char *peer)
 {
@@ -2178,19 +2449,22 @@ static void load_att_info(struct btd_device *device, const char *local,
 	char *prim_uuid, *str;
 	char **groups, **handle, *service_uuid;
 	struct gatt_primary *prim;
+	GSList *chars = NULL, *desc_ranges = NULL, *descs = NULL;
 	uuid_t uuid;
-	char tmp[3];
+	char tmp[3], *char_uuid;
 	int i;
 
 	sdp_uuid16_create(&uuid, GATT_PRIM_SVC_UUID);
 	prim_uuid = bt_uuid2string(&uuid);
 
+	sdp_uuid16_create(&uuid, GATT_CHARAC_UUID);
+	char_uuid = bt_uuid2string(&uuid);
+
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/attributes", local,
 			peer);
 	filename[PATH_MAX] = '\0';
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = keyfile_get(filename);
 	groups = g_key_file_get_groups(key_file, NULL);
 
 	for (handle = groups; *handle; handle++) {
@@ -2201,11 +2475,22 @@ static void load_att_info(struct btd_device *device, const char *local,
 		if (!str)
 			continue;
 
+		if (g_str_equal(str, char_uuid)) {
+			g_free(str);
+			chars = load_cached_char(key_file, *handle, chars);
+			continue;
+		}
+
 		uuid_ok = g_str_equal(str, prim_uuid);
-		g_free(str);
 
-		if (!uuid_ok)
+		/* Anything but services and characteristics is a descriptor */
+		if (!uuid_ok) {
+			descs = load_cached_desc(*handle, str, descs);
+			g_free(str);
 			continue;
+		}
+
+		g_free(str);
 
 		str = g_key_file_get_string(key_file, *handle, "Value", NULL);
 		if (!str)
@@ -2252,11 +2537,15 @@ static void load_att_info(struct btd_device *device, const char *local,
 		g_free(str);
 
 		device->primaries = g_slist_append(device->primaries, prim);
+
+		desc_ranges = load_desc_ranges(key_file, *handle, desc_ranges);
 	}
 
 	g_strfreev(groups);
-	g_key_file_free(key_file);
 	free(prim_uuid);
+	free(char_uuid);
+
+	char_caches_from_storage(device, chars, desc_ranges, descs);
 }
 
 static struct btd_device *device_new(struct btd_adapter *adapter,
@@ -2272,6 +2561,8 @@ static struct btd_device *device_new(struct btd_adapter *adapter,
 	if (device == NULL)
 		return NULL;
 
+	device->name = intern_string("");
+
 	address_up = g_ascii_strup(address, -1);
 	device->path = g_strdup_printf("%s/dev_%s", adapter_path, address_up);
 	g_strdelimit(device->path, ":", '_');
@@ -2344,7 +2635,7 @@ struct btd_device *device_create(struct btd_adapter *adapter,
 
 	str = load_cached_name(device, src, dst);
 	if (str) {
-		strcpy(device->name, str);
+		device_set_name_str(device, str);
 		g_free(str);
 	}
 
@@ -2379,7 +2670,7 @@ void btd_device_device_set_name(struct btd_device *device, const char *name)
 
 	DBG("%s %s", device->path, name);
 
-	strncpy(device->name, name, MAX_NAME_LENGTH);
+	device_set_name_str(device, name);
 
 	store_device_info(device);
 
@@ -2455,6 +2746,9 @@ void device_update_last_seen(struct btd_device *device, uint8_t bdaddr_type)
 		device->bredr_seen = time(NULL);
 	else
 		device->le_seen = time(NULL);
+
+	if (device->temporary)
+		adapter_temp_device_update(device->adapter, device);
 }
 
 /* It is possible that we have two device objects for the same device in
@@ -2476,13 +2770,14 @@ void device_merge_duplicate(struct btd_device *dev, struct btd_device *dup)
 	dev->blocked = dup->blocked;
 
 	for (l = dup->uuids; l; l = g_slist_next(l))
-		dev->uuids = g_slist_append(dev->uuids, g_strdup(l->data));
+		dev->uuids = g_slist_append(dev->uuids,
+				(gpointer) intern_uuid_str(l->data));
 
 	if (dev->name[0] == '\0')
-		strcpy(dev->name, dup->name);
+		device_set_name_str(dev, dup->name);
 
 	if (!dev->alias)
-		dev->alias = g_strdup(dup->alias);
+		dev->alias = intern_string(dup->alias);
 
 	dev->class = dup->class;
 
@@ -2552,8 +2847,6 @@ static void device_remove_stored(struct btd_device *device)
 	char device_addr[18];
 	char filename[PATH_MAX + 1];
 	GKeyFile *key_file;
-	char *data;
-	gsize length = 0;
 
 	if (device->bredr_state.bonded) {
 		device->bredr_state.bonded = false;
@@ -2579,24 +2872,16 @@ static void device_remove_stored(struct btd_device *device)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s", adapter_addr,
 			device_addr);
 	filename[PATH_MAX] = '\0';
+	keyfile_discard_dir(filename);
 	delete_folder_tree(filename);
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", adapter_addr,
 			device_addr);
 	filename[PATH_MAX] = '\0';
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
-	g_key_file_remove_group(key_file, "ServiceRecords", NULL);
-
-	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
-
-	g_free(data);
-	g_key_file_free(key_file);
+	key_file = keyfile_get(filename);
+	if (g_key_file_remove_group(key_file, "ServiceRecords", NULL))
+		keyfile_changed(filename);
 }
 
 void device_remove(struct btd_device *device, gboolean remove_stored)
@@ -2814,18 +3099,23 @@ void device_probe_profiles(struct btd_device *device, GSList *uuids)
 
 	DBG("Probing profiles for device %s", addr);
 
-	btd_profile_foreach(dev_probe, &d);
+	btd_profile_foreach_uuid(uuids, dev_probe, &d);
 
 add_uuids:
 	for (l = uuids; l != NULL; l = g_slist_next(l)) {
 		GSList *match = g_slist_find_custom(device->uuids, l->data,
 							bt_uuid_strcmp);
+		const char *str;
+
 		if (match)
 			continue;
 
+		str = intern_uuid_str(l->data);
+		if (!str)
+			continue;
+
 		device->uuids = g_slist_insert_sorted(device->uuids,
-						g_strdup(l->data),
-						bt_uuid_strcmp);
+						(gpointer) str, bt_uuid_strcmp);
 	}
 
 	g_dbus_emit_property_changed(dbus_conn, device->path,
@@ -2947,26 +3237,22 @@ static void update_bredr_services(struct browse_req *req, sdp_list_t *recs)
 	char att_file[PATH_MAX + 1];
 	GKeyFile *sdp_key_file = NULL;
 	GKeyFile *att_key_file = NULL;
-	char *data;
-	gsize length = 0;
 
 	ba2str(btd_adapter_get_address(device->adapter), srcaddr);
 	ba2str(&device->bdaddr, dstaddr);
 
-	if (!device->temporary) {
+	if (!device->temporary && !req->skip_store) {
 		snprintf(sdp_file, PATH_MAX, STORAGEDIR "/%s/cache/%s",
 							srcaddr, dstaddr);
 		sdp_file[PATH_MAX] = '\0';
 
-		sdp_key_file = g_key_file_new();
-		g_key_file_load_from_file(sdp_key_file, sdp_file, 0, NULL);
+		sdp_key_file = keyfile_get(sdp_file);
 
 		snprintf(att_file, PATH_MAX, STORAGEDIR "/%s/%s/attributes",
 							srcaddr, dstaddr);
 		att_file[PATH_MAX] = '\0';
 
-		att_key_file = g_key_file_new();
-		g_key_file_load_from_file(att_key_file, att_file, 0, NULL);
+		att_key_file = keyfile_get(att_file);
 	}
 
 	for (seq = recs; seq; seq = seq->next) {
@@ -3028,27 +3314,11 @@ next:
 		sdp_list_free(svcclass, free);
 	}
 
-	if (sdp_key_file) {
-		data = g_key_file_to_data(sdp_key_file, &length, NULL);
-		if (length > 0) {
-			create_file(sdp_file, S_IRUSR | S_IWUSR);
-			g_file_set_contents(sdp_file, data, length, NULL);
-		}
-
-		g_free(data);
-		g_key_file_free(sdp_key_file);
-	}
+	if (sdp_key_file)
+		keyfile_changed(sdp_file);
 
-	if (att_key_file) {
-		data = g_key_file_to_data(att_key_file, &length, NULL);
-		if (length > 0) {
-			create_file(att_file, S_IRUSR | S_IWUSR);
-			g_file_set_contents(att_file, data, length, NULL);
-		}
-
-		g_free(data);
-		g_key_file_free(att_key_file);
-	}
+	if (att_key_file)
+		keyfile_changed(att_file);
 }
 
 static int primary_cmp(gconstpointer a, gconstpointer b)
@@ -3124,6 +3394,51 @@ static void device_register_primaries(struct btd_device *device,
 	device->primaries = g_slist_concat(device->primaries, prim_list);
 }
 
+static void sdp_cache_filename(struct btd_device *device, char *filename)
+{
+	char srcaddr[18], dstaddr[18];
+
+	ba2str(btd_adapter_get_address(device->adapter), srcaddr);
+	ba2str(&device->bdaddr, dstaddr);
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", srcaddr,
+								dstaddr);
+	filename[PATH_MAX] = '\0';
+}
+
+static void store_db_state(struct btd_device *device, uint32_t state)
+{
+	char filename[PATH_MAX + 1];
+	char str[11];
+
+	if (device->temporary)
+		return;
+
+	sdp_cache_filename(device, filename);
+	sprintf(str, "0x%8.8X", state);
+
+	keyfile_set_string(filename, "General", "ServiceDatabaseState", str);
+}
+
+static bool read_db_state(struct btd_device *device, uint32_t *state)
+{
+	char filename[PATH_MAX + 1];
+	char *str;
+	bool found;
+
+	sdp_cache_filename(device, filename);
+
+	str = g_key_file_get_string(keyfile_get(filename), "General",
+						"ServiceDatabaseState", NULL);
+	if (!str)
+		return false;
+
+	found = sscanf(str, "0x%8X", state) == 1;
+	g_free(str);
+
+	return found;
+}
+
 static void search_cb(sdp_list_t *recs, int err, gpointer user_data)
 {
 	struct browse_req *req = user_data;
@@ -3141,6 +3456,9 @@ static void search_cb(sdp_list_t *recs, int err, gpointer user_data)
 
 	update_bredr_services(req, recs);
 
+	if (req->db_state_valid)
+		store_db_state(device, req->db_state);
+
 	if (device->tmp_records)
 		sdp_list_free(device->tmp_records,
 					(sdp_free_func_t) sdp_record_free);
@@ -3209,9 +3527,8 @@ static void store_services(struct btd_device *device)
 	uuid_t uuid;
 	char *prim_uuid;
 	GKeyFile *key_file;
+	char **groups, **group;
 	GSList *l;
-	char *data;
-	gsize length = 0;
 
 	if (device_address_is_private(device)) {
 		warn("Can't store services for private addressed device %s",
@@ -3219,6 +3536,9 @@ static void store_services(struct btd_device *device)
 		return;
 	}
 
+	if (!device->primaries)
+		return;
+
 	sdp_uuid16_create(&uuid, GATT_PRIM_SVC_UUID);
 	prim_uuid = bt_uuid2string(&uuid);
 	if (prim_uuid == NULL)
@@ -3231,7 +3551,12 @@ static void store_services(struct btd_device *device)
 								dst_addr);
 	filename[PATH_MAX] = '\0';
 
-	key_file = g_key_file_new();
+	/* The stored primaries are replaced as a whole */
+	key_file = keyfile_get(filename);
+	groups = g_key_file_get_groups(key_file, NULL);
+	for (group = groups; *group; group++)
+		g_key_file_remove_group(key_file, *group, NULL);
+	g_strfreev(groups);
 
 	for (l = device->primaries; l; l = l->next) {
 		struct gatt_primary *primary = l->data;
@@ -3265,15 +3590,9 @@ static void store_services(struct btd_device *device)
 					primary->range.end);
 	}
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	keyfile_changed(filename);
 
 	free(prim_uuid);
-	g_free(data);
-	g_key_file_free(key_file);
 }
 
 static bool device_get_auto_connect(struct btd_device *device)
@@ -3348,6 +3667,10 @@ static void register_all_services(struct browse_req *req, GSList *services)
 	g_slist_free_full(device->primaries, g_free);
 	device->primaries = NULL;
 
+	/* The stored characteristics are dropped by store_services() */
+	g_slist_free_full(device->char_caches, char_cache_free);
+	device->char_caches = NULL;
+
 	device_register_primaries(device, services, -1);
 
 	device_probe_profiles(device, req->profiles_added);
@@ -3555,6 +3878,7 @@ static void att_connect_cb(GIOChannel *io, GError *gerr, gpointer user_data)
 
 	g_io_channel_unref(device->att_io);
 	device->att_io = NULL;
+	adapter_le_connecting(device->adapter, false);
 
 	if (gerr) {
 		DBG("%s", gerr->message);
@@ -3622,11 +3946,8 @@ static void att_error_cb(const GError *gerr, gpointer user_data)
 	}
 }
 
-static void att_success_cb(gpointer user_data)
+void device_att_connected(struct btd_device *device)
 {
-	struct att_callbacks *attcb = user_data;
-	struct btd_device *device = attcb->user_data;
-
 	if (device->attios == NULL)
 		return;
 
@@ -3640,6 +3961,13 @@ static void att_success_cb(gpointer user_data)
 	g_slist_foreach(device->attios, attio_connected, device->attrib);
 }
 
+static void att_success_cb(gpointer user_data)
+{
+	struct att_callbacks *attcb = user_data;
+
+	device_att_connected(attcb->user_data);
+}
+
 int device_connect_le(struct btd_device *dev)
 {
 	struct btd_adapter *adapter = dev->adapter;
@@ -3699,6 +4027,7 @@ int device_connect_le(struct btd_device *dev)
 
 	/* Keep this, so we can cancel the connection */
 	dev->att_io = io;
+	adapter_le_connecting(dev->adapter, true);
 
 	return 0;
 }
@@ -3765,6 +4094,8 @@ static int device_browse_primary(struct btd_device *device, DBusMessage *msg)
 		return -EIO;
 	}
 
+	adapter_le_connecting(adapter, true);
+
 done:
 
 	if (msg) {
@@ -3807,48 +4138,294 @@ static uint16_t get_sdp_flags(struct btd_device *device)
 	return 0;
 }
 
-static int device_browse_sdp(struct btd_device *device, DBusMessage *msg)
+static int browse_sdp_full(struct browse_req *req)
 {
-	struct btd_adapter *adapter = device->adapter;
-	struct browse_req *req;
+	struct btd_device *device = req->device;
 	uuid_t uuid;
-	int err;
-
-	if (device->browse)
-		return -EBUSY;
 
-	req = g_new0(struct browse_req, 1);
-	req->device = device;
 	sdp_uuid16_create(&uuid, uuid_list[req->search_uuid++]);
 
-	req->sdp_flags = get_sdp_flags(device);
-
-	err = bt_search_service(btd_adapter_get_address(adapter),
-				&device->bdaddr, &uuid, browse_cb, req, NULL,
-				req->sdp_flags);
-	if (err < 0) {
-		browse_request_free(req);
-		return err;
-	}
-
-	device->browse = req;
+	return bt_search_service(btd_adapter_get_address(device->adapter),
+					&device->bdaddr, &uuid, browse_cb, req,
+					NULL, req->sdp_flags);
+}
 
-	if (msg) {
-		const char *sender = dbus_message_get_sender(msg);
+static void browse_sdp_fallback(struct browse_req *req)
+{
+	int err;
 
-		req->msg = dbus_message_ref(msg);
-		/* Track the request owner to cancel it
-		 * automatically if the owner exits */
-		req->listener_id = g_dbus_add_disconnect_watch(dbus_conn,
-						sender,
-						discover_services_req_exit,
-						req, NULL);
-	}
+	req->search_uuid = 0;
 
-	return err;
+	err = browse_sdp_full(req);
+	if (err < 0)
+		search_cb(NULL, err, req);
 }
 
-int device_discover_services(struct btd_device *device)
+static bool get_record_state(const sdp_record_t *rec, uint32_t *state)
+{
+	sdp_data_t *d;
+
+	d = sdp_data_get(rec, SDP_ATTR_RECORD_STATE);
+	if (!d || d->dtd != SDP_UINT32)
+		return false;
+
+	*state = d->val.uint32;
+
+	return true;
+}
+
+static void remove_stored_record(struct btd_device *device, uint32_t handle)
+{
+	char filename[PATH_MAX + 1];
+	char handle_str[11];
+	GKeyFile *key_file;
+
+	if (device->temporary)
+		return;
+
+	sdp_cache_filename(device, filename);
+	sprintf(handle_str, "0x%8.8X", handle);
+
+	key_file = keyfile_get(filename);
+	if (g_key_file_remove_key(key_file, "ServiceRecords", handle_str,
+									NULL))
+		keyfile_changed(filename);
+}
+
+static void fetch_changed_cb(sdp_list_t *recs, int err, gpointer user_data)
+{
+	struct browse_req *req = user_data;
+	struct btd_device *device = req->device;
+	uuid_t *uuid;
+
+	if (err < 0) {
+		search_cb(NULL, err, req);
+		return;
+	}
+
+	update_bredr_services(req, recs);
+
+	if (req->fetch) {
+		uuid = req->fetch->data;
+		req->fetch = g_slist_remove(req->fetch, uuid);
+
+		err = bt_search_service(
+				btd_adapter_get_address(device->adapter),
+				&device->bdaddr, uuid, fetch_changed_cb, req,
+				NULL, req->sdp_flags);
+		g_free(uuid);
+		if (err < 0)
+			search_cb(NULL, err, req);
+		return;
+	}
+
+	/* Everything else is unchanged and taken from storage */
+	req->skip_store = true;
+	search_cb(req->cached, 0, req);
+}
+
+static int fetch_uuid_cmp(gconstpointer a, gconstpointer b)
+{
+	return sdp_uuid_cmp(a, b);
+}
+
+static void record_state_cb(sdp_list_t *recs, int err, gpointer user_data);
+
+static int search_record_states(struct browse_req *req)
+{
+	struct btd_device *device = req->device;
+	uuid_t uuid;
+
+	sdp_uuid16_create(&uuid, uuid_list[req->search_uuid++]);
+
+	/* Only retrieve the handles, classes and states of the records */
+	return bt_search(btd_adapter_get_address(device->adapter),
+				&device->bdaddr, &uuid, SDP_ATTR_RECORD_HANDLE,
+				SDP_ATTR_RECORD_STATE, record_state_cb, req,
+				NULL, req->sdp_flags);
+}
+
+/*
+ * The record handles and states are retrieved with the same searches as
+ * the full browse, see browse_cb(). Once all records are known only those
+ * which are new or whose ServiceRecordState differs from the stored copy
+ * are fetched again, by searching for their service class.
+ */
+static void record_state_cb(sdp_list_t *recs, int err, gpointer user_data)
+{
+	struct browse_req *req = user_data;
+	struct btd_device *device = req->device;
+	sdp_list_t *seq, *keep = NULL, *next;
+
+	if (err < 0) {
+		browse_sdp_fallback(req);
+		return;
+	}
+
+	for (seq = recs; seq; seq = seq->next) {
+		if (sdp_list_find(req->states, seq->data, rec_cmp))
+			continue;
+
+		req->states = sdp_list_append(req->states,
+						sdp_copy_record(seq->data));
+	}
+
+	if (uuid_list[req->search_uuid] &&
+				!(req->search_uuid == 2 && req->states)) {
+		if (search_record_states(req) < 0)
+			browse_sdp_fallback(req);
+		return;
+	}
+
+	if (!req->states) {
+		browse_sdp_fallback(req);
+		return;
+	}
+
+	for (seq = req->states; seq; seq = seq->next) {
+		sdp_record_t *rec = seq->data;
+		sdp_list_t *stored, *svcclass = NULL;
+		uint32_t state, stored_state;
+
+		stored = sdp_list_find(req->cached, rec, rec_cmp);
+		if (stored && get_record_state(rec, &state) &&
+				get_record_state(stored->data, &stored_state) &&
+				state == stored_state) {
+			keep = sdp_list_append(keep, stored->data);
+			continue;
+		}
+
+		/* Records without a class can only be fetched by a browse */
+		if (sdp_get_service_classes(rec, &svcclass) < 0 || !svcclass) {
+			sdp_list_free(keep, NULL);
+			browse_sdp_fallback(req);
+			return;
+		}
+
+		if (!g_slist_find_custom(req->fetch, svcclass->data,
+							fetch_uuid_cmp))
+			req->fetch = g_slist_append(req->fetch,
+					g_memdup(svcclass->data,
+							sizeof(uuid_t)));
+
+		sdp_list_free(svcclass, free);
+	}
+
+	/*
+	 * Forget about records which are about to be replaced or which none
+	 * of the searches returned, a full browse wouldn't find them either.
+	 */
+	for (seq = req->cached; seq; seq = next) {
+		sdp_record_t *rec = seq->data;
+
+		next = seq->next;
+
+		if (sdp_list_find(keep, rec, rec_cmp))
+			continue;
+
+		remove_stored_record(device, rec->handle);
+		req->cached = sdp_list_remove(req->cached, rec);
+		sdp_record_free(rec);
+	}
+
+	sdp_list_free(keep, NULL);
+
+	DBG("%u changed service classes", g_slist_length(req->fetch));
+
+	fetch_changed_cb(NULL, 0, req);
+}
+
+static void db_state_cb(sdp_list_t *recs, int err, gpointer user_data)
+{
+	struct browse_req *req = user_data;
+	struct btd_device *device = req->device;
+	sdp_list_t *seq;
+	uint32_t stored;
+
+	for (seq = recs; err == 0 && seq; seq = seq->next) {
+		sdp_data_t *d = sdp_data_get(seq->data, SDP_ATTR_SVCDB_STATE);
+
+		if (!d || d->dtd != SDP_UINT32)
+			continue;
+
+		req->db_state = d->val.uint32;
+		req->db_state_valid = true;
+		break;
+	}
+
+	if (!req->db_state_valid || !req->cached ||
+					!read_db_state(device, &stored)) {
+		browse_sdp_fallback(req);
+		return;
+	}
+
+	if (req->db_state == stored) {
+		DBG("ServiceDatabaseState unchanged, using stored records");
+		req->skip_store = true;
+		search_cb(req->cached, 0, req);
+		return;
+	}
+
+	if (search_record_states(req) < 0)
+		browse_sdp_fallback(req);
+}
+
+static int device_browse_sdp(struct btd_device *device, DBusMessage *msg)
+{
+	struct btd_adapter *adapter = device->adapter;
+	struct browse_req *req;
+	uuid_t uuid;
+	uint32_t state;
+	int err;
+
+	if (device->browse)
+		return -EBUSY;
+
+	req = g_new0(struct browse_req, 1);
+	req->device = device;
+	req->sdp_flags = get_sdp_flags(device);
+
+	if (!device->temporary)
+		req->cached = read_device_records(device);
+
+	/*
+	 * Start by reading the ServiceDatabaseState of the remote, unless
+	 * the records have been stored before without a state which means
+	 * the remote does not support it.
+	 */
+	if (device->temporary || (req->cached &&
+					!read_db_state(device, &state))) {
+		err = browse_sdp_full(req);
+	} else {
+		sdp_uuid16_create(&uuid, SDP_SERVER_SVCLASS_ID);
+		err = bt_search_service(btd_adapter_get_address(adapter),
+					&device->bdaddr, &uuid, db_state_cb,
+					req, NULL, req->sdp_flags);
+	}
+
+	if (err < 0) {
+		browse_request_free(req);
+		return err;
+	}
+
+	device->browse = req;
+
+	if (msg) {
+		const char *sender = dbus_message_get_sender(msg);
+
+		req->msg = dbus_message_ref(msg);
+		/* Track the request owner to cancel it
+		 * automatically if the owner exits */
+		req->listener_id = g_dbus_add_disconnect_watch(dbus_conn,
+						sender,
+						discover_services_req_exit,
+						req, NULL);
+	}
+
+	return err;
+}
+
+int device_discover_services(struct btd_device *device)
 {
 	int err;
 
@@ -3901,8 +4478,11 @@ void btd_device_set_temporary(struct btd_device *device, gboolean temporary)
 
 	DBG("temporary %d", temporary);
 
-	if (temporary)
+	if (temporary) {
 		adapter_connect_list_remove(device->adapter, device);
+		adapter_temp_device_update(device->adapter, device);
+	} else
+		adapter_temp_device_cancel(device->adapter, device);
 
 	device->temporary = temporary;
 }
@@ -3925,6 +4505,21 @@ void btd_device_set_trusted(struct btd_device *device, gboolean trusted)
 					DEVICE_INTERFACE, "Trusted");
 }
 
+void btd_device_set_last_used(struct btd_device *device)
+{
+	if (!device)
+		return;
+
+	device->last_used = time(NULL);
+
+	store_device_info(device);
+}
+
+time_t btd_device_get_last_used(struct btd_device *device)
+{
+	return device->last_used;
+}
+
 void device_set_bonded(struct btd_device *device, uint8_t bdaddr_type)
 {
 	if (!device)
@@ -3932,10 +4527,19 @@ void device_set_bonded(struct btd_device *device, uint8_t bdaddr_type)
 
 	DBG("");
 
-	if (bdaddr_type == BDADDR_BREDR)
+	if (bdaddr_type == BDADDR_BREDR) {
 		device->bredr_state.bonded = true;
-	else
-		device->le_state.bonded = true;
+		return;
+	}
+
+	device->le_state.bonded = true;
+
+	/*
+	 * Services restored from storage are only reused for bonded devices
+	 * since only those get Service Changed indications on reconnect.
+	 */
+	if (device->primaries && !device->browse)
+		device->le_state.svc_resolved = true;
 }
 
 void device_set_legacy(struct btd_device *device, bool legacy)
@@ -3954,6 +4558,26 @@ void device_set_legacy(struct btd_device *device, bool legacy)
 					DEVICE_INTERFACE, "LegacyPairing");
 }
 
+bool device_eir_is_known(struct btd_device *device, uint64_t fingerprint)
+{
+	return device->eir_fingerprint[0] == fingerprint ||
+				device->eir_fingerprint[1] == fingerprint;
+}
+
+void device_set_eir_fingerprint(struct btd_device *device,
+							uint64_t fingerprint)
+{
+	if (device_eir_is_known(device, fingerprint))
+		return;
+
+	/*
+	 * Two slots so that kernels reporting advertising data and scan
+	 * response separately still hit the cache.
+	 */
+	device->eir_fingerprint[device->eir_fingerprint_next] = fingerprint;
+	device->eir_fingerprint_next ^= 1;
+}
+
 void device_set_rssi(struct btd_device *device, int8_t rssi)
 {
 	if (!device)
@@ -4612,6 +5236,422 @@ void btd_device_gatt_set_service_changed(struct btd_device *device,
 	device_browse_primary(device, NULL);
 }
 
+static void char_cache_filename(struct btd_device *device, char *filename)
+{
+	char src_addr[18], dst_addr[18];
+
+	ba2str(btd_adapter_get_address(device->adapter), src_addr);
+	ba2str(&device->bdaddr, dst_addr);
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/attributes", src_addr,
+								dst_addr);
+	filename[PATH_MAX] = '\0';
+}
+
+static void store_char_cache(struct btd_device *device,
+						struct char_cache *cache)
+{
+	char filename[PATH_MAX + 1];
+	GKeyFile *key_file;
+	uuid_t uuid;
+	char *char_uuid;
+	GSList *l;
+
+	if (device_address_is_private(device))
+		return;
+
+	if (!device_is_bonded(device, device->bdaddr_type))
+		return;
+
+	sdp_uuid16_create(&uuid, GATT_CHARAC_UUID);
+	char_uuid = bt_uuid2string(&uuid);
+	if (char_uuid == NULL)
+		return;
+
+	char_cache_filename(device, filename);
+	key_file = keyfile_get(filename);
+
+	for (l = cache->chars; l; l = l->next) {
+		struct gatt_char *chr = l->data;
+		char handle[6];
+
+		sprintf(handle, "%hu", chr->handle);
+
+		g_key_file_set_string(key_file, handle, "UUID", char_uuid);
+		g_key_file_set_string(key_file, handle, "Value", chr->uuid);
+		g_key_file_set_integer(key_file, handle, "ValueHandle",
+							chr->value_handle);
+		g_key_file_set_integer(key_file, handle, "Properties",
+							chr->properties);
+	}
+
+	keyfile_changed(filename);
+
+	free(char_uuid);
+}
+
+static struct char_cache *find_char_cache(struct btd_device *device,
+						uint16_t start, uint16_t end)
+{
+	GSList *l;
+
+	for (l = device->char_caches; l; l = l->next) {
+		struct char_cache *cache = l->data;
+
+		if (cache->range.start == start && cache->range.end == end)
+			return cache;
+	}
+
+	return NULL;
+}
+
+static bool find_primary_range(struct btd_device *device, uint16_t start,
+								uint16_t end)
+{
+	GSList *l;
+
+	for (l = device->primaries; l; l = l->next) {
+		struct gatt_primary *prim = l->data;
+
+		if (prim->range.start == start && prim->range.end == end)
+			return true;
+	}
+
+	return false;
+}
+
+/* Hand out copies, as with gatt_discover_char() the list is freed after */
+static void deliver_chars(GSList *chars, const bt_uuid_t *uuid,
+					gatt_cb_t func, gpointer user_data)
+{
+	GSList *l, *copy = NULL;
+
+	for (l = chars; l; l = l->next) {
+		struct gatt_char *chr = l->data;
+
+		if (uuid) {
+			bt_uuid_t chr_uuid;
+
+			if (bt_string_to_uuid(&chr_uuid, chr->uuid) < 0 ||
+					bt_uuid_cmp(&chr_uuid, uuid) != 0)
+				continue;
+		}
+
+		copy = g_slist_prepend(copy, g_memdup(chr, sizeof(*chr)));
+	}
+
+	copy = g_slist_reverse(copy);
+
+	if (copy)
+		func(0, copy, user_data);
+	else
+		func(ATT_ECODE_ATTR_NOT_FOUND, NULL, user_data);
+
+	g_slist_free_full(copy, g_free);
+}
+
+static void char_discovery_cb(uint8_t status, GSList *chars,
+							void *user_data)
+{
+	struct char_discovery *disc = user_data;
+	struct btd_device *device = disc->device;
+	struct char_cache *cache;
+	GSList *l;
+
+	if (device)
+		device->char_discoveries = g_slist_remove(
+					device->char_discoveries, disc);
+
+	/* Status 0 means the whole service has been discovered */
+	if (status || !device) {
+		disc->func(status, chars, disc->user_data);
+		g_free(disc);
+		return;
+	}
+
+	cache = find_char_cache(device, disc->range.start, disc->range.end);
+	if (!cache) {
+		cache = g_new0(struct char_cache, 1);
+		cache->range = disc->range;
+
+		for (l = chars; l; l = l->next)
+			cache->chars = g_slist_append(cache->chars,
+				g_memdup(l->data, sizeof(struct gatt_char)));
+
+		device->char_caches = g_slist_append(device->char_caches,
+									cache);
+
+		store_char_cache(device, cache);
+	}
+
+	deliver_chars(chars, disc->filter ? &disc->uuid : NULL, disc->func,
+							disc->user_data);
+
+	g_free(disc);
+}
+
+void btd_device_gatt_discover_char(struct btd_device *device,
+					uint16_t start, uint16_t end,
+					bt_uuid_t *uuid,
+					void (*func) (uint8_t status,
+							GSList *chars,
+							void *user_data),
+					void *user_data)
+{
+	struct char_cache *cache;
+	struct char_discovery *disc;
+
+	cache = find_char_cache(device, start, end);
+	if (cache) {
+		DBG("%s using cached characteristics 0x%04x-0x%04x",
+						device->path, start, end);
+		deliver_chars(cache->chars, uuid, func, user_data);
+		return;
+	}
+
+	if (!device->attrib) {
+		func(ATT_ECODE_IO, NULL, user_data);
+		return;
+	}
+
+	/* Only whole services are cached, anything else is passed through */
+	if (!find_primary_range(device, start, end)) {
+		if (gatt_discover_char(device->attrib, start, end, uuid, func,
+							user_data) == 0)
+			func(ATT_ECODE_IO, NULL, user_data);
+
+		return;
+	}
+
+	disc = g_new0(struct char_discovery, 1);
+	disc->device = device;
+	disc->range.start = start;
+	disc->range.end = end;
+	disc->func = func;
+	disc->user_data = user_data;
+
+	if (uuid) {
+		disc->uuid = *uuid;
+		disc->filter = true;
+	}
+
+	if (gatt_discover_char(device->attrib, start, end, NULL,
+					char_discovery_cb, disc) == 0) {
+		g_free(disc);
+		func(ATT_ECODE_IO, NULL, user_data);
+		return;
+	}
+
+	device->char_discoveries = g_slist_prepend(device->char_discoveries,
+									disc);
+}
+
+static void store_desc_cache(struct btd_device *device,
+						struct char_cache *cache)
+{
+	char filename[PATH_MAX + 1];
+	char handle[6];
+	GKeyFile *key_file;
+	int *ranges;
+	GSList *l;
+	gsize i;
+
+	if (device_address_is_private(device))
+		return;
+
+	if (!device_is_bonded(device, device->bdaddr_type))
+		return;
+
+	char_cache_filename(device, filename);
+	key_file = keyfile_get(filename);
+
+	for (l = cache->descs; l; l = l->next) {
+		struct gatt_desc *desc = l->data;
+
+		sprintf(handle, "%hu", desc->handle);
+		g_key_file_set_string(key_file, handle, "UUID", desc->uuid);
+	}
+
+	ranges = g_new0(int, g_slist_length(cache->desc_ranges) * 2);
+
+	for (i = 0, l = cache->desc_ranges; l; l = l->next) {
+		struct att_range *range = l->data;
+
+		ranges[i++] = range->start;
+		ranges[i++] = range->end;
+	}
+
+	/* The ranges go with the service, the primaries are stored per group */
+	sprintf(handle, "%hu", cache->range.start);
+	g_key_file_set_integer_list(key_file, handle, "DescriptorRanges",
+								ranges, i);
+
+	keyfile_changed(filename);
+
+	g_free(ranges);
+}
+
+static struct char_cache *find_desc_cache(struct btd_device *device,
+						uint16_t start, uint16_t end)
+{
+	GSList *l;
+
+	for (l = device->char_caches; l; l = l->next) {
+		struct char_cache *cache = l->data;
+
+		if (cache->range.start <= start && cache->range.end >= end)
+			return cache;
+	}
+
+	return NULL;
+}
+
+static bool desc_range_cached(struct char_cache *cache, uint16_t start,
+								uint16_t end)
+{
+	GSList *l;
+
+	for (l = cache->desc_ranges; l; l = l->next) {
+		struct att_range *range = l->data;
+
+		if (range->start == start && range->end == end)
+			return true;
+	}
+
+	return false;
+}
+
+static void deliver_descs(GSList *descs, uint16_t start, uint16_t end,
+					gatt_cb_t func, gpointer user_data)
+{
+	GSList *l, *copy = NULL;
+
+	for (l = descs; l; l = l->next) {
+		struct gatt_desc *desc = l->data;
+
+		if (desc->handle < start || desc->handle > end)
+			continue;
+
+		copy = g_slist_prepend(copy, g_memdup(desc, sizeof(*desc)));
+	}
+
+	copy = g_slist_reverse(copy);
+
+	if (copy)
+		func(0, copy, user_data);
+	else
+		func(ATT_ECODE_ATTR_NOT_FOUND, NULL, user_data);
+
+	g_slist_free_full(copy, g_free);
+}
+
+static void desc_discovery_cb(uint8_t status, GSList *descs,
+							void *user_data)
+{
+	struct char_discovery *disc = user_data;
+	struct btd_device *device = disc->device;
+	struct char_cache *cache;
+	struct att_range *range;
+	GSList *l;
+
+	if (device)
+		device->char_discoveries = g_slist_remove(
+					device->char_discoveries, disc);
+
+	/* Not found without descriptors means the range is empty */
+	if (!device || (status && status != ATT_ECODE_ATTR_NOT_FOUND))
+		goto done;
+
+	cache = find_desc_cache(device, disc->range.start, disc->range.end);
+	if (!cache || desc_range_cached(cache, disc->range.start,
+							disc->range.end))
+		goto done;
+
+	range = g_memdup(&disc->range, sizeof(*range));
+	cache->desc_ranges = g_slist_append(cache->desc_ranges, range);
+
+	for (l = descs; l; l = l->next)
+		cache->descs = g_slist_insert_sorted(cache->descs,
+				g_memdup(l->data, sizeof(struct gatt_desc)),
+				desc_handle_cmp);
+
+	store_desc_cache(device, cache);
+
+done:
+	disc->func(status, descs, disc->user_data);
+	g_free(disc);
+}
+
+void btd_device_gatt_discover_desc(struct btd_device *device,
+					uint16_t start, uint16_t end,
+					void (*func) (uint8_t status,
+							GSList *descs,
+							void *user_data),
+					void *user_data)
+{
+	struct char_cache *cache;
+	struct char_discovery *disc;
+
+	cache = find_desc_cache(device, start, end);
+	if (cache && desc_range_cached(cache, start, end)) {
+		DBG("%s using cached descriptors 0x%04x-0x%04x",
+						device->path, start, end);
+		deliver_descs(cache->descs, start, end, func, user_data);
+		return;
+	}
+
+	if (!device->attrib) {
+		func(ATT_ECODE_IO, NULL, user_data);
+		return;
+	}
+
+	/* Only ranges of cached services are cached themselves */
+	if (!cache) {
+		if (gatt_discover_desc(device->attrib, start, end, func,
+							user_data) == 0)
+			func(ATT_ECODE_IO, NULL, user_data);
+
+		return;
+	}
+
+	disc = g_new0(struct char_discovery, 1);
+	disc->device = device;
+	disc->range.start = start;
+	disc->range.end = end;
+	disc->func = func;
+	disc->user_data = user_data;
+
+	if (gatt_discover_desc(device->attrib, start, end, desc_discovery_cb,
+								disc) == 0) {
+		g_free(disc);
+		func(ATT_ECODE_IO, NULL, user_data);
+		return;
+	}
+
+	device->char_discoveries = g_slist_prepend(device->char_discoveries,
+									disc);
+}
+
+void btd_device_gatt_cache_invalidate(struct btd_device *device)
+{
+	char filename[PATH_MAX + 1];
+
+	DBG("%s", device->path);
+
+	g_slist_free_full(device->char_caches, char_cache_free);
+	device->char_caches = NULL;
+
+	char_cache_filename(device, filename);
+	keyfile_discard(filename);
+	unlink(filename);
+
+	/* Rediscover everything the next time the device is connected */
+	device->le_state.svc_resolved = false;
+
+	if (device->attrib)
+		device_browse_primary(device, NULL);
+}
+
 void btd_device_add_uuid(struct btd_device *device, const char *uuid)
 {
 	GSList *uuid_list;
@@ -4650,8 +5690,7 @@ static sdp_list_t *read_device_records(struct btd_device *device)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 	filename[PATH_MAX] = '\0';
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = keyfile_get(filename);
 	keys = g_key_file_get_keys(key_file, "ServiceRecords", NULL, NULL);
 
 	for (handle = keys; handle && *handle; handle++) {
@@ -4666,7 +5705,6 @@ static sdp_list_t *read_device_records(struct btd_device *device)
 	}
 
 	g_strfreev(keys);
-	g_key_file_free(key_file);
 
 	return recs;
 }
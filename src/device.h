@@ -22,6 +22,8 @@
  *
  */
 
+#include "lib/uuid.h"
+
 #define DEVICE_INTERFACE	"org.bluez.Device1"
 
 struct btd_device;
@@ -68,9 +70,33 @@ struct gatt_primary *btd_device_get_primary(struct btd_device *device,
 GSList *btd_device_get_primaries(struct btd_device *device);
 void btd_device_gatt_set_service_changed(struct btd_device *device,
 						uint16_t start, uint16_t end);
+
+/*
+ * Like gatt_discover_char() but served from the persistent attribute cache
+ * if the range is a fully discovered primary service. The callback may be
+ * called before this function returns.
+ */
+void btd_device_gatt_discover_char(struct btd_device *device,
+					uint16_t start, uint16_t end,
+					bt_uuid_t *uuid,
+					void (*func) (uint8_t status,
+							GSList *chars,
+							void *user_data),
+					void *user_data);
+
+/* Same as btd_device_gatt_discover_char() for the descriptors of a range */
+void btd_device_gatt_discover_desc(struct btd_device *device,
+					uint16_t start, uint16_t end,
+					void (*func) (uint8_t status,
+							GSList *descs,
+							void *user_data),
+					void *user_data);
+void btd_device_gatt_cache_invalidate(struct btd_device *device);
 bool device_attach_attrib(struct btd_device *dev, GIOChannel *io);
+void device_att_connected(struct btd_device *device);
 void btd_device_add_uuid(struct btd_device *device, const char *uuid);
-void device_add_eir_uuids(struct btd_device *dev, GSList *uuids);
+void device_add_eir_uuids(struct btd_device *dev, const bt_uuid_t *uuids,
+							unsigned int count);
 void device_probe_profile(gpointer a, gpointer b);
 void device_remove_profile(gpointer a, gpointer b);
 struct btd_adapter *device_get_adapter(struct btd_device *device);
@@ -83,9 +109,14 @@ gboolean device_is_trusted(struct btd_device *device);
 void device_set_paired(struct btd_device *dev, uint8_t bdaddr_type);
 void btd_device_set_temporary(struct btd_device *device, gboolean temporary);
 void btd_device_set_trusted(struct btd_device *device, gboolean trusted);
+void btd_device_set_last_used(struct btd_device *device);
+time_t btd_device_get_last_used(struct btd_device *device);
 void device_set_bonded(struct btd_device *device, uint8_t bdaddr_type);
 void device_set_legacy(struct btd_device *device, bool legacy);
 void device_set_rssi(struct btd_device *device, int8_t rssi);
+bool device_eir_is_known(struct btd_device *device, uint64_t fingerprint);
+void device_set_eir_fingerprint(struct btd_device *device,
+							uint64_t fingerprint);
 bool btd_device_is_connected(struct btd_device *dev);
 uint8_t btd_device_get_bdaddr_type(struct btd_device *dev);
 bool device_is_retrying(struct btd_device *device);
@@ -37,6 +37,7 @@
 #include <bluetooth/hci.h>
 #include <bluetooth/sdp.h>
 
+#include "lib/uuid.h"
 #include "src/shared/util.h"
 #include "uuid-helper.h"
 #include "eir.h"
@@ -45,8 +46,7 @@
 
 void eir_data_free(struct eir_data *eir)
 {
-	g_slist_free_full(eir->services, free);
-	eir->services = NULL;
+	eir->uuid_count = 0;
 	g_free(eir->name);
 	eir->name = NULL;
 	g_free(eir->hash);
@@ -55,22 +55,27 @@ void eir_data_free(struct eir_data *eir)
 	eir->randomizer = NULL;
 }
 
+static bt_uuid_t *eir_next_uuid(struct eir_data *eir)
+{
+	if (eir->uuid_count >= EIR_MAX_UUIDS)
+		return NULL;
+
+	return &eir->uuids[eir->uuid_count++];
+}
+
 static void eir_parse_uuid16(struct eir_data *eir, const void *data,
 								uint8_t len)
 {
 	const uint16_t *uuid16 = data;
-	uuid_t service;
-	char *uuid_str;
+	bt_uuid_t *uuid;
 	unsigned int i;
 
-	service.type = SDP_UUID16;
 	for (i = 0; i < len / 2; i++, uuid16++) {
-		service.value.uuid16 = get_le16(uuid16);
+		uuid = eir_next_uuid(eir);
+		if (!uuid)
+			return;
 
-		uuid_str = bt_uuid2string(&service);
-		if (!uuid_str)
-			continue;
-		eir->services = g_slist_append(eir->services, uuid_str);
+		bt_uuid16_create(uuid, get_le16(uuid16));
 	}
 }
 
@@ -78,18 +83,15 @@ static void eir_parse_uuid32(struct eir_data *eir, const void *data,
 								uint8_t len)
 {
 	const uint32_t *uuid32 = data;
-	uuid_t service;
-	char *uuid_str;
+	bt_uuid_t *uuid;
 	unsigned int i;
 
-	service.type = SDP_UUID32;
 	for (i = 0; i < len / 4; i++, uuid32++) {
-		service.value.uuid32 = get_le32(uuid32);
+		uuid = eir_next_uuid(eir);
+		if (!uuid)
+			return;
 
-		uuid_str = bt_uuid2string(&service);
-		if (!uuid_str)
-			continue;
-		eir->services = g_slist_append(eir->services, uuid_str);
+		bt_uuid32_create(uuid, get_le32(uuid32));
 	}
 }
 
@@ -97,19 +99,21 @@ static void eir_parse_uuid128(struct eir_data *eir, const uint8_t *data,
 								uint8_t len)
 {
 	const uint8_t *uuid_ptr = data;
-	uuid_t service;
-	char *uuid_str;
+	bt_uuid_t *uuid;
+	uint128_t value;
 	unsigned int i;
 	int k;
 
-	service.type = SDP_UUID128;
 	for (i = 0; i < len / 16; i++) {
+		uuid = eir_next_uuid(eir);
+		if (!uuid)
+			return;
+
+		/* EIR data is Little Endian, bt_uuid_t keeps Big Endian */
 		for (k = 0; k < 16; k++)
-			service.value.uuid128.data[k] = uuid_ptr[16 - k - 1];
-		uuid_str = bt_uuid2string(&service);
-		if (!uuid_str)
-			continue;
-		eir->services = g_slist_append(eir->services, uuid_str);
+			value.data[k] = uuid_ptr[16 - k - 1];
+
+		bt_uuid128_create(uuid, value);
 		uuid_ptr += 16;
 	}
 }
@@ -246,6 +250,20 @@ void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
 	}
 }
 
+uint64_t eir_fingerprint(const uint8_t *eir_data, uint8_t eir_len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;	/* FNV-1a offset basis */
+	uint8_t i;
+
+	for (i = 0; i < eir_len; i++) {
+		hash ^= eir_data[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	/* Zero is used for "no fingerprint" */
+	return hash ? hash : 1;
+}
+
 int eir_parse_oob(struct eir_data *eir, uint8_t *eir_data, uint16_t eir_len)
 {
 
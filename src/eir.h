@@ -47,8 +47,12 @@
 #define EIR_SIM_HOST                0x10 /* Simultaneous LE and BR/EDR to Same
 					    Device Capable (Host) */
 
+/* Enough for a maximum length EIR filled with 16-bit UUIDs */
+#define EIR_MAX_UUIDS		128
+
 struct eir_data {
-	GSList *services;
+	bt_uuid_t uuids[EIR_MAX_UUIDS];
+	unsigned int uuid_count;
 	unsigned int flags;
 	char *name;
 	uint32_t class;
@@ -66,6 +70,7 @@ struct eir_data {
 
 void eir_data_free(struct eir_data *eir);
 void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len);
+uint64_t eir_fingerprint(const uint8_t *eir_data, uint8_t eir_len);
 int eir_parse_oob(struct eir_data *eir, uint8_t *eir_data, uint16_t eir_len);
 int eir_create_oob(const bdaddr_t *addr, const char *name, uint32_t cod,
 			const uint8_t *hash, const uint8_t *randomizer,
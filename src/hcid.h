@@ -32,6 +32,9 @@ struct main_opts {
 	gboolean	reverse_sdp;
 	gboolean	name_resolv;
 	gboolean	debug_keys;
+	gboolean	continuous_scan;
+	uint16_t	le_scan_interval;	/* in 0.625 ms units */
+	uint16_t	le_scan_window;		/* in 0.625 ms units */
 
 	uint16_t	did_source;
 	uint16_t	did_vendor;
@@ -0,0 +1,272 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2014  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <bluetooth/bluetooth.h>
+
+#include "lib/uuid.h"
+#include "log.h"
+#include "intern.h"
+
+struct string_entry {
+	unsigned int refs;
+	char str[0];
+};
+
+struct uuid_entry {
+	unsigned int refs;
+	bt_uuid_t uuid;
+	char str[MAX_LEN_UUID_STR + 1];
+};
+
+#define string_entry_of(s) \
+	((struct string_entry *) ((s) - offsetof(struct string_entry, str)))
+#define uuid_entry_of(ptr, member) \
+	((struct uuid_entry *) ((const char *) (ptr) - \
+				offsetof(struct uuid_entry, member)))
+
+static GHashTable *strings = NULL;
+static GHashTable *uuids = NULL;
+
+/*
+ * Bytes the callers would have allocated for private copies, minus the
+ * bytes actually used by the shared entries.
+ */
+static long bytes_requested = 0;
+static long bytes_used = 0;
+
+const char *intern_string(const char *str)
+{
+	struct string_entry *entry;
+	size_t len;
+
+	if (!str)
+		return NULL;
+
+	if (!strings)
+		strings = g_hash_table_new_full(g_str_hash, g_str_equal,
+								NULL, g_free);
+
+	len = strlen(str) + 1;
+
+	entry = g_hash_table_lookup(strings, str);
+	if (!entry) {
+		entry = g_malloc(sizeof(*entry) + len);
+		entry->refs = 0;
+		memcpy(entry->str, str, len);
+		g_hash_table_insert(strings, entry->str, entry);
+		bytes_used += sizeof(*entry) + len;
+	}
+
+	entry->refs++;
+	bytes_requested += len;
+
+	return entry->str;
+}
+
+void intern_string_unref(const char *str)
+{
+	struct string_entry *entry;
+
+	if (!str)
+		return;
+
+	entry = string_entry_of(str);
+
+	bytes_requested -= strlen(str) + 1;
+
+	if (--entry->refs > 0)
+		return;
+
+	bytes_used -= sizeof(*entry) + strlen(str) + 1;
+
+	g_hash_table_remove(strings, entry->str);
+}
+
+static guint uuid128_hash(gconstpointer key)
+{
+	const bt_uuid_t *uuid = key;
+	uint32_t val[4];
+
+	memcpy(val, &uuid->value.u128, sizeof(val));
+
+	return val[0] ^ val[1] ^ val[2] ^ val[3];
+}
+
+static gboolean uuid128_equal(gconstpointer a, gconstpointer b)
+{
+	const bt_uuid_t *u1 = a;
+	const bt_uuid_t *u2 = b;
+
+	return memcmp(&u1->value.u128, &u2->value.u128,
+						sizeof(uint128_t)) == 0;
+}
+
+static struct uuid_entry *uuid_entry_get(const bt_uuid_t *uuid)
+{
+	struct uuid_entry *entry;
+	bt_uuid_t uuid128;
+
+	if (!uuids)
+		uuids = g_hash_table_new_full(uuid128_hash, uuid128_equal,
+								NULL, g_free);
+
+	bt_uuid_to_uuid128(uuid, &uuid128);
+
+	entry = g_hash_table_lookup(uuids, &uuid128);
+	if (entry)
+		return entry;
+
+	entry = g_new0(struct uuid_entry, 1);
+	entry->uuid = uuid128;
+	bt_uuid_to_string(&uuid128, entry->str, sizeof(entry->str));
+
+	g_hash_table_insert(uuids, &entry->uuid, entry);
+	bytes_used += sizeof(*entry);
+
+	return entry;
+}
+
+static void uuid_entry_unref(struct uuid_entry *entry)
+{
+	if (--entry->refs > 0)
+		return;
+
+	bytes_used -= sizeof(*entry);
+
+	g_hash_table_remove(uuids, &entry->uuid);
+}
+
+const char *intern_uuid_str(const char *str)
+{
+	struct uuid_entry *entry;
+	bt_uuid_t uuid;
+
+	if (!str || bt_string_to_uuid(&uuid, str) < 0)
+		return NULL;
+
+	entry = uuid_entry_get(&uuid);
+	entry->refs++;
+	bytes_requested += sizeof(entry->str);
+
+	return entry->str;
+}
+
+void intern_uuid_str_unref(const char *str)
+{
+	struct uuid_entry *entry;
+
+	if (!str)
+		return;
+
+	entry = uuid_entry_of(str, str);
+	bytes_requested -= sizeof(entry->str);
+
+	uuid_entry_unref(entry);
+}
+
+const bt_uuid_t *intern_uuid(const bt_uuid_t *uuid)
+{
+	struct uuid_entry *entry;
+
+	if (!uuid)
+		return NULL;
+
+	entry = uuid_entry_get(uuid);
+	entry->refs++;
+	bytes_requested += sizeof(entry->uuid);
+
+	return &entry->uuid;
+}
+
+void intern_uuid_unref(const bt_uuid_t *uuid)
+{
+	struct uuid_entry *entry;
+
+	if (!uuid)
+		return;
+
+	entry = uuid_entry_of(uuid, uuid);
+	bytes_requested -= sizeof(entry->uuid);
+
+	uuid_entry_unref(entry);
+}
+
+const bt_uuid_t *intern_uuid_str_to_uuid(const char *str)
+{
+	return &uuid_entry_of(str, str)->uuid;
+}
+
+const char *intern_uuid_to_str(const bt_uuid_t *uuid)
+{
+	return uuid_entry_of(uuid, uuid)->str;
+}
+
+const bt_uuid_t *intern_uuid_find(const char *str)
+{
+	struct uuid_entry *entry;
+	bt_uuid_t uuid, uuid128;
+
+	if (!uuids || !str || bt_string_to_uuid(&uuid, str) < 0)
+		return NULL;
+
+	bt_uuid_to_uuid128(&uuid, &uuid128);
+
+	entry = g_hash_table_lookup(uuids, &uuid128);
+	if (!entry)
+		return NULL;
+
+	return &entry->uuid;
+}
+
+long intern_bytes_saved(void)
+{
+	return bytes_requested - bytes_used;
+}
+
+void intern_cleanup(void)
+{
+	DBG("%ld bytes saved, %u strings and %u UUIDs left",
+				intern_bytes_saved(),
+				strings ? g_hash_table_size(strings) : 0,
+				uuids ? g_hash_table_size(uuids) : 0);
+
+	if (strings) {
+		g_hash_table_destroy(strings);
+		strings = NULL;
+	}
+
+	if (uuids) {
+		g_hash_table_destroy(uuids);
+		uuids = NULL;
+	}
+}
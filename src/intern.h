@@ -0,0 +1,53 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2014  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Reference counted tables of shared, immutable strings and UUIDs.
+ *
+ * Every successful intern call takes a reference which has to be dropped
+ * with the matching unref function, passing the returned pointer. UUIDs
+ * are stored once in binary 128-bit form together with their canonical
+ * string, so either form can be handed out and converted without parsing.
+ */
+
+const char *intern_string(const char *str);
+void intern_string_unref(const char *str);
+
+/* Return NULL if str is not a valid UUID */
+const char *intern_uuid_str(const char *str);
+void intern_uuid_str_unref(const char *str);
+
+const bt_uuid_t *intern_uuid(const bt_uuid_t *uuid);
+void intern_uuid_unref(const bt_uuid_t *uuid);
+
+/* Conversions between the two forms of an interned UUID, no reference */
+const bt_uuid_t *intern_uuid_str_to_uuid(const char *str);
+const char *intern_uuid_to_str(const bt_uuid_t *uuid);
+
+/* Interned UUID matching str, NULL if nobody holds a reference to it */
+const bt_uuid_t *intern_uuid_find(const char *str);
+
+/* Memory saved compared to private copies, negative if none is shared */
+long intern_bytes_saved(void);
+
+void intern_cleanup(void);
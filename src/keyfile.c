@@ -0,0 +1,273 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2014  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "log.h"
+#include "textfile.h"
+#include "keyfile.h"
+
+/*
+ * Dirty files are written at most this many seconds after their first
+ * change, no matter how many further changes arrive in the meantime.
+ */
+#define KEYFILE_FLUSH_DELAY	5
+
+struct keyfile {
+	char *filename;
+	GKeyFile *key_file;
+	bool dirty;
+};
+
+static GHashTable *keyfiles = NULL;
+static guint flush_id = 0;
+
+static unsigned int stat_changes = 0;
+static unsigned int stat_writes = 0;
+
+static void keyfile_free(gpointer data)
+{
+	struct keyfile *file = data;
+
+	g_key_file_free(file->key_file);
+	g_free(file->filename);
+	g_free(file);
+}
+
+static void keyfile_write(struct keyfile *file)
+{
+	char *data;
+	gsize length = 0;
+
+	file->dirty = false;
+
+	data = g_key_file_to_data(file->key_file, &length, NULL);
+
+	create_file(file->filename, S_IRUSR | S_IWUSR);
+	if (!g_file_set_contents(file->filename, data, length, NULL))
+		error("Unable to write %s", file->filename);
+
+	g_free(data);
+
+	stat_writes++;
+}
+
+static void write_dirty(gpointer key, gpointer value, gpointer user_data)
+{
+	struct keyfile *file = value;
+
+	if (file->dirty)
+		keyfile_write(file);
+}
+
+void keyfile_flush_all(void)
+{
+	if (!keyfiles)
+		return;
+
+	if (flush_id > 0) {
+		g_source_remove(flush_id);
+		flush_id = 0;
+	}
+
+	g_hash_table_foreach(keyfiles, write_dirty, NULL);
+
+	/*
+	 * Cached contents are only kept around while they are likely to be
+	 * reused, i.e. in between flushes, so that memory usage does not
+	 * grow with the number of files ever touched.
+	 */
+	g_hash_table_remove_all(keyfiles);
+
+	DBG("%u changes coalesced into %u writes", stat_changes, stat_writes);
+}
+
+static gboolean flush_timeout(gpointer user_data)
+{
+	flush_id = 0;
+
+	keyfile_flush_all();
+
+	return FALSE;
+}
+
+static void schedule_flush(void)
+{
+	if (flush_id > 0)
+		return;
+
+	flush_id = g_timeout_add_seconds(KEYFILE_FLUSH_DELAY, flush_timeout,
+									NULL);
+}
+
+static struct keyfile *keyfile_lookup(const char *filename)
+{
+	struct keyfile *file;
+
+	if (!keyfiles)
+		keyfile_init();
+
+	file = g_hash_table_lookup(keyfiles, filename);
+	if (file)
+		return file;
+
+	file = g_new0(struct keyfile, 1);
+	file->filename = g_strdup(filename);
+	file->key_file = g_key_file_new();
+	g_key_file_load_from_file(file->key_file, filename, 0, NULL);
+
+	g_hash_table_insert(keyfiles, file->filename, file);
+
+	schedule_flush();
+
+	return file;
+}
+
+GKeyFile *keyfile_get(const char *filename)
+{
+	return keyfile_lookup(filename)->key_file;
+}
+
+void keyfile_changed(const char *filename)
+{
+	struct keyfile *file = keyfile_lookup(filename);
+
+	file->dirty = true;
+	stat_changes++;
+
+	schedule_flush();
+}
+
+void keyfile_sync(const char *filename)
+{
+	struct keyfile *file;
+
+	if (!keyfiles)
+		return;
+
+	file = g_hash_table_lookup(keyfiles, filename);
+	if (file && file->dirty)
+		keyfile_write(file);
+}
+
+void keyfile_set_string(const char *filename, const char *group,
+					const char *key, const char *value)
+{
+	GKeyFile *key_file = keyfile_get(filename);
+	char *old;
+
+	old = g_key_file_get_string(key_file, group, key, NULL);
+	if (g_strcmp0(old, value)) {
+		g_key_file_set_string(key_file, group, key, value);
+		keyfile_changed(filename);
+	}
+
+	g_free(old);
+}
+
+void keyfile_set_integer(const char *filename, const char *group,
+					const char *key, int value)
+{
+	GKeyFile *key_file = keyfile_get(filename);
+	GError *gerr = NULL;
+	int old;
+
+	old = g_key_file_get_integer(key_file, group, key, &gerr);
+	if (!gerr && old == value)
+		return;
+
+	g_clear_error(&gerr);
+
+	g_key_file_set_integer(key_file, group, key, value);
+	keyfile_changed(filename);
+}
+
+void keyfile_set_boolean(const char *filename, const char *group,
+					const char *key, gboolean value)
+{
+	GKeyFile *key_file = keyfile_get(filename);
+	GError *gerr = NULL;
+	gboolean old;
+
+	old = g_key_file_get_boolean(key_file, group, key, &gerr);
+	if (!gerr && old == value)
+		return;
+
+	g_clear_error(&gerr);
+
+	g_key_file_set_boolean(key_file, group, key, value);
+	keyfile_changed(filename);
+}
+
+void keyfile_discard(const char *filename)
+{
+	if (!keyfiles)
+		return;
+
+	g_hash_table_remove(keyfiles, filename);
+}
+
+static gboolean match_dir(gpointer key, gpointer value, gpointer user_data)
+{
+	const char *filename = key;
+	const char *dirname = user_data;
+	size_t len = strlen(dirname);
+
+	return strncmp(filename, dirname, len) == 0 && filename[len] == '/';
+}
+
+void keyfile_discard_dir(const char *dirname)
+{
+	if (!keyfiles)
+		return;
+
+	g_hash_table_foreach_remove(keyfiles, match_dir, (gpointer) dirname);
+}
+
+void keyfile_init(void)
+{
+	if (keyfiles)
+		return;
+
+	keyfiles = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+								keyfile_free);
+}
+
+void keyfile_cleanup(void)
+{
+	if (!keyfiles)
+		return;
+
+	keyfile_flush_all();
+
+	g_hash_table_destroy(keyfiles);
+	keyfiles = NULL;
+}
@@ -0,0 +1,53 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2014  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Write-behind cache of the GKeyFile based storage files.
+ *
+ * keyfile_get() returns the cached, parsed contents of a file (empty if
+ * the file does not exist). The returned key file is owned by the cache
+ * and stays valid until control returns to the main loop. After changing
+ * it call keyfile_changed() to have the file written on the next flush,
+ * or keyfile_sync() if the change must reach the disk right away.
+ */
+
+GKeyFile *keyfile_get(const char *filename);
+void keyfile_changed(const char *filename);
+void keyfile_sync(const char *filename);
+
+/* Setters which only mark the file dirty if the value really changed */
+void keyfile_set_string(const char *filename, const char *group,
+					const char *key, const char *value);
+void keyfile_set_integer(const char *filename, const char *group,
+					const char *key, int value);
+void keyfile_set_boolean(const char *filename, const char *group,
+					const char *key, gboolean value);
+
+/* Drop cached state of files which are about to be removed from disk */
+void keyfile_discard(const char *filename);
+void keyfile_discard_dir(const char *dirname);
+
+void keyfile_flush_all(void);
+
+void keyfile_init(void);
+void keyfile_cleanup(void);
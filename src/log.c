@@ -27,7 +27,11 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <syslog.h>
+#include <time.h>
 
 #include <glib.h>
 
@@ -77,6 +81,58 @@ void btd_debug(const char *format, ...)
 	va_end(ap);
 }
 
+/*
+ * Debug messages which are not printed can be recorded into an in-memory
+ * ring instead. Only the format pointer, a timestamp and the raw argument
+ * values are stored, formatting happens when the ring is dumped. The
+ * daemon is single threaded, so the ring does not need any locking.
+ */
+#define TRACE_RING_SIZE		(256 * 1024)
+#define TRACE_RECORD_MAX	256
+#define TRACE_SPEC_MAX		32
+
+struct trace_record {
+	const char *format;
+	const char *file;
+	const char *func;
+	uint64_t timestamp;		/* CLOCK_MONOTONIC in ns */
+	uint16_t size;			/* Including this header */
+	uint16_t args;			/* Arguments recorded */
+	uint32_t truncated;		/* Not all arguments fit */
+};
+
+union trace_arg {
+	int64_t i;
+	double d;
+	const void *p;
+};
+
+enum trace_type {
+	TRACE_NONE,
+	TRACE_INT,
+	TRACE_LONG,
+	TRACE_LLONG,
+	TRACE_SIZE,
+	TRACE_INTMAX,
+	TRACE_PTRDIFF,
+	TRACE_DOUBLE,
+	TRACE_LDOUBLE,
+	TRACE_PTR,
+	TRACE_STR,
+};
+
+struct trace_spec {
+	const char *start;		/* The '%' of the conversion */
+	const char *end;
+	unsigned int stars;		/* '*' width and precision */
+	int precision;			/* -1 if none, -2 if '*' */
+	enum trace_type type;
+};
+
+static uint8_t *trace_ring = NULL;
+static uint64_t trace_head = 0;
+static uint64_t trace_tail = 0;
+
 extern struct btd_debug_desc __start___debug[];
 extern struct btd_debug_desc __stop___debug[];
 
@@ -108,7 +164,508 @@ void __btd_enable_debug(struct btd_debug_desc *start,
 	for (desc = start; desc < stop; desc++) {
 		if (is_enabled(desc))
 			desc->flags |= BTD_DEBUG_FLAG_PRINT;
+
+		if (trace_ring != NULL)
+			desc->flags |= BTD_DEBUG_FLAG_TRACE;
+	}
+}
+
+/* Parse the conversion following the '%' at p */
+static const char *parse_spec(const char *p, struct trace_spec *spec)
+{
+	enum { LEN_NONE, LEN_L, LEN_LL, LEN_Z, LEN_J, LEN_T, LEN_BIG_L } len;
+
+	spec->start = p++;
+	spec->stars = 0;
+	spec->precision = -1;
+	spec->type = TRACE_NONE;
+
+	while (*p != '\0' && strchr("-+ #0'", *p))
+		p++;
+
+	if (*p == '*') {
+		spec->stars++;
+		p++;
+	} else {
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+
+	if (*p == '.') {
+		p++;
+
+		if (*p == '*') {
+			spec->stars++;
+			spec->precision = -2;
+			p++;
+		} else {
+			spec->precision = 0;
+			while (*p >= '0' && *p <= '9')
+				spec->precision = spec->precision * 10 +
+								*p++ - '0';
+		}
+	}
+
+	len = LEN_NONE;
+
+	switch (*p) {
+	case 'h':
+		while (*p == 'h')
+			p++;
+		break;
+	case 'l':
+		p++;
+		len = LEN_L;
+		if (*p == 'l') {
+			p++;
+			len = LEN_LL;
+		}
+		break;
+	case 'q':
+		p++;
+		len = LEN_LL;
+		break;
+	case 'z':
+		p++;
+		len = LEN_Z;
+		break;
+	case 'j':
+		p++;
+		len = LEN_J;
+		break;
+	case 't':
+		p++;
+		len = LEN_T;
+		break;
+	case 'L':
+		p++;
+		len = LEN_BIG_L;
+		break;
+	}
+
+	switch (*p) {
+	case 'd':
+	case 'i':
+	case 'u':
+	case 'x':
+	case 'X':
+	case 'o':
+	case 'c':
+		if (len == LEN_L)
+			spec->type = TRACE_LONG;
+		else if (len == LEN_LL)
+			spec->type = TRACE_LLONG;
+		else if (len == LEN_Z)
+			spec->type = TRACE_SIZE;
+		else if (len == LEN_J)
+			spec->type = TRACE_INTMAX;
+		else if (len == LEN_T)
+			spec->type = TRACE_PTRDIFF;
+		else
+			spec->type = TRACE_INT;
+		break;
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		if (len == LEN_BIG_L)
+			spec->type = TRACE_LDOUBLE;
+		else
+			spec->type = TRACE_DOUBLE;
+		break;
+	case 'p':
+		spec->type = TRACE_PTR;
+		break;
+	case 's':
+		spec->type = TRACE_STR;
+		break;
+	case '%':
+	case '\0':
+		spec->stars = 0;
+		break;
+	}
+
+	if (*p != '\0')
+		p++;
+
+	spec->end = p;
+
+	return p;
+}
+
+static void trace_ring_read(uint64_t offset, void *data, size_t len)
+{
+	size_t pos = offset % TRACE_RING_SIZE;
+	size_t first = MIN(len, TRACE_RING_SIZE - pos);
+
+	memcpy(data, trace_ring + pos, first);
+	memcpy((uint8_t *) data + first, trace_ring, len - first);
+}
+
+static void trace_ring_write(const void *data, size_t len)
+{
+	size_t pos = trace_head % TRACE_RING_SIZE;
+	size_t first = MIN(len, TRACE_RING_SIZE - pos);
+
+	/* Drop the oldest records to make room */
+	while (trace_head + len - trace_tail > TRACE_RING_SIZE) {
+		struct trace_record rec;
+
+		trace_ring_read(trace_tail, &rec, sizeof(rec));
+		trace_tail += rec.size;
+	}
+
+	memcpy(trace_ring + pos, data, first);
+	memcpy(trace_ring, (const uint8_t *) data + first, len - first);
+
+	trace_head += len;
+}
+
+void btd_trace(const struct btd_debug_desc *desc, const char *func,
+						const char *format, ...)
+{
+	uint64_t buf[TRACE_RECORD_MAX / sizeof(uint64_t)];
+	struct trace_record *rec = (struct trace_record *) buf;
+	uint8_t *data = (uint8_t *) buf;
+	size_t off = sizeof(*rec);
+	struct trace_spec spec;
+	struct timespec ts;
+	const char *p;
+	va_list ap;
+
+	if (trace_ring == NULL)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	rec->format = format;
+	rec->file = desc->file;
+	rec->func = func;
+	rec->timestamp = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	rec->args = 0;
+	rec->truncated = 0;
+
+	va_start(ap, format);
+
+	for (p = format; *p != '\0';) {
+		union trace_arg arg = { 0 };
+		unsigned int i;
+		int star = 0;
+		const char *str;
+		size_t len;
+
+		if (*p != '%') {
+			p++;
+			continue;
+		}
+
+		p = parse_spec(p, &spec);
+		if (spec.type == TRACE_NONE)
+			continue;
+
+		if (off + (spec.stars + 1) * sizeof(arg) > sizeof(buf)) {
+			rec->truncated = 1;
+			break;
+		}
+
+		for (i = 0; i < spec.stars; i++) {
+			star = va_arg(ap, int);
+			arg.i = star;
+			memcpy(data + off, &arg, sizeof(arg));
+			off += sizeof(arg);
+		}
+
+		/* The last '*' is the precision if it was given as one */
+		if (spec.precision == -2)
+			spec.precision = star < 0 ? -1 : star;
+
+		switch (spec.type) {
+		case TRACE_NONE:
+			continue;
+		case TRACE_INT:
+			arg.i = va_arg(ap, int);
+			break;
+		case TRACE_LONG:
+			arg.i = va_arg(ap, long);
+			break;
+		case TRACE_LLONG:
+			arg.i = va_arg(ap, long long);
+			break;
+		case TRACE_SIZE:
+			arg.i = va_arg(ap, size_t);
+			break;
+		case TRACE_INTMAX:
+			arg.i = va_arg(ap, intmax_t);
+			break;
+		case TRACE_PTRDIFF:
+			arg.i = va_arg(ap, ptrdiff_t);
+			break;
+		case TRACE_DOUBLE:
+			arg.d = va_arg(ap, double);
+			break;
+		case TRACE_LDOUBLE:
+			arg.d = va_arg(ap, long double);
+			break;
+		case TRACE_PTR:
+			arg.p = va_arg(ap, void *);
+			break;
+		case TRACE_STR:
+			/* Strings are copied, padded to the argument size */
+			str = va_arg(ap, const char *);
+			if (str == NULL)
+				str = "(null)";
+
+			/* A precision allows strings without terminator */
+			len = sizeof(buf) - off - 1;
+			if (spec.precision >= 0 &&
+					(size_t) spec.precision < len)
+				len = spec.precision;
+			else if (strnlen(str, len + 1) > len)
+				rec->truncated = 1;
+
+			len = strnlen(str, len);
+
+			memcpy(data + off, str, len);
+			memset(data + off + len, 0, sizeof(arg) -
+							len % sizeof(arg));
+			off += len - len % sizeof(arg) + sizeof(arg);
+			rec->args += spec.stars + 1;
+			continue;
+		}
+
+		memcpy(data + off, &arg, sizeof(arg));
+		off += sizeof(arg);
+		rec->args += spec.stars + 1;
+	}
+
+	va_end(ap);
+
+	rec->size = off;
+
+	trace_ring_write(buf, off);
+}
+
+static size_t format_spec(char *out, size_t size, const struct trace_spec *spec,
+					const uint8_t *data, size_t *off)
+{
+	char fmt[TRACE_SPEC_MAX];
+	union trace_arg arg, star[2];
+	const char *p;
+	size_t len;
+	unsigned int i;
+	int n = 0;
+
+	for (i = 0; i < spec->stars; i++) {
+		memcpy(&star[i], data + *off, sizeof(arg));
+		*off += sizeof(arg);
+	}
+
+	/* Replace '*' with the recorded values */
+	len = 0;
+	i = 0;
+	for (p = spec->start; p < spec->end && len < sizeof(fmt) - 12; p++) {
+		if (*p != '*') {
+			fmt[len++] = *p;
+			continue;
+		}
+
+		if (p[-1] != '.')
+			len += sprintf(fmt + len, "%d", (int) star[i].i);
+		else if (star[i].i >= 0)
+			len += sprintf(fmt + len, "%d", (int) star[i].i);
+		else
+			len--;
+
+		i++;
+	}
+
+	fmt[len] = '\0';
+
+	if (spec->type == TRACE_STR) {
+		const char *str = (const char *) (data + *off);
+
+		len = strlen(str);
+		*off += len - len % sizeof(arg) + sizeof(arg);
+
+		return snprintf(out, size, fmt, str);
+	}
+
+	memcpy(&arg, data + *off, sizeof(arg));
+	*off += sizeof(arg);
+
+	switch (spec->type) {
+	case TRACE_NONE:
+		break;
+	case TRACE_INT:
+		n = snprintf(out, size, fmt, (int) arg.i);
+		break;
+	case TRACE_LONG:
+		n = snprintf(out, size, fmt, (long) arg.i);
+		break;
+	case TRACE_LLONG:
+		n = snprintf(out, size, fmt, (long long) arg.i);
+		break;
+	case TRACE_SIZE:
+		n = snprintf(out, size, fmt, (size_t) arg.i);
+		break;
+	case TRACE_INTMAX:
+		n = snprintf(out, size, fmt, (intmax_t) arg.i);
+		break;
+	case TRACE_PTRDIFF:
+		n = snprintf(out, size, fmt, (ptrdiff_t) arg.i);
+		break;
+	case TRACE_DOUBLE:
+		n = snprintf(out, size, fmt, arg.d);
+		break;
+	case TRACE_LDOUBLE:
+		n = snprintf(out, size, fmt, (long double) arg.d);
+		break;
+	case TRACE_PTR:
+		n = snprintf(out, size, fmt, arg.p);
+		break;
+	case TRACE_STR:
+		break;
+	}
+
+	return n;
+}
+
+static void trace_format(const struct trace_record *rec, const uint8_t *data,
+						char *out, size_t size)
+{
+	struct trace_spec spec;
+	size_t off = sizeof(*rec);
+	size_t len = 0;
+	unsigned int args = 0;
+	const char *p;
+
+	for (p = rec->format; *p != '\0' && len < size - 1;) {
+		const char *start = p;
+
+		if (*p != '%') {
+			out[len++] = *p++;
+			continue;
+		}
+
+		p = parse_spec(p, &spec);
+
+		if (spec.type == TRACE_NONE) {
+			if (p - start == 2 && start[1] == '%') {
+				out[len++] = '%';
+				continue;
+			}
+
+			/* Unknown conversions are copied as is */
+			for (; start < p && len < size - 1; start++)
+				out[len++] = *start;
+			continue;
+		}
+
+		if (args + spec.stars + 1 > rec->args)
+			break;
+
+		len += format_spec(out + len, size - len, &spec, data, &off);
+		len = MIN(len, size - 1);
+		args += spec.stars + 1;
 	}
+
+	out[len] = '\0';
+
+	if (rec->truncated && len + 4 < size)
+		strcpy(out + len, " ...");
+}
+
+void __btd_trace_dump(void)
+{
+	uint64_t buf[TRACE_RECORD_MAX / sizeof(uint64_t)];
+	struct trace_record *rec = (struct trace_record *) buf;
+	char line[1024];
+	uint64_t offset;
+	unsigned int count = 0;
+
+	if (trace_ring == NULL)
+		return;
+
+	syslog(LOG_INFO, "Trace dump start");
+
+	for (offset = trace_tail; offset < trace_head; offset += rec->size) {
+		trace_ring_read(offset, rec, sizeof(*rec));
+		trace_ring_read(offset, buf, rec->size);
+
+		trace_format(rec, (const uint8_t *) buf, line, sizeof(line));
+
+		syslog(LOG_INFO, "[%lu.%06lu] %s:%s() %s",
+				(unsigned long) (rec->timestamp / 1000000000),
+				(unsigned long) (rec->timestamp % 1000000000
+								/ 1000),
+				rec->file, rec->func, line);
+		count++;
+	}
+
+	syslog(LOG_INFO, "Trace dump end, %u records", count);
+}
+
+struct stats_provider {
+	btd_stats_func_t func;
+	void *user_data;
+};
+
+static GSList *stats_providers = NULL;
+
+void btd_stats_register(btd_stats_func_t func, void *user_data)
+{
+	struct stats_provider *provider;
+
+	provider = g_new0(struct stats_provider, 1);
+	provider->func = func;
+	provider->user_data = user_data;
+
+	stats_providers = g_slist_append(stats_providers, provider);
+}
+
+void btd_stats_unregister(btd_stats_func_t func, void *user_data)
+{
+	GSList *l;
+
+	for (l = stats_providers; l; l = l->next) {
+		struct stats_provider *provider = l->data;
+
+		if (provider->func == func && provider->user_data == user_data) {
+			stats_providers = g_slist_delete_link(stats_providers,
+									l);
+			g_free(provider);
+			return;
+		}
+	}
+}
+
+void __btd_stats_dump(void)
+{
+	GSList *l;
+
+	syslog(LOG_INFO, "Statistics dump start");
+
+	for (l = stats_providers; l; l = l->next) {
+		struct stats_provider *provider = l->data;
+
+		provider->func(provider->user_data);
+	}
+
+	syslog(LOG_INFO, "Statistics dump end");
+}
+
+void __btd_trace_init(void)
+{
+	if (trace_ring != NULL)
+		return;
+
+	trace_ring = g_malloc(TRACE_RING_SIZE);
+
+	__btd_enable_debug(__start___debug, __stop___debug);
 }
 
 void __btd_toggle_debug(void)
@@ -138,6 +695,12 @@ void __btd_log_init(const char *debug, int detach)
 
 void __btd_log_cleanup(void)
 {
+	g_free(trace_ring);
+	trace_ring = NULL;
+
+	g_slist_free_full(stats_providers, g_free);
+	stats_providers = NULL;
+
 	closelog();
 
 	g_strfreev(enabled);
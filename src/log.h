@@ -35,9 +35,27 @@ struct btd_debug_desc {
 	const char *file;
 #define BTD_DEBUG_FLAG_DEFAULT (0)
 #define BTD_DEBUG_FLAG_PRINT   (1 << 0)
+#define BTD_DEBUG_FLAG_TRACE   (1 << 1)
 	unsigned int flags;
 } __attribute__((aligned(8)));
 
+/* The format is checked through the btd_debug() call in DBG() */
+void btd_trace(const struct btd_debug_desc *desc, const char *func,
+						const char *format, ...);
+
+void __btd_trace_init(void);
+void __btd_trace_dump(void);
+
+/*
+ * Statistics providers, called to log their counters with info() when
+ * bluetoothd receives SIGUSR1.
+ */
+typedef void (*btd_stats_func_t) (void *user_data);
+
+void btd_stats_register(btd_stats_func_t func, void *user_data);
+void btd_stats_unregister(btd_stats_func_t func, void *user_data);
+void __btd_stats_dump(void);
+
 void __btd_enable_debug(struct btd_debug_desc *start,
 					struct btd_debug_desc *stop);
 
@@ -47,7 +65,8 @@ void __btd_enable_debug(struct btd_debug_desc *start,
  * @arg...: list of arguments
  *
  * Simple macro around btd_debug() which also include the function
- * name it is called in.
+ * name it is called in. Messages that are not printed are recorded with
+ * btd_trace() if tracing is enabled.
  */
 #define DBG(fmt, arg...) do { \
 	static struct btd_debug_desc __btd_debug_desc \
@@ -56,4 +75,6 @@ void __btd_enable_debug(struct btd_debug_desc *start,
 	}; \
 	if (__btd_debug_desc.flags & BTD_DEBUG_FLAG_PRINT) \
 		btd_debug("%s:%s() " fmt,  __FILE__, __func__ , ## arg); \
+	else if (__btd_debug_desc.flags & BTD_DEBUG_FLAG_TRACE) \
+		btd_trace(&__btd_debug_desc, __func__, fmt , ## arg); \
 } while (0)
@@ -57,6 +57,8 @@
 #include "profile.h"
 #include "gatt.h"
 #include "systemd.h"
+#include "keyfile.h"
+#include "intern.h"
 
 #define BLUEZ_NAME "org.bluez"
 
@@ -77,6 +79,10 @@ static const char * const supported_options[] = {
 	"ReverseServiceDiscovery",
 	"NameResolving",
 	"DebugKeys",
+	"PropertyRateLimit",
+	"ContinuousScan",
+	"LEScanInterval",
+	"LEScanWindow",
 };
 
 static GKeyFile *load_config(const char *file)
@@ -131,6 +137,80 @@ done:
 	main_opts.did_version = version;
 }
 
+static void parse_rate_limit(const char *limit)
+{
+	char *interface, *name, *sep;
+	unsigned int interval;
+
+	sep = strrchr(limit, ':');
+	if (!sep || sscanf(sep + 1, "%u", &interval) != 1)
+		goto invalid;
+
+	interface = g_strndup(limit, sep - limit);
+	g_strstrip(interface);
+
+	sep = strrchr(interface, '.');
+	if (!sep || sep == interface || *(sep + 1) == '\0') {
+		g_free(interface);
+		goto invalid;
+	}
+
+	*sep = '\0';
+	name = sep + 1;
+
+	DBG("rate limit %s.%s %u ms", interface, name, interval);
+
+	g_dbus_set_property_rate_limit(interface,
+				g_str_equal(name, "*") ? NULL : name, interval);
+
+	g_free(interface);
+	return;
+
+invalid:
+	warn("Invalid PropertyRateLimit entry %s in main.conf", limit);
+}
+
+/* Scan interval and window are configured in ms, valid range 2.5 - 10240 */
+static uint16_t parse_scan_time(GKeyFile *config, const char *key)
+{
+	GError *err = NULL;
+	double val;
+
+	val = g_key_file_get_double(config, "General", key, &err);
+	if (err) {
+		g_clear_error(&err);
+		return 0;
+	}
+
+	if (val < 2.5 || val > 10240) {
+		warn("Invalid %s %.3f ms in main.conf", key, val);
+		return 0;
+	}
+
+	return val / 0.625;
+}
+
+static void parse_scan_params(GKeyFile *config)
+{
+	uint16_t interval, window;
+
+	interval = parse_scan_time(config, "LEScanInterval");
+	window = parse_scan_time(config, "LEScanWindow");
+
+	if (!interval || !window)
+		return;
+
+	if (window > interval) {
+		warn("LEScanWindow larger than LEScanInterval in main.conf");
+		return;
+	}
+
+	DBG("le scan interval %u window %u", interval, window);
+
+	main_opts.le_scan_interval = interval;
+	main_opts.le_scan_window = window;
+}
+
 static void check_config(GKeyFile *config)
 {
 	char **keys;
@@ -172,7 +252,7 @@ static void check_config(GKeyFile *config)
 static void parse_config(GKeyFile *config)
 {
 	GError *err = NULL;
-	char *str;
+	char *str, **strlist;
 	int val;
 	gboolean boolean;
 
@@ -264,6 +344,28 @@ static void parse_config(GKeyFile *config)
 		g_clear_error(&err);
 	else
 		main_opts.debug_keys = boolean;
+
+	boolean = g_key_file_get_boolean(config, "General",
+						"ContinuousScan", &err);
+	if (err)
+		g_clear_error(&err);
+	else
+		main_opts.continuous_scan = boolean;
+
+	parse_scan_params(config);
+
+	strlist = g_key_file_get_string_list(config, "General",
+						"PropertyRateLimit", NULL, &err);
+	if (err) {
+		g_clear_error(&err);
+	} else {
+		int i;
+
+		for (i = 0; strlist[i]; i++)
+			parse_rate_limit(strlist[i]);
+
+		g_strfreev(strlist);
+	}
 }
 
 static void init_defaults(void)
@@ -333,6 +435,10 @@ static gboolean signal_handler(GIOChannel *channel, GIOCondition cond,
 
 		__terminated = 1;
 		break;
+	case SIGUSR1:
+		__btd_trace_dump();
+		__btd_stats_dump();
+		break;
 	case SIGUSR2:
 		__btd_toggle_debug();
 		break;
@@ -351,6 +457,7 @@ static guint setup_signalfd(void)
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
 	sigaddset(&mask, SIGUSR2);
 
 	if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
@@ -384,6 +491,7 @@ static char *option_plugin = NULL;
 static char *option_noplugin = NULL;
 static gboolean option_compat = FALSE;
 static gboolean option_detach = TRUE;
+static gboolean option_trace = TRUE;
 static gboolean option_version = FALSE;
 static gboolean option_experimental = FALSE;
 
@@ -476,6 +584,9 @@ static GOptionEntry options[] = {
 	{ "nodetach", 'n', G_OPTION_FLAG_REVERSE,
 				G_OPTION_ARG_NONE, &option_detach,
 				"Run with logging in foreground" },
+	{ "notrace", 'T', G_OPTION_FLAG_REVERSE,
+				G_OPTION_ARG_NONE, &option_trace,
+				"Disable in-memory tracing of debug messages" },
 	{ "version", 'v', 0, G_OPTION_ARG_NONE, &option_version,
 				"Show version information and exit" },
 	{ NULL },
@@ -521,6 +632,9 @@ int main(int argc, char *argv[])
 
 	__btd_log_init(option_debug, option_detach);
 
+	if (option_trace)
+		__btd_trace_init();
+
 	sd_notify(0, "STATUS=Starting up");
 
 	config = load_config(CONFIGDIR "/main.conf");
@@ -539,6 +653,8 @@ int main(int argc, char *argv[])
 
 	gatt_init();
 
+	keyfile_init();
+
 	if (adapter_init() < 0) {
 		error("Adapter handling initialization failed");
 		exit(1);
@@ -601,6 +717,10 @@ int main(int argc, char *argv[])
 
 	adapter_cleanup();
 
+	keyfile_cleanup();
+
+	intern_cleanup();
+
 	gatt_cleanup();
 
 	rfkill_exit();
@@ -44,6 +44,7 @@
 #include "log.h"
 #include "error.h"
 #include "uuid-helper.h"
+#include "intern.h"
 #include "dbus-common.h"
 #include "sdp-client.h"
 #include "sdp-xml.h"
@@ -644,6 +645,120 @@ static GSList *custom_props = NULL;
 static GSList *profiles = NULL;
 static GSList *ext_profiles = NULL;
 
+/*
+ * Registered profiles indexed by their remote UUID. The keys are interned
+ * binary UUIDs so lookups only hash a pointer.
+ */
+struct profile_index {
+	struct btd_profile *profile;
+	unsigned int seq;		/* Registration order */
+};
+
+static GHashTable *uuid_index = NULL;
+static unsigned int index_seq = 0;
+
+static void uuid_index_add(struct btd_profile *profile)
+{
+	struct profile_index *entry;
+	const char *str;
+	const bt_uuid_t *key;
+	GSList *list;
+
+	str = intern_uuid_str(profile->remote_uuid);
+	if (!str)
+		return;
+
+	key = intern_uuid_str_to_uuid(str);
+
+	if (!uuid_index)
+		uuid_index = g_hash_table_new(NULL, NULL);
+
+	entry = g_new0(struct profile_index, 1);
+	entry->profile = profile;
+	entry->seq = index_seq++;
+
+	/* Each entry holds a reference to the interned UUID */
+	list = g_hash_table_lookup(uuid_index, key);
+	list = g_slist_append(list, entry);
+
+	g_hash_table_insert(uuid_index, (gpointer) key, list);
+}
+
+static void uuid_index_remove(struct btd_profile *profile)
+{
+	const bt_uuid_t *key;
+	GSList *list, *l;
+
+	if (!uuid_index)
+		return;
+
+	key = intern_uuid_find(profile->remote_uuid);
+	if (!key)
+		return;
+
+	list = g_hash_table_lookup(uuid_index, key);
+
+	for (l = list; l; l = g_slist_next(l)) {
+		struct profile_index *entry = l->data;
+
+		if (entry->profile != profile)
+			continue;
+
+		list = g_slist_delete_link(list, l);
+		g_free(entry);
+		break;
+	}
+
+	if (list)
+		g_hash_table_insert(uuid_index, (gpointer) key, list);
+	else
+		g_hash_table_remove(uuid_index, key);
+
+	intern_uuid_str_unref(intern_uuid_to_str(key));
+}
+
+static int index_seq_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct profile_index *e1 = a;
+	const struct profile_index *e2 = b;
+
+	return e1->seq - e2->seq;
+}
+
+void btd_profile_foreach_uuid(GSList *uuids,
+				void (*func)(struct btd_profile *p, void *data),
+				void *data)
+{
+	GSList *matches = NULL, *l;
+
+	if (!uuid_index)
+		return;
+
+	for (; uuids; uuids = g_slist_next(uuids)) {
+		const bt_uuid_t *key = intern_uuid_find(uuids->data);
+
+		if (!key)
+			continue;
+
+		l = g_hash_table_lookup(uuid_index, key);
+		for (; l; l = g_slist_next(l)) {
+			if (!g_slist_find(matches, l->data))
+				matches = g_slist_prepend(matches, l->data);
+		}
+	}
+
+	/* Keep the order btd_profile_foreach() would use */
+	matches = g_slist_sort(matches, index_seq_cmp);
+
+	for (l = matches; l; l = g_slist_next(l)) {
+		struct profile_index *entry = l->data;
+
+		func(entry->profile, data);
+	}
+
+	g_slist_free(matches);
+}
+
 void btd_profile_foreach(void (*func)(struct btd_profile *p, void *data),
 								void *data)
 {
@@ -669,12 +784,14 @@ void btd_profile_foreach(void (*func)(struct btd_profile *p, void *data),
 int btd_profile_register(struct btd_profile *profile)
 {
 	profiles = g_slist_append(profiles, profile);
+	uuid_index_add(profile);
 	return 0;
 }
 
 void btd_profile_unregister(struct btd_profile *profile)
 {
 	profiles = g_slist_remove(profiles, profile);
+	uuid_index_remove(profile);
 }
 
 static struct ext_profile *find_ext_profile(const char *owner,
@@ -2224,6 +2341,7 @@ static struct ext_profile *create_ext(const char *owner, const char *path,
 	DBG("Created \"%s\"", ext->name);
 
 	ext_profiles = g_slist_append(ext_profiles, ext);
+	uuid_index_add(&ext->p);
 
 	adapter_foreach(adapter_add_profile, &ext->p);
 
@@ -2235,6 +2353,7 @@ static void remove_ext(struct ext_profile *ext)
 	adapter_foreach(adapter_remove_profile, &ext->p);
 
 	ext_profiles = g_slist_remove(ext_profiles, ext);
+	uuid_index_remove(&ext->p);
 
 	DBG("Removed \"%s\"", ext->name);
 
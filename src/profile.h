@@ -51,6 +51,11 @@ struct btd_profile {
 void btd_profile_foreach(void (*func)(struct btd_profile *p, void *data),
 								void *data);
 
+/* Like btd_profile_foreach() but only for profiles matching one of uuids */
+void btd_profile_foreach_uuid(GSList *uuids,
+				void (*func)(struct btd_profile *p, void *data),
+				void *data);
+
 int btd_profile_register(struct btd_profile *profile);
 void btd_profile_unregister(struct btd_profile *profile);
 
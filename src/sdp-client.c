@@ -113,6 +113,7 @@ struct search_context {
 	bt_destroy_t		destroy;
 	gpointer		user_data;
 	uuid_t			uuid;
+	uint32_t		range;
 	guint			io_id;
 };
 
@@ -209,7 +210,6 @@ static gboolean connect_watch(GIOChannel *chan, GIOCondition cond,
 {
 	struct search_context *ctxt = user_data;
 	sdp_list_t *search, *attrids;
-	uint32_t range = 0x0000ffff;
 	socklen_t len;
 	int sk, err, sk_err = 0;
 
@@ -231,7 +231,7 @@ static gboolean connect_watch(GIOChannel *chan, GIOCondition cond,
 	}
 
 	search = sdp_list_append(NULL, &ctxt->uuid);
-	attrids = sdp_list_append(NULL, &range);
+	attrids = sdp_list_append(NULL, &ctxt->range);
 	if (sdp_service_search_attr_async(ctxt->session,
 				search, SDP_ATTR_REQ_RANGE, attrids) < 0) {
 		sdp_list_free(attrids, NULL);
@@ -309,20 +309,22 @@ static int create_search_context(struct search_context **ctxt,
 	return 0;
 }
 
-int bt_search_service(const bdaddr_t *src, const bdaddr_t *dst,
-			uuid_t *uuid, bt_callback_t cb, void *user_data,
+int bt_search(const bdaddr_t *src, const bdaddr_t *dst, uuid_t *uuid,
+			uint16_t attr_start, uint16_t attr_end,
+			bt_callback_t cb, void *user_data,
 			bt_destroy_t destroy, uint16_t flags)
 {
 	struct search_context *ctxt = NULL;
 	int err;
 
-	if (!cb)
+	if (!cb || attr_start > attr_end)
 		return -EINVAL;
 
 	err = create_search_context(&ctxt, src, dst, uuid, flags);
 	if (err < 0)
 		return err;
 
+	ctxt->range	= (attr_start << 16) | attr_end;
 	ctxt->cb	= cb;
 	ctxt->destroy	= destroy;
 	ctxt->user_data	= user_data;
@@ -332,6 +334,14 @@ int bt_search_service(const bdaddr_t *src, const bdaddr_t *dst,
 	return 0;
 }
 
+int bt_search_service(const bdaddr_t *src, const bdaddr_t *dst,
+			uuid_t *uuid, bt_callback_t cb, void *user_data,
+			bt_destroy_t destroy, uint16_t flags)
+{
+	return bt_search(src, dst, uuid, 0x0000, 0xffff, cb, user_data,
+							destroy, flags);
+}
+
 static int find_by_bdaddr(gconstpointer data, gconstpointer user_data)
 {
 	const struct search_context *ctxt = data, *search = user_data;
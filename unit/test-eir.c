@@ -33,6 +33,7 @@
 #include <bluetooth/hci.h>
 #include <bluetooth/sdp.h>
 
+#include "lib/uuid.h"
 #include "src/eir.h"
 
 struct test_data {
@@ -536,30 +537,39 @@ static void test_basic(void)
 	memset(&data, 0, sizeof(data));
 
 	eir_parse(&data, buf, HCI_MAX_EIR_LENGTH);
-	g_assert(data.services == NULL);
+	g_assert(data.uuid_count == 0);
 	g_assert(data.name == NULL);
 
 	eir_data_free(&data);
 }
 
+static void uuid_to_string128(const bt_uuid_t *uuid, char *str, size_t n)
+{
+	bt_uuid_t uuid128;
+
+	bt_uuid_to_uuid128(uuid, &uuid128);
+	bt_uuid_to_string(&uuid128, str, n);
+}
+
 static void test_parsing(gconstpointer data)
 {
 	const struct test_data *test = data;
 	struct eir_data eir;
+	char uuid_str[MAX_LEN_UUID_STR];
+	unsigned int i;
 
 	memset(&eir, 0, sizeof(eir));
 
 	eir_parse(&eir, test->eir_data, test->eir_size);
 
 	if (g_test_verbose() == TRUE) {
-		GSList *list;
-
 		g_print("Flags: %d\n", eir.flags);
 		g_print("Name: %s\n", eir.name);
 		g_print("TX power: %d\n", eir.tx_power);
 
-		for (list = eir.services; list; list = list->next) {
-			char *uuid_str = list->data;
+		for (i = 0; i < eir.uuid_count; i++) {
+			uuid_to_string128(&eir.uuids[i], uuid_str,
+							sizeof(uuid_str));
 			g_print("UUID: %s\n", uuid_str);
 		}
 	}
@@ -576,16 +586,16 @@ static void test_parsing(gconstpointer data)
 	g_assert(eir.tx_power == test->tx_power);
 
 	if (test->uuid) {
-		GSList *list;
-		int n = 0;
-
-		for (list = eir.services; list; list = list->next, n++) {
-			char *uuid_str = list->data;
-			g_assert(test->uuid[n]);
-			g_assert_cmpstr(test->uuid[n], ==, uuid_str);
+		for (i = 0; i < eir.uuid_count; i++) {
+			uuid_to_string128(&eir.uuids[i], uuid_str,
+							sizeof(uuid_str));
+			g_assert(test->uuid[i]);
+			g_assert_cmpstr(test->uuid[i], ==, uuid_str);
 		}
+
+		g_assert(test->uuid[i] == NULL);
 	} else {
-		g_assert(eir.services == NULL);
+		g_assert(eir.uuid_count == 0);
 	}
 
 	eir_data_free(&eir);
@@ -26,6 +26,7 @@
 #endif
 
 #include <stdbool.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
 
@@ -232,6 +233,105 @@ static void test_command(gconstpointer data)
 	execute_context(context);
 }
 
+/* Per controller events bluetoothd registers for in read_info_complete() */
+static const uint16_t adapter_events[] = {
+	MGMT_EV_NEW_SETTINGS, MGMT_EV_CLASS_OF_DEV_CHANGED,
+	MGMT_EV_LOCAL_NAME_CHANGED, MGMT_EV_DISCOVERING,
+	MGMT_EV_DEVICE_FOUND, MGMT_EV_DEVICE_DISCONNECTED,
+	MGMT_EV_DEVICE_CONNECTED, MGMT_EV_CONNECT_FAILED,
+	MGMT_EV_DEVICE_UNPAIRED, MGMT_EV_AUTH_FAILED,
+	MGMT_EV_NEW_LINK_KEY, MGMT_EV_NEW_LONG_TERM_KEY,
+	MGMT_EV_NEW_CSRK, MGMT_EV_NEW_IRK,
+	MGMT_EV_DEVICE_BLOCKED, MGMT_EV_DEVICE_UNBLOCKED,
+	MGMT_EV_PIN_CODE_REQUEST, MGMT_EV_USER_CONFIRM_REQUEST,
+	MGMT_EV_USER_PASSKEY_REQUEST, MGMT_EV_PASSKEY_NOTIFY,
+};
+
+/* Small enough batches to never block on the socket send buffer */
+#define DISPATCH_BATCH		64
+#define DISPATCH_ROUNDS		256
+
+struct dispatch_data {
+	GMainLoop *main_loop;
+	unsigned int received;
+	unsigned int expected;
+};
+
+static void dispatch_event(uint16_t index, uint16_t length,
+					const void *param, void *user_data)
+{
+	struct dispatch_data *data = user_data;
+
+	if (++data->received == data->expected)
+		g_main_loop_quit(data->main_loop);
+}
+
+/*
+ * Measure the cost of delivering a device found event to bluetoothd style
+ * handlers with a growing number of controllers. Only run with -m perf.
+ */
+static void test_dispatch(gconstpointer user_data)
+{
+	unsigned int controllers = GPOINTER_TO_UINT(user_data);
+	struct dispatch_data data;
+	struct mgmt *mgmt;
+	unsigned char pkt[MGMT_HDR_SIZE + sizeof(struct mgmt_ev_device_found)];
+	struct mgmt_hdr *hdr = (void *) pkt;
+	GTimer *timer;
+	double usec;
+	unsigned int i, j, round;
+	int err, sv[2];
+
+	err = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv);
+	g_assert(err == 0);
+
+	mgmt = mgmt_new(sv[1]);
+	g_assert(mgmt);
+
+	mgmt_set_close_on_unref(mgmt, true);
+
+	memset(&data, 0, sizeof(data));
+	data.main_loop = g_main_loop_new(NULL, FALSE);
+
+	for (i = 0; i < controllers; i++) {
+		for (j = 0; j < G_N_ELEMENTS(adapter_events); j++)
+			mgmt_register(mgmt, adapter_events[j], i,
+						dispatch_event, &data, NULL);
+	}
+
+	memset(pkt, 0, sizeof(pkt));
+	hdr->opcode = htobs(MGMT_EV_DEVICE_FOUND);
+	hdr->len = htobs(sizeof(struct mgmt_ev_device_found));
+
+	timer = g_timer_new();
+
+	for (round = 0; round < DISPATCH_ROUNDS; round++) {
+		data.expected += DISPATCH_BATCH;
+
+		for (i = 0; i < DISPATCH_BATCH; i++) {
+			hdr->index = htobs(i % controllers);
+			err = write(sv[0], pkt, sizeof(pkt));
+			g_assert(err == sizeof(pkt));
+		}
+
+		g_main_loop_run(data.main_loop);
+	}
+
+	g_timer_stop(timer);
+
+	usec = g_timer_elapsed(timer, NULL) * 1e6 / data.received;
+
+	g_test_minimized_result(usec, "%u controllers: %.3f us per event",
+							controllers, usec);
+
+	g_timer_destroy(timer);
+
+	mgmt_unref(mgmt);
+	close(sv[0]);
+
+	g_main_loop_unref(data.main_loop);
+}
+
 int main(int argc, char *argv[])
 {
 	g_test_init(&argc, &argv, NULL);
@@ -239,5 +339,18 @@ int main(int argc, char *argv[])
 	g_test_add_data_func("/mgmt/command/1", &command_test_1, test_command);
 	g_test_add_data_func("/mgmt/command/2", &command_test_2, test_command);
 
+	if (g_test_perf()) {
+		unsigned int count;
+
+		for (count = 1; count <= 16; count *= 2) {
+			char *path;
+
+			path = g_strdup_printf("/mgmt/dispatch/%u", count);
+			g_test_add_data_func(path, GUINT_TO_POINTER(count),
+							test_dispatch);
+			g_free(path);
+		}
+	}
+
 	return g_test_run();
 }
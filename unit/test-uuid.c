@@ -163,6 +163,106 @@ static void test_cmp(gconstpointer data)
 	g_assert(bt_uuid_cmp(&uuid1, &uuid2) == 0);
 }
 
+/* Strictly ascending, with 16, 32 and 128-bit forms interleaved */
+static const char *order[] = {
+	"00000000-0000-0000-0000-000000000000",
+	"0x0000",
+	"00000000-0000-1000-8000-00805F9B34FC",
+	"0x00001233",
+	"00001233-ffff-ffff-ffff-ffffffffffff",
+	"00001234-0000-1000-8000-00805F9B34FA",
+	"0x1234",
+	"00001234-0000-1000-8000-00805F9B34FC",
+	"0x00001235",
+	"0x2800",
+	"0x2803",
+	"0xffff",
+	"0x00010000",
+	"0x12345678",
+	"12345678-0000-1000-8000-00805F9B34FC",
+	"12345679-0000-0000-0000-000000000000",
+	"0xfffffffe",
+	"ffffffff-0000-0000-0000-000000000000",
+	"0xffffffff",
+	"ffffffff-ffff-ffff-ffff-ffffffffffff",
+	NULL,
+};
+
+/* Reference implementation: compare the 128-bit big-endian forms */
+static int uuid128_cmp(const bt_uuid_t *uuid1, const bt_uuid_t *uuid2)
+{
+	bt_uuid_t u1, u2;
+
+	bt_uuid_to_uuid128(uuid1, &u1);
+	bt_uuid_to_uuid128(uuid2, &u2);
+
+	return memcmp(&u1.value.u128, &u2.value.u128, sizeof(uint128_t));
+}
+
+static int sign(int val)
+{
+	return val < 0 ? -1 : val > 0;
+}
+
+static void test_cmp_order(void)
+{
+	int i, j;
+
+	for (i = 0; order[i]; i++) {
+		bt_uuid_t uuid1;
+
+		g_assert(bt_string_to_uuid(&uuid1, order[i]) == 0);
+
+		for (j = 0; order[j]; j++) {
+			bt_uuid_t uuid2;
+
+			g_assert(bt_string_to_uuid(&uuid2, order[j]) == 0);
+
+			g_assert_cmpint(sign(bt_uuid_cmp(&uuid1, &uuid2)), ==,
+							sign(i - j));
+			g_assert_cmpint(sign(bt_uuid_cmp(&uuid1, &uuid2)), ==,
+					sign(uuid128_cmp(&uuid1, &uuid2)));
+		}
+	}
+}
+
+#define CMP_ITERATIONS		(1 << 22)
+
+/*
+ * Measure bt_uuid_cmp() against expanding both operands, the way an ATT
+ * server search matches 16-bit attribute types. Only run with -m perf.
+ */
+static void test_cmp_perf(gconstpointer data)
+{
+	int (*cmp)(const bt_uuid_t *, const bt_uuid_t *) = data;
+	bt_uuid_t uuids[4];
+	GTimer *timer;
+	unsigned int i, matches = 0;
+	double nsec;
+
+	bt_uuid16_create(&uuids[0], GATT_PRIM_SVC_UUID);
+	bt_uuid16_create(&uuids[1], GATT_CHARAC_UUID);
+	bt_uuid16_create(&uuids[2], GATT_CLIENT_CHARAC_CFG_UUID);
+	g_assert(bt_string_to_uuid(&uuids[3], HEART_RATE_UUID) == 0);
+
+	timer = g_timer_new();
+
+	for (i = 0; i < CMP_ITERATIONS; i++) {
+		if (cmp(&uuids[i % 4], &uuids[(i / 4) % 4]) == 0)
+			matches++;
+	}
+
+	g_timer_stop(timer);
+
+	g_assert(matches == CMP_ITERATIONS / 4);
+
+	nsec = g_timer_elapsed(timer, NULL) * 1e9 / CMP_ITERATIONS;
+
+	g_test_minimized_result(nsec, "%.2f ns per comparison", nsec);
+
+	g_timer_destroy(timer);
+}
+
 static const char *malformed[] = {
 	"0",
 	"01",
@@ -216,6 +316,15 @@ int main(int argc, char *argv[])
 	g_test_add_data_func("/uuid/thritytwo2/str", &uuid_32_2, test_str);
 	g_test_add_data_func("/uuid/thirtytwo2/cmp", &uuid_32_2, test_cmp);
 
+	g_test_add_func("/uuid/cmp/order", test_cmp_order);
+
+	if (g_test_perf()) {
+		g_test_add_data_func("/uuid/cmp/perf/expand", uuid128_cmp,
+								test_cmp_perf);
+		g_test_add_data_func("/uuid/cmp/perf/fast", bt_uuid_cmp,
+								test_cmp_perf);
+	}
+
 	for (i = 0; malformed[i]; i++) {
 		char *testpath;
 